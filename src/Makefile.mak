@@ -1,11 +1,23 @@
 cc=cl.exe
 link=link.exe
-CFLAGS=/I ".\\"
+CFLAGS=/I ".\\" /O2
 
 all: squeezerw.exe
 
-squeezerw.exe: maxrects.obj squeezer.obj squeezerw.obj lodepng.obj imageops.obj
+squeezerw.exe: maxrects.obj skyline.obj guillotine.obj exact.obj predictor.obj squeezer.obj squeezerw.obj lodepng.obj imageops.obj sysops.obj
   $(link) -out:squeezerw.exe $**
 
+maxrectsbench.exe: maxrectsbench.obj maxrects.obj sysops.obj
+  $(link) -out:maxrectsbench.exe $**
+
+bench: maxrectsbench.exe
+  maxrectsbench.exe
+
+maxrectscheck.exe: maxrectscheck.obj maxrects.obj exact.obj sysops.obj
+  $(link) -out:maxrectscheck.exe $**
+
+check: maxrectscheck.exe
+  maxrectscheck.exe
+
 clean:
-  del squeezerw.exe maxrects.obj squeezer.obj squeezerw.obj lodepng.obj imageops.obj
+  del squeezerw.exe maxrectsbench.exe maxrectsbench.obj maxrectscheck.exe maxrectscheck.obj maxrects.obj skyline.obj guillotine.obj exact.obj predictor.obj squeezer.obj squeezerw.obj lodepng.obj imageops.obj sysops.obj
@@ -0,0 +1,868 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "exact.h"
+#include "sysops.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// The time limit is checked once every this many search nodes.
+#define EXACT_NODES_PER_CLOCK 1024
+
+// Slots of the table of skylines known to lead nowhere.
+#define EXACT_TABLE_SIZE (1 << 18)
+
+// One flat piece of the skyline: the bin is taken up to y over
+// [x, x + width). Neighbouring pieces never have the same y.
+typedef struct exactSegment {
+  int x;
+  int y;
+  int width;
+} exactSegment;
+
+// Inputs of one size, placed as interchangeable copies. With rotations
+// the width is the longer side, so both orientations share a class.
+typedef struct exactClass {
+  int width;
+  int height;
+  int count;
+  int remaining;
+} exactClass;
+
+typedef struct exactPlacement {
+  int sizeClass;
+  int x;
+  int y;
+  int width;
+  int height;
+} exactPlacement;
+
+typedef struct exactContext {
+  int width;
+  int height;
+  int rectCount;
+  maxRectsSize *rects;
+  int allowRotations:1;
+  int timedOut:1;
+  // Set when a rect may go anywhere along a gap, not only to its left end.
+  int allSpots:1;
+  exactClass *classes;
+  int classCount;
+  // Class of every input, -1 for the empty ones, which go to the corner.
+  int *classOf;
+  int searchCount;
+  unsigned long long rectArea;
+  exactPlacement *placements;
+  int placedCount;
+  // Area the layout may leave empty.
+  long long slack;
+  // One skyline per search depth, segmentCapacity pieces each.
+  exactSegment *skylines;
+  int *segmentCounts;
+  int segmentCapacity;
+  exactSegment *wells;
+  // Left edges a rect can have in a layout pushed down and left: each is
+  // the sum of the widths of the rects to its left.
+  char *spots;
+  // Classes by the narrowest side they can stand on.
+  int *narrowOrder;
+  // Hashes of skylines with the pending counts that were searched in
+  // vain; rects of equal height side by side reach the same skyline in
+  // either order.
+  unsigned long long *failedStates;
+  // Bins the search found too small; every bin that fits inside one of
+  // them is too small as well. Widths are kept in x, heights in y.
+  exactSegment *smallBins;
+  int smallBinCount;
+  int smallBinCapacity;
+  char *placed;
+  maxRectsPosition *results;
+  double deadline;
+  unsigned long long nodes;
+} exactContext;
+
+static int compareClasses(const void *first, const void *second) {
+  const exactClass *a = (const exactClass *)first;
+  const exactClass *b = (const exactClass *)second;
+  long long areaA = (long long)a->width * a->height;
+  long long areaB = (long long)b->width * b->height;
+  if (areaA != areaB) {
+    return areaA > areaB ? -1 : 1;
+  }
+  if (a->width != b->width) {
+    return a->width > b->width ? -1 : 1;
+  }
+  return a->height > b->height ? -1 : (a->height < b->height);
+}
+
+static void getClassSize(exactContext *ctx, maxRectsSize *rect, int *width,
+    int *height) {
+  if (ctx->allowRotations && rect->height > rect->width) {
+    *width = rect->height;
+    *height = rect->width;
+  } else {
+    *width = rect->width;
+    *height = rect->height;
+  }
+}
+
+// Narrowest side a class can stand on.
+static int getNarrowSide(exactContext *ctx, exactClass *sizeClass) {
+  return ctx->allowRotations ? sizeClass->height : sizeClass->width;
+}
+
+// Groups the inputs by size, biggest first, so the search tries the hard
+// to place ones early and never tries two copies of a size at one spot.
+static int initExact(exactContext *ctx) {
+  int rectCount = ctx->rectCount;
+  int i;
+  int j;
+  ctx->classes = (exactClass *)malloc(sizeof(exactClass) *
+    MAX(1, rectCount));
+  ctx->classOf = (int *)malloc(sizeof(int) * MAX(1, rectCount));
+  ctx->placements = (exactPlacement *)malloc(sizeof(exactPlacement) *
+    MAX(1, rectCount));
+  ctx->placed = (char *)malloc(MAX(1, rectCount));
+  ctx->results = (maxRectsPosition *)malloc(sizeof(maxRectsPosition) *
+    MAX(1, rectCount));
+  if (!ctx->classes || !ctx->classOf || !ctx->placements || !ctx->placed ||
+      !ctx->results) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (i = 0; i < rectCount; ++i) {
+    maxRectsSize *rect = &ctx->rects[i];
+    int width;
+    int height;
+    if (0 == rect->width || 0 == rect->height) {
+      continue;
+    }
+    getClassSize(ctx, rect, &width, &height);
+    for (j = 0; j < ctx->classCount; ++j) {
+      if (ctx->classes[j].width == width &&
+          ctx->classes[j].height == height) {
+        break;
+      }
+    }
+    if (j == ctx->classCount) {
+      ctx->classes[j].width = width;
+      ctx->classes[j].height = height;
+      ctx->classes[j].count = 0;
+      ++ctx->classCount;
+    }
+    ++ctx->classes[j].count;
+    ++ctx->searchCount;
+    ctx->rectArea += (unsigned long long)width * height;
+  }
+  qsort(ctx->classes, ctx->classCount, sizeof(exactClass), compareClasses);
+  for (i = 0; i < rectCount; ++i) {
+    maxRectsSize *rect = &ctx->rects[i];
+    int width;
+    int height;
+    ctx->classOf[i] = -1;
+    if (0 == rect->width || 0 == rect->height) {
+      continue;
+    }
+    getClassSize(ctx, rect, &width, &height);
+    for (j = 0; j < ctx->classCount; ++j) {
+      if (ctx->classes[j].width == width &&
+          ctx->classes[j].height == height) {
+        ctx->classOf[i] = j;
+        break;
+      }
+    }
+  }
+  // A placement adds at most two pieces to the skyline and leaving a gap
+  // empty merges at least two, so the search is at most three times as
+  // deep as there are inputs.
+  ctx->segmentCapacity = ctx->searchCount * 2 + 2;
+  ctx->skylines = (exactSegment *)malloc(sizeof(exactSegment) *
+    ctx->segmentCapacity * (ctx->searchCount * 3 + 2));
+  ctx->segmentCounts = (int *)malloc(sizeof(int) *
+    (ctx->searchCount * 3 + 2));
+  ctx->wells = (exactSegment *)malloc(sizeof(exactSegment) *
+    ctx->segmentCapacity);
+  ctx->narrowOrder = (int *)malloc(sizeof(int) * MAX(1, ctx->classCount));
+  ctx->failedStates = (unsigned long long *)malloc(
+    sizeof(unsigned long long) * EXACT_TABLE_SIZE);
+  if (!ctx->skylines || !ctx->segmentCounts || !ctx->wells ||
+      !ctx->narrowOrder || !ctx->failedStates) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (i = 0; i < ctx->classCount; ++i) {
+    int narrow = getNarrowSide(ctx, &ctx->classes[i]);
+    for (j = i; j > 0 && getNarrowSide(ctx,
+        &ctx->classes[ctx->narrowOrder[j - 1]]) > narrow; --j) {
+      ctx->narrowOrder[j] = ctx->narrowOrder[j - 1];
+    }
+    ctx->narrowOrder[j] = i;
+  }
+  return 0;
+}
+
+static void releaseExact(exactContext *ctx) {
+  free(ctx->classes);
+  free(ctx->classOf);
+  free(ctx->placements);
+  free(ctx->placed);
+  free(ctx->results);
+  free(ctx->skylines);
+  free(ctx->segmentCounts);
+  free(ctx->wells);
+  free(ctx->narrowOrder);
+  free(ctx->failedStates);
+  free(ctx->smallBins);
+  memset(ctx, 0, sizeof(exactContext));
+}
+
+// Appends a piece, merging it into the last one when they are level.
+static void pushSegment(exactSegment *segments, int *count, int x, int y,
+    int width) {
+  if (*count > 0 && segments[*count - 1].y == y) {
+    segments[*count - 1].width += width;
+    return;
+  }
+  segments[*count].x = x;
+  segments[*count].y = y;
+  segments[*count].width = width;
+  ++*count;
+}
+
+// Copies the skyline of depth to depth + 1 with piece index replaced by
+// a width x height block at offset from its left end, the part left of
+// the block raised to left, or the whole piece raised to height when
+// width is 0.
+static void buildSkyline(exactContext *ctx, int depth, int index,
+    int offset, int left, int width, int height) {
+  exactSegment *segments = ctx->skylines + depth * ctx->segmentCapacity;
+  exactSegment *next = segments + ctx->segmentCapacity;
+  int count = ctx->segmentCounts[depth];
+  int nextCount = 0;
+  int i;
+  for (i = 0; i < count; ++i) {
+    exactSegment *segment = &segments[i];
+    if (i != index) {
+      pushSegment(next, &nextCount, segment->x, segment->y, segment->width);
+    } else if (0 == width) {
+      pushSegment(next, &nextCount, segment->x, height, segment->width);
+    } else {
+      if (offset > 0) {
+        pushSegment(next, &nextCount, segment->x, left, offset);
+      }
+      pushSegment(next, &nextCount, segment->x + offset,
+        segment->y + height, width);
+      if (offset + width < segment->width) {
+        pushSegment(next, &nextCount, segment->x + offset + width,
+          segment->y, segment->width - offset - width);
+      }
+    }
+  }
+  ctx->segmentCounts[depth + 1] = nextCount;
+}
+
+// Lower bound of the area the pending rects cannot cover, after Korf's
+// wasted space bound. Pieces too close to the top for the lowest rect are
+// lost whole. Below its lower neighbour a piece is a well only rects up
+// to its width fit into; filling the wells narrowest first with the area
+// of the rects that fit, what stays empty is lost too.
+static long long getWastedArea(exactContext *ctx, exactSegment *segments,
+    int count) {
+  exactSegment *wells = ctx->wells;
+  long long waste = 0;
+  long long carry = 0;
+  int wellCount = 0;
+  int minHeight = INT_MAX;
+  int next = 0;
+  int i;
+  int j;
+  for (i = 0; i < ctx->classCount; ++i) {
+    if (ctx->classes[i].remaining) {
+      minHeight = MIN(minHeight, ctx->classes[i].height);
+    }
+  }
+  for (i = 0; i < count; ++i) {
+    exactSegment *segment = &segments[i];
+    exactSegment well;
+    int top;
+    if (ctx->height - segment->y < minHeight) {
+      waste += (long long)segment->width * (ctx->height - segment->y);
+      continue;
+    }
+    top = MIN(i > 0 ? segments[i - 1].y : ctx->height,
+      i + 1 < count ? segments[i + 1].y : ctx->height);
+    // The well's depth is kept in y.
+    well.width = segment->width;
+    well.y = top - segment->y;
+    for (j = wellCount; j > 0 && wells[j - 1].width > well.width; --j) {
+      wells[j] = wells[j - 1];
+    }
+    wells[j] = well;
+    ++wellCount;
+  }
+  for (i = 0; i < wellCount; ++i) {
+    long long area = (long long)wells[i].width * wells[i].y;
+    for (; next < ctx->classCount; ++next) {
+      exactClass *sizeClass = &ctx->classes[ctx->narrowOrder[next]];
+      if (getNarrowSide(ctx, sizeClass) > wells[i].width) {
+        break;
+      }
+      carry += (long long)sizeClass->width * sizeClass->height *
+        sizeClass->remaining;
+    }
+    if (area > carry) {
+      waste += area - carry;
+      carry = 0;
+    } else {
+      carry -= area;
+    }
+  }
+  return waste;
+}
+
+// Hash of a skyline and the pending counts; both together also fix the
+// area left empty so far.
+static unsigned long long hashState(exactContext *ctx,
+    exactSegment *segments, int count) {
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  int i;
+  for (i = 0; i < count; ++i) {
+    hash = (hash ^ (unsigned int)segments[i].y) * 0x100000001b3ULL;
+    hash = (hash ^ (unsigned int)segments[i].width) * 0x100000001b3ULL;
+  }
+  for (i = 0; i < ctx->classCount; ++i) {
+    hash = (hash ^ (unsigned int)ctx->classes[i].remaining) *
+      0x100000001b3ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash ? hash : 1;
+}
+
+static int searchExact(exactContext *ctx, int depth, long long waste);
+
+// Places one pending size at offset along the floor of the gap at index,
+// in either orientation, and searches on. The part of the gap left of it
+// stays empty up to the lower of its left neighbour and the new block, so
+// away from the left end only a block taller than that neighbour has
+// something on its left to stop it sliding there. Returns as searchExact.
+static int placeInGap(exactContext *ctx, int depth, long long waste,
+    int index, int offset) {
+  exactSegment *segments = ctx->skylines + depth * ctx->segmentCapacity;
+  exactSegment *gap = &segments[index];
+  int result;
+  int i;
+  for (i = 0; i < ctx->classCount; ++i) {
+    exactClass *sizeClass = &ctx->classes[i];
+    int flip;
+    if (0 == sizeClass->remaining) {
+      continue;
+    }
+    for (flip = 0; flip < (ctx->allowRotations &&
+        sizeClass->width != sizeClass->height ? 2 : 1); ++flip) {
+      exactPlacement *placement = &ctx->placements[ctx->placedCount];
+      int width = flip ? sizeClass->height : sizeClass->width;
+      int height = flip ? sizeClass->width : sizeClass->height;
+      int left = MIN(index > 0 ? segments[index - 1].y : INT_MAX,
+        gap->y + height);
+      long long lost = (long long)offset * (left - gap->y);
+      if (offset + width > gap->width || gap->y + height > ctx->height ||
+          (offset > 0 && left == gap->y + height) ||
+          waste + lost > ctx->slack) {
+        continue;
+      }
+      placement->sizeClass = i;
+      placement->x = gap->x + offset;
+      placement->y = gap->y;
+      placement->width = width;
+      placement->height = height;
+      buildSkyline(ctx, depth, index, offset, left, width, height);
+      --sizeClass->remaining;
+      ++ctx->placedCount;
+      result = searchExact(ctx, depth + 1, waste + lost);
+      if (0 != result) {
+        return result;
+      }
+      --ctx->placedCount;
+      ++sizeClass->remaining;
+    }
+  }
+  return 0;
+}
+
+// Fills the lowest, leftmost gap of the skyline. Each pending size goes
+// first to the gap's left end, then the gap is left empty up to its lower
+// neighbour, and last, with allSpots, each size goes to every other spot
+// along the floor that a left edge can have. Every layout can be pushed
+// down and left until no rect moves. In such a layout the leftmost rect
+// on the gap's floor sits at one of those spots, and with no rect on its
+// floor the gap is empty up to its lower neighbour, since whatever lies
+// above would rest on nothing. A rect may still hang over the gap from
+// higher up and keep the one below it from the left end, which is why
+// the other spots are tried. So the search misses nothing. Returns 1 when
+// all inputs are placed, 0 when this branch fails and -1 when time ran
+// out.
+static int searchExact(exactContext *ctx, int depth, long long waste) {
+  exactSegment *segments = ctx->skylines + depth * ctx->segmentCapacity;
+  int count = ctx->segmentCounts[depth];
+  exactSegment *gap;
+  unsigned long long key;
+  int slot;
+  int lowest = 0;
+  int raise;
+  int offset;
+  int result = 0;
+  int i;
+  if (ctx->placedCount == ctx->searchCount) {
+    return 1;
+  }
+  if (0 == ++ctx->nodes % EXACT_NODES_PER_CLOCK && ctx->deadline > 0 &&
+      sysOpsGetTime() > ctx->deadline) {
+    ctx->timedOut = 1;
+    return -1;
+  }
+  if (waste + getWastedArea(ctx, segments, count) > ctx->slack) {
+    return 0;
+  }
+  key = hashState(ctx, segments, count);
+  slot = (int)(key & (EXACT_TABLE_SIZE - 1));
+  if (ctx->failedStates[slot] == key) {
+    return 0;
+  }
+  for (i = 1; i < count; ++i) {
+    if (segments[i].y < segments[lowest].y) {
+      lowest = i;
+    }
+  }
+  gap = &segments[lowest];
+  result = placeInGap(ctx, depth, waste, lowest, 0);
+  if (0 != result) {
+    return result;
+  }
+  // With a wall on both sides the gap spans the bin, and leaving it empty
+  // leaves no room for the rest.
+  raise = MIN(lowest > 0 ? segments[lowest - 1].y : INT_MAX,
+    lowest + 1 < count ? segments[lowest + 1].y : INT_MAX);
+  if (INT_MAX != raise &&
+      waste + (long long)gap->width * (raise - gap->y) <= ctx->slack) {
+    buildSkyline(ctx, depth, lowest, 0, 0, 0, raise);
+    result = searchExact(ctx, depth + 1,
+      waste + (long long)gap->width * (raise - gap->y));
+  }
+  for (offset = 1; 0 == result && ctx->allSpots && lowest > 0 &&
+      offset < gap->width && waste + offset <= ctx->slack; ++offset) {
+    if (ctx->spots[gap->x + offset]) {
+      result = placeInGap(ctx, depth, waste, lowest, offset);
+    }
+  }
+  if (0 == result) {
+    ctx->failedStates[slot] = key;
+  }
+  return result;
+}
+
+// Marks the sides that sums of rect widths, or heights, reach up to
+// maxSide; with rotations either side of a rect counts.
+static void markSums(exactContext *ctx, int maxSide, int heights,
+    char *sums) {
+  int i;
+  int side;
+  memset(sums, 0, maxSide + 1);
+  sums[0] = 1;
+  for (i = 0; i < ctx->rectCount; ++i) {
+    maxRectsSize *rect = &ctx->rects[i];
+    int first = heights ? rect->height : rect->width;
+    int second = ctx->allowRotations ? (heights ? rect->width :
+      rect->height) : first;
+    if (ctx->classOf[i] < 0) {
+      continue;
+    }
+    for (side = maxSide; side >= 0; --side) {
+      if (!sums[side]) {
+        continue;
+      }
+      if (side + first <= maxSide) {
+        sums[side + first] = 1;
+      }
+      if (side + second <= maxSide) {
+        sums[side + second] = 1;
+      }
+    }
+  }
+}
+
+// Hands every placement to an input of its class, in input order.
+static void fillExactResults(exactContext *ctx) {
+  int i;
+  int j;
+  memset(ctx->placed, 0, ctx->rectCount);
+  for (i = 0; i < ctx->rectCount; ++i) {
+    ctx->results[i].left = 0;
+    ctx->results[i].top = 0;
+    ctx->results[i].rotated = 0;
+  }
+  for (i = 0; i < ctx->placedCount; ++i) {
+    exactPlacement *placement = &ctx->placements[i];
+    for (j = 0; j < ctx->rectCount; ++j) {
+      if (!ctx->placed[j] && ctx->classOf[j] == placement->sizeClass) {
+        break;
+      }
+    }
+    ctx->placed[j] = 1;
+    ctx->results[j].left = placement->x;
+    ctx->results[j].top = placement->y;
+    ctx->results[j].rotated = placement->width != ctx->rects[j].width;
+  }
+}
+
+// Whether a width x height bin holds the rects; the layout is left in
+// ctx->results. Returns as exactPack.
+static int decideBin(exactContext *ctx, int width, int height) {
+  int i;
+  int result;
+  // The skyline fills wide bins much faster than tall ones, and with
+  // rotations a layout turned on its side fits the turned bin.
+  if (ctx->allowRotations && height > width) {
+    result = decideBin(ctx, height, width);
+    for (i = 0; 0 == result && i < ctx->rectCount; ++i) {
+      maxRectsPosition *position = &ctx->results[i];
+      int left = position->left;
+      position->left = position->top;
+      position->top = left;
+      position->rotated = !position->rotated &&
+        ctx->rects[i].width != ctx->rects[i].height;
+    }
+    return result;
+  }
+  if (ctx->deadline > 0 && sysOpsGetTime() > ctx->deadline) {
+    ctx->timedOut = 1;
+    return 2;
+  }
+  if (ctx->rectArea > (unsigned long long)width * height) {
+    return 1;
+  }
+  for (i = 0; i < ctx->classCount; ++i) {
+    exactClass *sizeClass = &ctx->classes[i];
+    if ((sizeClass->width > width || sizeClass->height > height) &&
+        (!ctx->allowRotations || sizeClass->height > width ||
+          sizeClass->width > height)) {
+      return 1;
+    }
+  }
+  for (i = 0; i < ctx->smallBinCount; ++i) {
+    if (width <= ctx->smallBins[i].x && height <= ctx->smallBins[i].y) {
+      return 1;
+    }
+  }
+  // Most bins that fit at all are found by a greedy pass long before the
+  // search would get there.
+  if (0 == maxRectsFill(width, height, ctx->rectCount, ctx->rects,
+      rectBestShortSideFit, ctx->allowRotations, ctx->results, ctx->placed,
+      0, 0, 0)) {
+    for (i = 0; i < ctx->rectCount && ctx->placed[i]; ++i) {
+    }
+    if (i == ctx->rectCount) {
+      return 0;
+    }
+  }
+  ctx->spots = (char *)malloc(width + 1);
+  if (!ctx->spots) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  markSums(ctx, width, 0, ctx->spots);
+  ctx->width = width;
+  ctx->height = height;
+  ctx->slack = (long long)width * height - (long long)ctx->rectArea;
+  ctx->placedCount = 0;
+  for (i = 0; i < ctx->classCount; ++i) {
+    ctx->classes[i].remaining = ctx->classes[i].count;
+  }
+  ctx->skylines[0].x = 0;
+  ctx->skylines[0].y = 0;
+  ctx->skylines[0].width = width;
+  ctx->segmentCounts[0] = 1;
+  // Filling gaps from their left end only finds most layouts that exist
+  // much sooner; every spot is needed to be sure there is none.
+  result = 0;
+  for (i = 0; i < 2 && 0 == result; ++i) {
+    ctx->allSpots = i;
+    memset(ctx->failedStates, 0,
+      sizeof(unsigned long long) * EXACT_TABLE_SIZE);
+    result = searchExact(ctx, 0, 0);
+  }
+  free(ctx->spots);
+  ctx->spots = 0;
+  if (result < 0) {
+    return 2;
+  }
+  if (0 == result) {
+    if (ctx->smallBinCount == ctx->smallBinCapacity) {
+      int capacity = MAX(8, ctx->smallBinCapacity * 2);
+      exactSegment *bins = (exactSegment *)realloc(ctx->smallBins,
+        sizeof(exactSegment) * capacity);
+      if (!bins) {
+        fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+        return -1;
+      }
+      ctx->smallBins = bins;
+      ctx->smallBinCapacity = capacity;
+    }
+    ctx->smallBins[ctx->smallBinCount].x = width;
+    ctx->smallBins[ctx->smallBinCount].y = height;
+    ++ctx->smallBinCount;
+    return 1;
+  }
+  fillExactResults(ctx);
+  return 0;
+}
+
+static void finishExact(exactContext *ctx, int width, int height,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  if (layoutResults) {
+    memcpy(layoutResults, ctx->results,
+      sizeof(maxRectsPosition) * ctx->rectCount);
+  }
+  if (occupancy) {
+    *occupancy = (float)((double)ctx->rectArea / ((double)width * height));
+  }
+}
+
+int exactPack(int width, int height, int rectCount, maxRectsSize *rects,
+    int allowRotations, double seconds, maxRectsPosition *layoutResults,
+    float *occupancy) {
+  exactContext contextStruct;
+  exactContext *ctx = &contextStruct;
+  int result;
+  memset(ctx, 0, sizeof(exactContext));
+  ctx->rectCount = rectCount;
+  ctx->rects = rects;
+  ctx->allowRotations = allowRotations;
+  ctx->deadline = seconds > 0 ? sysOpsGetTime() + seconds : 0;
+  if (0 != initExact(ctx)) {
+    releaseExact(ctx);
+    return -1;
+  }
+  result = decideBin(ctx, width, height);
+  if (0 == result) {
+    finishExact(ctx, width, height, layoutResults, occupancy);
+  }
+  releaseExact(ctx);
+  return result;
+}
+
+// Keeps the sides of candidates a layout can actually end at: the right
+// edge of a layout pushed to the left is a sum of rect sides, so a side
+// with no such sum above the previous candidate is never the smallest.
+static int filterSides(int count, const int *sides, const char *sums,
+    int *kept) {
+  int keptCount = 0;
+  int previous = 0;
+  int i;
+  for (i = 0; i < count; ++i) {
+    int side;
+    for (side = sides[i]; side > previous && !sums[side]; --side) {
+    }
+    if (side > previous) {
+      kept[keptCount++] = sides[i];
+    }
+    previous = sides[i];
+  }
+  return keptCount;
+}
+
+// Lowest height a bin of width needs for its tallest rect and its area,
+// or 0 when some rect fits no such bin.
+static int getMinimumHeight(exactContext *ctx, int width) {
+  long long height = (long long)((ctx->rectArea + width - 1) / width);
+  int i;
+  for (i = 0; i < ctx->classCount; ++i) {
+    exactClass *sizeClass = &ctx->classes[i];
+    if (sizeClass->width <= width) {
+      height = MAX(height, sizeClass->height);
+    } else if (ctx->allowRotations && sizeClass->height <= width) {
+      height = MAX(height, sizeClass->width);
+    } else {
+      return 0;
+    }
+  }
+  return (int)MIN(height, INT_MAX);
+}
+
+// Less area first, then closer to square, then narrower.
+static int isBetterBin(int width, int height, int otherWidth,
+    int otherHeight) {
+  unsigned long long area = (unsigned long long)width * height;
+  unsigned long long otherArea = (unsigned long long)otherWidth * otherHeight;
+  if (area != otherArea) {
+    return area < otherArea;
+  }
+  if (abs(width - height) != abs(otherWidth - otherHeight)) {
+    return abs(width - height) < abs(otherWidth - otherHeight);
+  }
+  return width < otherWidth;
+}
+
+// Orders widths from the square root of the rect area outwards, where the
+// smallest bins usually are, so a good bound prunes the others early.
+static void orderWidths(exactContext *ctx, int count, int *widths) {
+  double center = sqrt((double)ctx->rectArea);
+  int i;
+  int j;
+  for (i = 1; i < count; ++i) {
+    int width = widths[i];
+    for (j = i; j > 0 && fabs(widths[j - 1] - center) >
+        fabs(width - center); --j) {
+      widths[j] = widths[j - 1];
+    }
+    widths[j] = width;
+  }
+}
+
+// Bisects the heights of one width for the lowest that fits; every bin
+// that fits is better than the best so far, which it replaces.
+static int searchHeight(exactContext *ctx, int width, int heightCount,
+    const int *heights, int *bestWidth, int *bestHeight,
+    maxRectsPosition *layoutResults) {
+  int minHeight = getMinimumHeight(ctx, width);
+  int low = 0;
+  int high = heightCount - 1;
+  if (0 == minHeight) {
+    return 0;
+  }
+  while (low <= high && heights[low] < minHeight) {
+    ++low;
+  }
+  while (high >= low && *bestWidth > 0 &&
+      !isBetterBin(width, heights[high], *bestWidth, *bestHeight)) {
+    --high;
+  }
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    int result = decideBin(ctx, width, heights[middle]);
+    if (result > 1 || result < 0) {
+      return result;
+    }
+    if (0 == result) {
+      *bestWidth = width;
+      *bestHeight = heights[middle];
+      memcpy(layoutResults, ctx->results,
+        sizeof(maxRectsPosition) * ctx->rectCount);
+      high = middle - 1;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return 0;
+}
+
+int exactMinimumBin(int widthCount, const int *widths, int heightCount,
+    const int *heights, int square, int rectCount, maxRectsSize *rects,
+    int allowRotations, double seconds, int *width, int *height,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  exactContext contextStruct;
+  exactContext *ctx = &contextStruct;
+  int maxSide = MAX(widthCount > 0 ? widths[widthCount - 1] : 0,
+    heightCount > 0 ? heights[heightCount - 1] : 0);
+  char *sums = (char *)malloc(maxSide + 1);
+  char *heightSums = (char *)malloc(maxSide + 1);
+  int *keptWidths = (int *)malloc(sizeof(int) * MAX(1, widthCount));
+  int *keptHeights = (int *)malloc(sizeof(int) * MAX(1, heightCount));
+  int keptWidthCount;
+  int keptHeightCount;
+  int bestWidth = 0;
+  int bestHeight = 0;
+  int result = 0;
+  int i;
+  memset(ctx, 0, sizeof(exactContext));
+  ctx->rectCount = rectCount;
+  ctx->rects = rects;
+  ctx->allowRotations = allowRotations;
+  ctx->deadline = seconds > 0 ? sysOpsGetTime() + seconds : 0;
+  if (!sums || !heightSums || !keptWidths || !keptHeights) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    result = -1;
+  } else if (0 != initExact(ctx)) {
+    result = -1;
+  }
+  if (0 == result) {
+    markSums(ctx, maxSide, 0, sums);
+    markSums(ctx, maxSide, 1, heightSums);
+    keptHeightCount = filterSides(heightCount, heights, heightSums,
+      keptHeights);
+    // A square can shrink to a smaller one only if both of its sides can.
+    for (i = 0; square && i <= maxSide; ++i) {
+      sums[i] |= heightSums[i];
+    }
+    keptWidthCount = filterSides(widthCount, widths, sums, keptWidths);
+    if (!square) {
+      orderWidths(ctx, keptWidthCount, keptWidths);
+    }
+    for (i = 0; i < keptWidthCount && 0 == result; ++i) {
+      int side = keptWidths[i];
+      int minHeight;
+      if (!square) {
+        result = searchHeight(ctx, side, keptHeightCount, keptHeights,
+          &bestWidth, &bestHeight, layoutResults);
+        continue;
+      }
+      // Square sides grow, so the first that fits is the smallest.
+      minHeight = getMinimumHeight(ctx, side);
+      if (0 == minHeight || minHeight > side) {
+        continue;
+      }
+      result = decideBin(ctx, side, side);
+      if (0 == result) {
+        bestWidth = side;
+        bestHeight = side;
+        memcpy(layoutResults, ctx->results,
+          sizeof(maxRectsPosition) * rectCount);
+        break;
+      }
+      if (1 == result) {
+        result = 0;
+      }
+    }
+  }
+  if (0 == result) {
+    if (bestWidth > 0) {
+      *width = bestWidth;
+      *height = bestHeight;
+      finishExact(ctx, bestWidth, bestHeight, 0, occupancy);
+    } else {
+      result = 1;
+    }
+  }
+  releaseExact(ctx);
+  free(sums);
+  free(heightSums);
+  free(keptWidths);
+  free(keptHeights);
+  return result;
+}
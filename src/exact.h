@@ -0,0 +1,40 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef EXACT_H
+#define EXACT_H
+
+#include "maxrects.h"
+
+// Decides by branch and bound whether the rects fit a width x height bin.
+// Sprites of the same size are interchangeable and tried once, and a
+// branch stops as soon as the space it left empty is more than the bin
+// can spare. Returns 0 with a layout, 1 when no layout exists, 2 when
+// seconds ran out first (0 for no limit) and -1 on errors.
+int exactPack(int width, int height, int rectCount, maxRectsSize *rects,
+    int allowRotations, double seconds, maxRectsPosition *layoutResults,
+    float *occupancy);
+
+// Finds the smallest area box that holds the rects, with a width from
+// widths and a height from heights, both ascending; with square the box
+// has equal sides, taken from widths. Of equal areas the squarer box
+// wins. The box is returned in width and height, with results as for
+// exactPack.
+int exactMinimumBin(int widthCount, const int *widths, int heightCount,
+    const int *heights, int square, int rectCount, maxRectsSize *rects,
+    int allowRotations, double seconds, int *width, int *height,
+    maxRectsPosition *layoutResults, float *occupancy);
+
+#endif
@@ -0,0 +1,408 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "guillotine.h"
+#include "sysops.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+typedef struct guillotineRect {
+  int x;
+  int y;
+  int width;
+  int height;
+} guillotineRect;
+
+typedef struct guillotineOrder {
+  int area;
+  int longSide;
+  int index;
+} guillotineOrder;
+
+typedef struct guillotineContext {
+  int width;
+  int height;
+  int rectCount;
+  maxRectsSize *rects;
+  maxRectsPosition *layoutResults;
+  char *placed;
+  const unsigned int *areaLimit;
+  int usedWidth;
+  int usedHeight;
+  enum guillotineFreeRectChoiceHeuristic choice;
+  enum guillotineSplitHeuristic split;
+  int allowRotations:1;
+  int merge:1;
+  guillotineRect *freeRects;
+  int freeCount;
+  int freeCapacity;
+  guillotineOrder *order;
+} guillotineContext;
+
+static int addFreeRect(guillotineContext *ctx, int x, int y, int width,
+    int height) {
+  guillotineRect *rect;
+  if (width <= 0 || height <= 0) {
+    return 0;
+  }
+  if (ctx->freeCount == ctx->freeCapacity) {
+    int capacity = MAX(64, ctx->freeCapacity * 2);
+    guillotineRect *freeRects = (guillotineRect *)realloc(ctx->freeRects,
+      sizeof(guillotineRect) * capacity);
+    if (!freeRects) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    ctx->freeRects = freeRects;
+    ctx->freeCapacity = capacity;
+  }
+  rect = &ctx->freeRects[ctx->freeCount++];
+  rect->x = x;
+  rect->y = y;
+  rect->width = width;
+  rect->height = height;
+  return 0;
+}
+
+static void removeFreeRect(guillotineContext *ctx, int index) {
+  ctx->freeRects[index] = ctx->freeRects[--ctx->freeCount];
+}
+
+static void scoreFreeRect(guillotineContext *ctx, guillotineRect *freeRect,
+    int width, int height, int *score1, int *score2) {
+  int leftoverHoriz = freeRect->width - width;
+  int leftoverVert = freeRect->height - height;
+  switch (ctx->choice) {
+    case guillotineBestShortSideFit:
+      *score1 = MIN(leftoverHoriz, leftoverVert);
+      *score2 = MAX(leftoverHoriz, leftoverVert);
+      break;
+    case guillotineBestLongSideFit:
+      *score1 = MAX(leftoverHoriz, leftoverVert);
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+    default:
+      *score1 = freeRect->width * freeRect->height - width * height;
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+  }
+}
+
+// Returns the index of the chosen free rect, or -1 if nothing fits.
+static int findPositionForNewNode(guillotineContext *ctx, int width,
+    int height, guillotineRect *bestNode) {
+  int bestScore1 = INT_MAX;
+  int bestScore2 = INT_MAX;
+  int bestIndex = -1;
+  int i;
+  for (i = 0; i < ctx->freeCount; ++i) {
+    guillotineRect *freeRect = &ctx->freeRects[i];
+    int score1;
+    int score2;
+    if (freeRect->width >= width && freeRect->height >= height) {
+      scoreFreeRect(ctx, freeRect, width, height, &score1, &score2);
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestScore1 = score1;
+        bestScore2 = score2;
+        bestIndex = i;
+        bestNode->width = width;
+        bestNode->height = height;
+      }
+    }
+    if (ctx->allowRotations &&
+        freeRect->width >= height && freeRect->height >= width) {
+      scoreFreeRect(ctx, freeRect, height, width, &score1, &score2);
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestScore1 = score1;
+        bestScore2 = score2;
+        bestIndex = i;
+        bestNode->width = height;
+        bestNode->height = width;
+      }
+    }
+    // Nothing beats a perfect fit.
+    if (bestIndex >= 0 && 0 == bestScore1 && 0 == bestScore2) {
+      break;
+    }
+  }
+  if (bestIndex >= 0) {
+    bestNode->x = ctx->freeRects[bestIndex].x;
+    bestNode->y = ctx->freeRects[bestIndex].y;
+  }
+  return bestIndex;
+}
+
+// Whether to cut the leftover of freeRect horizontally, so the piece below
+// the placed rect spans the whole free rect width.
+static int splitHorizontally(guillotineContext *ctx, guillotineRect *freeRect,
+    guillotineRect *placedRect) {
+  int leftoverWidth = freeRect->width - placedRect->width;
+  int leftoverHeight = freeRect->height - placedRect->height;
+  switch (ctx->split) {
+    case guillotineSplitLongerLeftoverAxis:
+      return leftoverWidth > leftoverHeight;
+    case guillotineSplitMinimizeArea:
+      return placedRect->width * leftoverHeight >
+        leftoverWidth * placedRect->height;
+    case guillotineSplitMaximizeArea:
+      return placedRect->width * leftoverHeight <=
+        leftoverWidth * placedRect->height;
+    case guillotineSplitShorterAxis:
+      return freeRect->width <= freeRect->height;
+    case guillotineSplitLongerAxis:
+      return freeRect->width > freeRect->height;
+    default:
+      return leftoverWidth <= leftoverHeight;
+  }
+}
+
+// Joins free rect #index with any free rect that shares a whole edge with
+// it, repeatedly, since a merged rect may line up with another one.
+static void mergeFreeRect(guillotineContext *ctx, int index) {
+  int merged = 1;
+  while (merged) {
+    guillotineRect *rect = &ctx->freeRects[index];
+    int i;
+    merged = 0;
+    for (i = 0; i < ctx->freeCount; ++i) {
+      guillotineRect *other = &ctx->freeRects[i];
+      if (i == index) {
+        continue;
+      }
+      if (rect->x == other->x && rect->width == other->width &&
+          (rect->y + rect->height == other->y ||
+            other->y + other->height == rect->y)) {
+        rect->y = MIN(rect->y, other->y);
+        rect->height += other->height;
+        merged = 1;
+      } else if (rect->y == other->y && rect->height == other->height &&
+          (rect->x + rect->width == other->x ||
+            other->x + other->width == rect->x)) {
+        rect->x = MIN(rect->x, other->x);
+        rect->width += other->width;
+        merged = 1;
+      }
+      if (merged) {
+        // The last rect moves into the hole; follow #index if it was last.
+        if (index == ctx->freeCount - 1) {
+          index = i;
+        }
+        removeFreeRect(ctx, i);
+        break;
+      }
+    }
+  }
+}
+
+static int placeRect(guillotineContext *ctx, int freeIndex,
+    guillotineRect *placedRect) {
+  guillotineRect freeRect = ctx->freeRects[freeIndex];
+  int firstNew;
+  int i;
+  removeFreeRect(ctx, freeIndex);
+  firstNew = ctx->freeCount;
+  if (splitHorizontally(ctx, &freeRect, placedRect)) {
+    if (0 != addFreeRect(ctx, freeRect.x, placedRect->y + placedRect->height,
+          freeRect.width, freeRect.height - placedRect->height) ||
+        0 != addFreeRect(ctx, placedRect->x + placedRect->width, freeRect.y,
+          freeRect.width - placedRect->width, placedRect->height)) {
+      return -1;
+    }
+  } else {
+    if (0 != addFreeRect(ctx, freeRect.x, placedRect->y + placedRect->height,
+          placedRect->width, freeRect.height - placedRect->height) ||
+        0 != addFreeRect(ctx, placedRect->x + placedRect->width, freeRect.y,
+          freeRect.width - placedRect->width, freeRect.height)) {
+      return -1;
+    }
+  }
+  if (ctx->merge) {
+    // Merging only removes rects, so walk the new ones from the back.
+    for (i = ctx->freeCount - 1; i >= firstNew && i < ctx->freeCount; --i) {
+      mergeFreeRect(ctx, i);
+    }
+  }
+  return 0;
+}
+
+// Biggest area first, then longer side, then input order, so the result
+// does not depend on the qsort implementation.
+static int compareRectOrder(const void *first, const void *second) {
+  const guillotineOrder *a = (const guillotineOrder *)first;
+  const guillotineOrder *b = (const guillotineOrder *)second;
+  if (a->area != b->area) {
+    return a->area > b->area ? -1 : 1;
+  }
+  if (a->longSide != b->longSide) {
+    return a->longSide > b->longSide ? -1 : 1;
+  }
+  return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+static int initContext(guillotineContext *ctx) {
+  int i;
+  if (0 != addFreeRect(ctx, 0, 0, ctx->width, ctx->height)) {
+    return -1;
+  }
+  ctx->order = (guillotineOrder *)malloc(sizeof(guillotineOrder) *
+    MAX(ctx->rectCount, 1));
+  if (!ctx->order) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (i = 0; i < ctx->rectCount; ++i) {
+    maxRectsSize *size = &ctx->rects[i];
+    ctx->order[i].area = size->width * size->height;
+    ctx->order[i].longSide = MAX(size->width, size->height);
+    ctx->order[i].index = i;
+  }
+  qsort(ctx->order, ctx->rectCount, sizeof(guillotineOrder),
+    compareRectOrder);
+  return 0;
+}
+
+static void releaseContext(guillotineContext *ctx) {
+  free(ctx->freeRects);
+  free(ctx->order);
+  ctx->freeRects = 0;
+  ctx->order = 0;
+}
+
+// Tracks the bounding box of the placed rects; returns 1 once its area
+// passes the area limit, which another thread may lower meanwhile.
+static int isOverAreaLimit(guillotineContext *ctx, int right, int bottom) {
+  unsigned int limit;
+  ctx->usedWidth = MAX(ctx->usedWidth, right);
+  ctx->usedHeight = MAX(ctx->usedHeight, bottom);
+  if (!ctx->areaLimit) {
+    return 0;
+  }
+  limit = sysOpsAtomicLoad(ctx->areaLimit);
+  return limit > 0 &&
+    (unsigned long long)ctx->usedWidth * ctx->usedHeight > limit;
+}
+
+static int startLayout(guillotineContext *ctx) {
+  int i;
+  for (i = 0; i < ctx->rectCount; ++i) {
+    int rectIndex = ctx->order[i].index;
+    maxRectsSize *size = &ctx->rects[rectIndex];
+    maxRectsPosition *result = &ctx->layoutResults[rectIndex];
+    guillotineRect placedRect;
+    int freeIndex;
+    memset(&placedRect, 0, sizeof(placedRect));
+    freeIndex = findPositionForNewNode(ctx, size->width, size->height,
+      &placedRect);
+    if (freeIndex < 0) {
+      // Filling a page skips what does not fit.
+      if (ctx->placed) {
+        continue;
+      }
+      return -1;
+    }
+    if (0 != placeRect(ctx, freeIndex, &placedRect)) {
+      return -1;
+    }
+    if (ctx->placed) {
+      ctx->placed[rectIndex] = 1;
+    }
+    result->left = placedRect.x;
+    result->top = placedRect.y;
+    result->rotated = placedRect.width != size->width ||
+      placedRect.height != size->height;
+    if (isOverAreaLimit(ctx, placedRect.x + placedRect.width,
+        placedRect.y + placedRect.height)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int layoutRects(int width, int height, int rectCount,
+    maxRectsSize *rects, enum guillotineFreeRectChoiceHeuristic choice,
+    enum guillotineSplitHeuristic split, int allowRotations, int merge,
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, float *occupancy) {
+  guillotineContext contextStruct;
+  guillotineContext *ctx = &contextStruct;
+  int result;
+  memset(ctx, 0, sizeof(guillotineContext));
+  ctx->width = width;
+  ctx->height = height;
+  ctx->rectCount = rectCount;
+  ctx->rects = rects;
+  ctx->layoutResults = layoutResults;
+  ctx->placed = placed;
+  ctx->areaLimit = areaLimit;
+  if (placed) {
+    memset(placed, 0, rectCount);
+  }
+  ctx->choice = choice;
+  ctx->split = split;
+  ctx->allowRotations = allowRotations;
+  ctx->merge = merge;
+  if (0 != initContext(ctx)) {
+    releaseContext(ctx);
+    return -1;
+  }
+  result = startLayout(ctx);
+  if (0 != result) {
+    releaseContext(ctx);
+    return result;
+  }
+  if (occupancy) {
+    unsigned long long usedSurfaceArea = 0;
+    int i;
+    for (i = 0; i < rectCount; ++i) {
+      if (!placed || placed[i]) {
+        usedSurfaceArea += rects[i].width * rects[i].height;
+      }
+    }
+    *occupancy = (float)usedSurfaceArea / (width * height);
+  }
+  releaseContext(ctx);
+  return 0;
+}
+
+int guillotine(int width, int height, int rectCount, maxRectsSize *rects,
+    enum guillotineFreeRectChoiceHeuristic choice,
+    enum guillotineSplitHeuristic split, int allowRotations, int merge,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, choice, split,
+    allowRotations, merge, layoutResults, 0, 0, occupancy);
+}
+
+int guillotineFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum guillotineFreeRectChoiceHeuristic choice,
+    enum guillotineSplitHeuristic split, int allowRotations, int merge,
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, choice, split,
+    allowRotations, merge, layoutResults, placed, areaLimit, occupancy);
+}
@@ -0,0 +1,56 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef GUILLOTINE_H
+#define GUILLOTINE_H
+
+#include "maxrects.h"
+
+enum guillotineFreeRectChoiceHeuristic {
+  guillotineBestAreaFit, ///< -BAF: Picks the smallest free rect the rect fits into.
+  guillotineBestShortSideFit, ///< -BSSF: Picks the free rect with the smallest short side leftover.
+  guillotineBestLongSideFit ///< -BLSF: Picks the free rect with the smallest long side leftover.
+};
+
+enum guillotineSplitHeuristic {
+  guillotineSplitShorterLeftoverAxis, ///< -SLAS: Cuts along the shorter leftover side.
+  guillotineSplitLongerLeftoverAxis, ///< -LLAS: Cuts along the longer leftover side.
+  guillotineSplitMinimizeArea, ///< -MINAS: Keeps the bigger leftover in one piece, the smaller one is cut short.
+  guillotineSplitMaximizeArea, ///< -MAXAS: Keeps the smaller leftover in one piece.
+  guillotineSplitShorterAxis, ///< -SAS: Cuts along the shorter side of the free rect.
+  guillotineSplitLongerAxis ///< -LAS: Cuts along the longer side of the free rect.
+};
+
+// Packs the rects biggest first into a list of disjoint free rects, each
+// placement cutting its free rect in two. With merge, neighbouring free
+// rects that line up are joined again. Much cheaper than maxRects, since
+// there is no overlapping free rect upkeep. Fails quietly like maxRects
+// when the rects do not fit.
+int guillotine(int width, int height, int rectCount, maxRectsSize *rects,
+    enum guillotineFreeRectChoiceHeuristic choice,
+    enum guillotineSplitHeuristic split, int allowRotations, int merge,
+    maxRectsPosition *layoutResults, float *occupancy);
+
+// Like guillotine, but skips the rects that do not fit instead of failing,
+// for filling one page of a multi-page atlas; placed[i] is set to 1 for
+// every rect that got a position. With placed 0 it fails like guillotine.
+// areaLimit works as for maxRectsFill.
+int guillotineFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum guillotineFreeRectChoiceHeuristic choice,
+    enum guillotineSplitHeuristic split, int allowRotations, int merge,
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, float *occupancy);
+
+#endif
@@ -254,6 +254,31 @@ int imageOpsTrim(imageOpsImage *img, int *cropLeft, int *cropTop) {
   return 0;
 }
 
+int imageOpsCrop(imageOpsImage *img, int width, int height) {
+  unsigned char *newImageData;
+  if (width <= 0 || height <= 0 || width > img->width ||
+      height > img->height) {
+    fprintf(stderr, "%s: %dx%d is not inside the image\n", __FUNCTION__,
+      width, height);
+    return -1;
+  }
+  if (width == img->width && height == img->height) {
+    return 0;
+  }
+  newImageData = (unsigned char *)calloc(width * height, 4);
+  if (!newImageData) {
+    fprintf(stderr, "%s: calloc failed\n", __FUNCTION__);
+    return -1;
+  }
+  copyImageData(newImageData, 0, 0, width, img->imageData, 0, 0, img->width,
+    width, height);
+  free(img->imageData);
+  img->imageData = newImageData;
+  img->width = width;
+  img->height = height;
+  return 0;
+}
+
 int imageOpsGetWidth(imageOpsImage *img) {
   return img->width;
 }
@@ -268,3 +293,45 @@ int imageOpsComposite(imageOpsImage *dest, imageOpsImage *src,
     src->width, src->width, src->height);
   return 0;
 }
+
+int imageOpsClear(imageOpsImage *img, int left, int top, int width,
+    int height) {
+  int y;
+  if (left < 0 || top < 0 || width < 0 || height < 0 ||
+      left + width > img->width || top + height > img->height) {
+    fprintf(stderr, "%s: %dx%d at %d,%d is not inside the image\n",
+      __FUNCTION__, width, height, left, top);
+    return -1;
+  }
+  for (y = top; y < top + height; ++y) {
+    memset(img->imageData + (y * img->width + left) * 4, 0, width * 4);
+  }
+  return 0;
+}
+
+static const unsigned char *getPixel(imageOpsImage *img, unsigned int x,
+    unsigned int y) {
+  static const unsigned char transparent[4] = {0, 0, 0, 0};
+  if (x >= img->width || y >= img->height) {
+    return transparent;
+  }
+  return img->imageData + (y * img->width + x) * 4;
+}
+
+unsigned long long imageOpsCountChanged(imageOpsImage *img,
+    imageOpsImage *other) {
+  unsigned int width = img->width > other->width ? img->width : other->width;
+  unsigned int height = img->height > other->height ? img->height :
+    other->height;
+  unsigned long long changed = 0;
+  unsigned int x;
+  unsigned int y;
+  for (y = 0; y < height; ++y) {
+    for (x = 0; x < width; ++x) {
+      if (0 != memcmp(getPixel(img, x, y), getPixel(other, x, y), 4)) {
+        ++changed;
+      }
+    }
+  }
+  return changed;
+}
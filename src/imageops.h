@@ -26,10 +26,19 @@ int imageOpsAddBorder(imageOpsImage *img);
 imageOpsImage *imageOpsCreate(int width, int height);
 int imageOpsSave(imageOpsImage *img, const char *filename);
 int imageOpsTrim(imageOpsImage *img, int *cropLeft, int *cropTop);
+// Keeps the top left width x height of the image.
+int imageOpsCrop(imageOpsImage *img, int width, int height);
 void imageOpsDestroy(imageOpsImage *img);
 int imageOpsGetWidth(imageOpsImage *img);
 int imageOpsGetHeight(imageOpsImage *img);
 int imageOpsComposite(imageOpsImage *dest, imageOpsImage *src,
   int left, int top);
+// Makes a width x height region transparent black.
+int imageOpsClear(imageOpsImage *img, int left, int top, int width,
+  int height);
+// Pixels that differ between two images laid over each other at the top
+// left, over the box covering both; outside an image is transparent black.
+unsigned long long imageOpsCountChanged(imageOpsImage *img,
+  imageOpsImage *other);
 
 #endif
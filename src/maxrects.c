@@ -9,6 +9,7 @@
   This version is MIT Licensed.
 */
 #include "maxrects.h"
+#include "sysops.h"
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -25,6 +26,19 @@
 #endif
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+// The generic scoring loops are inlined into one copy per heuristic and
+// rotation mode, whatever the optimizer thinks of their size.
+#if defined(_MSC_VER)
+#define MAX_RECTS_INLINE static __forceinline
+#elif defined(__GNUC__)
+#define MAX_RECTS_INLINE static __inline__ __attribute__((always_inline))
+#else
+#define MAX_RECTS_INLINE static
+#endif
+
+// maxRectsUniform only handles inputs with at most this many distinct sizes.
+#define MAX_RECTS_UNIFORM_CLASSES 8
+
 typedef struct maxRectsRect {
   struct maxRectsRect *next;
   struct maxRectsRect *prev;
@@ -33,24 +47,209 @@ typedef struct maxRectsRect {
   int y;
   int width;
   int height;
-  int inFreeRectLink:1;
   int inUsedRectLink:1;
   int inInputRectLink:1;
 } maxRectsRect;
 
+typedef struct maxRectsRectBlock {
+  struct maxRectsRectBlock *next;
+  int capacity;
+  int used;
+  maxRectsRect rects[1];
+} maxRectsRectBlock;
+
+// Free rectangles are kept as a structure of arrays so the fit scan can
+// stream through them. Removal swaps the last rect into the hole.
+typedef struct maxRectsFreeList {
+  int *x;
+  int *y;
+  int *width;
+  int *height;
+  int *area;
+  int count;
+  int capacity;
+} maxRectsFreeList;
+
+// Placed rects bucketed by each edge coordinate, so contact scoring only
+// visits rects that actually share an edge line with the candidate.
+typedef struct maxRectsEdgeIndex {
+  int *leftHead;
+  int *rightHead;
+  int *topHead;
+  int *bottomHead;
+  int *x;
+  int *y;
+  int *width;
+  int *height;
+  int *nextLeft;
+  int *nextRight;
+  int *nextTop;
+  int *nextBottom;
+  int count;
+} maxRectsEdgeIndex;
+
+// A scored placement; order is freeIndex * 2, plus 1 when flipped, and -1
+// when nothing fits.
+typedef struct maxRectsCandidate {
+  int score1;
+  int score2;
+  int order;
+} maxRectsCandidate;
+
+#define MAX_RECTS_CACHED_CANDIDATES 8
+
+// The cheapest candidates of one input, sorted. Every free rect candidate
+// that is not listed scores at least (bound1, bound2), so the first entry
+// is the input's best until the list runs dry. An empty list with an
+// INT_MAX bound means nothing fits; with any other bound it is stale. When
+// the entries score the bound themselves, they are the first few of a
+// bigger tie and only hold until the next placement.
+typedef struct maxRectsCandidateList {
+  int count;
+  int bound1;
+  int bound2;
+  maxRectsCandidate entries[MAX_RECTS_CACHED_CANDIDATES + 1];
+} maxRectsCandidateList;
+
+// Pending inputs of one (width, height). They share a candidate list, and
+// classMembers[first] to classMembers[first + count - 1] holds them by
+// ascending rectOrder.
+typedef struct maxRectsSizeClass {
+  int width;
+  int height;
+  int first;
+  int count;
+} maxRectsSizeClass;
+
 typedef struct maxRectsContext {
   int width;
   int height;
   int rectCount;
   maxRectsSize *rects;
   maxRectsPosition *layoutResults;
+  char *placed;
+  const unsigned int *areaLimit;
+  // sysOpsGetTime to give up at, 0 for none, read every few placements.
+  double deadline;
+  int deadlineSteps;
+  int usedWidth;
+  int usedHeight;
+  // Set for an ordered layout: the rects to place, in this order.
+  const int *order;
+  int orderCount;
   enum maxRectsFreeRectChoiceHeuristic method;
   int allowRotations:1;
-  maxRectsRect *freeRectLink;
+  int beamSearch:1;
+  // Scoring loops of method and allowRotations.
+  const struct maxRectsKernels *kernels;
+  maxRectsFreeList freeList;
+  maxRectsFreeList splitList;
+  int *indexBuffer;
+  unsigned char *pruneMarks;
+  int scratchCapacity;
+  maxRectsEdgeIndex edgeIndex;
+  int *freeOrigin;
+  int *freeRemap;
+  maxRectsRect **classMembers;
+  maxRectsSizeClass *pendingClasses;
+  maxRectsCandidateList *pendingCandidates;
+  int pendingCount;
   maxRectsRect *usedRectLink;
   maxRectsRect *inputRectLink;
+  maxRectsRectBlock *rectBlocks;
+  maxRectsRect *recycledRects;
 } maxRectsContext;
 
+// Scoring loops specialised for one heuristic and rotation mode, see
+// MAX_RECTS_FREE_LIST_KERNELS. The contact point rule keeps no candidate
+// lists and only has findPosition.
+typedef struct maxRectsKernels {
+  void (*findPosition)(maxRectsContext *ctx, int width, int height,
+    maxRectsRect *bestNode, int *score1, int *score2);
+  void (*fillCandidates)(maxRectsFreeList *list,
+    maxRectsCandidateList *candidates, int width, int height);
+  void (*offerFreeRects)(maxRectsFreeList *list,
+    maxRectsCandidateList *candidates, int first, int width, int height);
+} maxRectsKernels;
+
+#define MAX_RECTS_BEAM_THREADS 64
+
+// One partial layout of a beam search. It owns its free rects and contact
+// edges, so it can be scored and extended without touching the others.
+typedef struct maxRectsBeamState {
+  maxRectsFreeList freeList;
+  maxRectsEdgeIndex edgeIndex;
+  // Inputs still pending in each size class.
+  int *pendingCounts;
+  // Placed rects in placement order, rectOrder as in the used rect link.
+  maxRectsRect *placedRects;
+  int placedCount;
+  // Sum of the primary scores of the placements, lower is better.
+  long long cost;
+  // Order independent hash of the placements, to drop the same layout
+  // reached in a different order.
+  unsigned long long hash;
+  int usedWidth;
+  int usedHeight;
+  int pruned:1;
+} maxRectsBeamState;
+
+// A state extended by the next input of one size class at its best spot.
+typedef struct maxRectsBeamChild {
+  int parent;
+  int sizeClass;
+  int score2;
+  int rectOrder;
+  long long cost;
+  unsigned long long hash;
+  maxRectsRect node;
+  // The last child kept from a parent takes over its storage.
+  int takesParent;
+} maxRectsBeamChild;
+
+// Scratch context of one thread; it borrows a state's free rects and
+// contact edges for the task at hand and owns none.
+typedef struct maxRectsBeamWorker {
+  struct maxRectsBeamSearch *beam;
+  maxRectsContext ctx;
+  // The batch of tasks the worker last took part in.
+  unsigned int generation;
+} maxRectsBeamWorker;
+
+typedef void (*maxRectsBeamTask)(struct maxRectsBeamSearch *beam,
+  maxRectsContext *ctx, int index);
+
+typedef struct maxRectsBeamSearch {
+  maxRectsContext *base;
+  int beamWidth;
+  maxRectsBeamState *states;
+  int stateCount;
+  maxRectsBeamState *nextStates;
+  // classCount slots per state, childCounts[i] of them used.
+  maxRectsBeamChild *children;
+  int *childCounts;
+  maxRectsBeamChild *selected;
+  int selectedCount;
+  unsigned long long *seenHashes;
+  int seenCapacity;
+  maxRectsBeamWorker *workers;
+  int workerCount;
+  // Workers past the first run on threads started once for the search,
+  // which wait on condition until generation moves on to a new batch.
+  sysOpsThread *threads[MAX_RECTS_BEAM_THREADS];
+  int threadCount;
+  sysOpsMutex *mutex;
+  sysOpsCondition *condition;
+  unsigned int generation;
+  int busyCount;
+  int stopping;
+  maxRectsBeamTask task;
+  int taskCount;
+  int nextTask;
+  // Set by any worker whose task in the batch ran out of memory.
+  unsigned int failed;
+} maxRectsBeamSearch;
+
 static void addRectToLink(maxRectsRect *rect, maxRectsRect **link) {
   rect->prev = 0;
   rect->next = *link;
@@ -60,16 +259,19 @@ static void addRectToLink(maxRectsRect *rect, maxRectsRect **link) {
   *link = rect;
 }
 
-static void freeRectOnLine(maxRectsRect *rect, long line) {
+static void freeRectOnLine(maxRectsContext *ctx, maxRectsRect *rect,
+    long line) {
   //printf("%s:%ld: 0x%08x\n", __FUNCTION__, line,
   //  (int)((char *)rect - (char *)0));
-  free(rect);
+  rect->next = ctx->recycledRects;
+  ctx->recycledRects = rect;
 }
 
-#define freeRect(rect) \
-  freeRectOnLine((rect), __LINE__)
+#define freeRect(ctx, rect) \
+  freeRectOnLine((ctx), (rect), __LINE__)
 
-static void removeRectFromLink(maxRectsRect *rect, maxRectsRect **link) {
+static void removeRectFromLink(maxRectsContext *ctx, maxRectsRect *rect,
+    maxRectsRect **link) {
   if (rect->prev) {
     rect->prev->next = rect->next;
   }
@@ -79,40 +281,17 @@ static void removeRectFromLink(maxRectsRect *rect, maxRectsRect **link) {
   if (rect == *link) {
     *link = rect->next;
   }
-  freeRect(rect);
+  freeRect(ctx, rect);
 }
 
-static void freeLink(maxRectsRect **link) {
-  while (*link) {
-    maxRectsRect *willDel = *link;
-    *link = willDel->next;
-    freeRect(willDel);
-  }
-}
-
-static void addRectToFreeRectLinkOnLine(maxRectsContext *ctx,
-    maxRectsRect *rect, long line) {
-  //printf("%s:%ld: 0x%08x\n", __FUNCTION__, line,
-  //  (int)((char *)rect - (char *)0));
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
-  rect->inFreeRectLink = 1;
-  addRectToLink(rect, &ctx->freeRectLink);
-}
-
-#define addRectToFreeRectLink(ctx, rect) \
-  addRectToFreeRectLinkOnLine((ctx), (rect), __LINE__)
-
 static void addRectToUsedRectLink(maxRectsContext *ctx, maxRectsRect *rect) {
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
+  assert(!rect->inInputRectLink && !rect->inUsedRectLink);
   rect->inUsedRectLink = 1;
   addRectToLink(rect, &ctx->usedRectLink);
 }
 
 static void addRectToInputRectLink(maxRectsContext *ctx, maxRectsRect *rect) {
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
+  assert(!rect->inInputRectLink && !rect->inUsedRectLink);
   rect->inInputRectLink = 1;
   addRectToLink(rect, &ctx->inputRectLink);
 }
@@ -122,15 +301,7 @@ static void removeAndFreeRectFromUsedRectLink(maxRectsContext *ctx,
   //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
   assert(rect->inUsedRectLink);
   rect->inUsedRectLink = 0;
-  removeRectFromLink(rect, &ctx->usedRectLink);
-}
-
-static void removeAndFreeRectFromFreeRectLink(maxRectsContext *ctx,
-    maxRectsRect *rect) {
-  //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
-  assert(rect->inFreeRectLink);
-  rect->inFreeRectLink = 0;
-  removeRectFromLink(rect, &ctx->freeRectLink);
+  removeRectFromLink(ctx, rect, &ctx->usedRectLink);
 }
 
 static void removeAndFreeRectFromInputRectLink(maxRectsContext *ctx,
@@ -138,16 +309,32 @@ static void removeAndFreeRectFromInputRectLink(maxRectsContext *ctx,
   //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
   assert(rect->inInputRectLink);
   rect->inInputRectLink = 0;
-  removeRectFromLink(rect, &ctx->inputRectLink);
+  removeRectFromLink(ctx, rect, &ctx->inputRectLink);
 }
 
-static maxRectsRect *createRectOnLine(int x, int y, int width, int height,
-    int rectOrder, long line) {
-  maxRectsRect *rect = (maxRectsRect *)calloc(1, sizeof(maxRectsRect));
-  if (!rect) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
-    return 0;
+static maxRectsRect *createRectOnLine(maxRectsContext *ctx, int x, int y,
+    int width, int height, int rectOrder, long line) {
+  maxRectsRect *rect = ctx->recycledRects;
+  if (rect) {
+    ctx->recycledRects = rect->next;
+  } else {
+    maxRectsRectBlock *block = ctx->rectBlocks;
+    if (!block || block->used == block->capacity) {
+      int capacity = block ? block->capacity * 2 : MAX(64, ctx->rectCount * 4);
+      block = (maxRectsRectBlock *)malloc(sizeof(maxRectsRectBlock) +
+        (capacity - 1) * sizeof(maxRectsRect));
+      if (!block) {
+        fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+        return 0;
+      }
+      block->next = ctx->rectBlocks;
+      block->capacity = capacity;
+      block->used = 0;
+      ctx->rectBlocks = block;
+    }
+    rect = &block->rects[block->used++];
   }
+  memset(rect, 0, sizeof(maxRectsRect));
   rect->x = x;
   rect->y = y;
   rect->width = width;
@@ -158,196 +345,492 @@ static maxRectsRect *createRectOnLine(int x, int y, int width, int height,
   return rect;
 }
 
-#define createRect(x, y, width, height, rectOrder) \
-  createRectOnLine((x), (y), (width), (height), (rectOrder), __LINE__)
+#define createRect(ctx, x, y, width, height, rectOrder) \
+  createRectOnLine((ctx), (x), (y), (width), (height), (rectOrder), __LINE__)
 
-maxRectsRect *findPositionForNewNodeBottomLeft(maxRectsContext *ctx,
-    int width, int height, int *bestY, int *bestX) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
+static int reserveFreeList(maxRectsFreeList *list, int capacity) {
+  int *buffer;
+  if (capacity <= list->capacity) {
     return 0;
   }
+  capacity = MAX(capacity, list->capacity * 2);
+  buffer = (int *)malloc(sizeof(int) * 5 * capacity);
+  if (!buffer) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  if (list->count) {
+    memcpy(buffer, list->x, sizeof(int) * list->count);
+    memcpy(buffer + capacity, list->y, sizeof(int) * list->count);
+    memcpy(buffer + capacity * 2, list->width, sizeof(int) * list->count);
+    memcpy(buffer + capacity * 3, list->height, sizeof(int) * list->count);
+    memcpy(buffer + capacity * 4, list->area, sizeof(int) * list->count);
+  }
+  free(list->x);
+  list->x = buffer;
+  list->y = buffer + capacity;
+  list->width = buffer + capacity * 2;
+  list->height = buffer + capacity * 3;
+  list->area = buffer + capacity * 4;
+  list->capacity = capacity;
+  return 0;
+}
 
-	*bestY = INT_MAX;
+static void releaseFreeList(maxRectsFreeList *list) {
+  free(list->x);
+  memset(list, 0, sizeof(maxRectsFreeList));
+}
 
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int topSideY = (int)loop->y + height;
-			if (topSideY < *bestY || (topSideY == *bestY && loop->x < *bestX)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestY = topSideY;
-				*bestX = (int)loop->x;
-			}
-		}
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int topSideY = (int)loop->y + width;
-			if (topSideY < *bestY || (topSideY == *bestY && loop->x < *bestX)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestY = topSideY;
-				*bestX = (int)loop->x;
-			}
-		}
-	}
-	return bestNode;
+static int addToFreeList(maxRectsFreeList *list, int x, int y, int width,
+    int height) {
+  int index;
+  if (list->count == list->capacity &&
+      0 != reserveFreeList(list, MAX(64, list->count + 1))) {
+    return -1;
+  }
+  index = list->count++;
+  list->x[index] = x;
+  list->y[index] = y;
+  list->width[index] = width;
+  list->height[index] = height;
+  list->area[index] = width * height;
+  return index;
+}
+
+static void removeFromFreeList(maxRectsFreeList *list, int index) {
+  int last = --list->count;
+  assert(index >= 0 && index <= last);
+  list->x[index] = list->x[last];
+  list->y[index] = list->y[last];
+  list->width[index] = list->width[last];
+  list->height[index] = list->height[last];
+  list->area[index] = list->area[last];
 }
 
-maxRectsRect *findPositionForNewNodeBestShortSideFit(maxRectsContext *ctx,
-    int width, int height, int *bestShortSideFit, int *bestLongSideFit)  {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
+static int reserveScratch(maxRectsContext *ctx, int capacity) {
+  int *indexBuffer;
+  unsigned char *pruneMarks;
+  int *freeOrigin;
+  int *freeRemap;
+  if (capacity <= ctx->scratchCapacity) {
     return 0;
   }
+  capacity = MAX(capacity, ctx->scratchCapacity * 2);
+  // The index buffer may already hold this placement's split indices.
+  indexBuffer = (int *)realloc(ctx->indexBuffer, sizeof(int) * capacity);
+  if (indexBuffer) {
+    ctx->indexBuffer = indexBuffer;
+  }
+  pruneMarks = (unsigned char *)realloc(ctx->pruneMarks, capacity);
+  if (pruneMarks) {
+    ctx->pruneMarks = pruneMarks;
+  }
+  freeOrigin = (int *)realloc(ctx->freeOrigin, sizeof(int) * capacity);
+  if (freeOrigin) {
+    ctx->freeOrigin = freeOrigin;
+  }
+  freeRemap = (int *)realloc(ctx->freeRemap, sizeof(int) * capacity);
+  if (freeRemap) {
+    ctx->freeRemap = freeRemap;
+  }
+  if (!indexBuffer || !pruneMarks || !freeOrigin || !freeRemap) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  ctx->scratchCapacity = capacity;
+  return 0;
+}
 
-	*bestShortSideFit = INT_MAX;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MAX_RECTS_SIMD_LANES 8
+typedef __m256i simdInt;
+#define simdLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define simdSet1(v) _mm256_set1_epi32(v)
+#define simdAdd(a, b) _mm256_add_epi32((a), (b))
+#define simdSub(a, b) _mm256_sub_epi32((a), (b))
+#define simdAnd(a, b) _mm256_and_si256((a), (b))
+#define simdOr(a, b) _mm256_or_si256((a), (b))
+#define simdGreater(a, b) _mm256_cmpgt_epi32((a), (b))
+#define simdSignMask(a) _mm256_movemask_ps(_mm256_castsi256_ps(a))
+#define simdSelect(mask, a, b) _mm256_blendv_epi8((b), (a), (mask))
+#define simdStore(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+#elif defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MAX_RECTS_SIMD_LANES 4
+typedef __m128i simdInt;
+#define simdLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define simdSet1(v) _mm_set1_epi32(v)
+#define simdAdd(a, b) _mm_add_epi32((a), (b))
+#define simdSub(a, b) _mm_sub_epi32((a), (b))
+#define simdAnd(a, b) _mm_and_si128((a), (b))
+#define simdOr(a, b) _mm_or_si128((a), (b))
+#define simdGreater(a, b) _mm_cmpgt_epi32((a), (b))
+#define simdSignMask(a) _mm_movemask_ps(_mm_castsi128_ps(a))
+#define simdSelect(mask, a, b) \
+  _mm_or_si128(_mm_and_si128((mask), (a)), _mm_andnot_si128((mask), (b)))
+#define simdStore(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#endif
 
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (shortSideFit < *bestShortSideFit ||
-          (shortSideFit == *bestShortSideFit &&
-            longSideFit < *bestLongSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
+// Scores placing a width x height rect at the top left corner of free rect
+// #index. The (score1, score2) pair is minimized lexicographically, INT_MAX
+// means it does not fit.
+MAX_RECTS_INLINE void scoreFreeRect(maxRectsFreeList *list, int index, int width,
+    int height, enum maxRectsFreeRectChoiceHeuristic method, int *score1,
+    int *score2) {
+  int leftoverHoriz = list->width[index] - width;
+  int leftoverVert = list->height[index] - height;
+  if (leftoverHoriz < 0 || leftoverVert < 0) {
+    *score1 = INT_MAX;
+    *score2 = INT_MAX;
+    return;
+  }
+  switch (method) {
+    case rectBestShortSideFit:
+      *score1 = MIN(leftoverHoriz, leftoverVert);
+      *score2 = MAX(leftoverHoriz, leftoverVert);
+      break;
+    case rectBestLongSideFit:
+      *score1 = MAX(leftoverHoriz, leftoverVert);
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+    case rectBestAreaFit:
+      *score1 = list->area[index] - width * height;
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+    default:
+      *score1 = list->y[index] + height;
+      *score2 = list->x[index];
+      break;
+  }
+}
 
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int flippedLeftoverHoriz = abs((int)loop->width - height);
-			int flippedLeftoverVert = abs((int)loop->height - width);
-			int flippedShortSideFit = MIN(flippedLeftoverHoriz, flippedLeftoverVert);
-			int flippedLongSideFit = MAX(flippedLeftoverHoriz, flippedLeftoverVert);
-
-			if (flippedShortSideFit < *bestShortSideFit ||
-          (flippedShortSideFit == *bestShortSideFit &&
-            flippedLongSideFit < *bestLongSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = flippedShortSideFit;
-				*bestLongSideFit = flippedLongSideFit;
-			}
-		}
-	}
-	return bestNode;
+#ifdef MAX_RECTS_SIMD_LANES
+// Scores one orientation against the free rects starting at #index and
+// returns a lane bit mask of the ones that fit and whose score1 is not
+// worse than best1. Only those have to be looked at by the scalar tie break.
+MAX_RECTS_INLINE int scoreFreeRectsSimd(maxRectsFreeList *list, int index,
+    simdInt width, simdInt height, simdInt area,
+    enum maxRectsFreeRectChoiceHeuristic method, simdInt best1,
+    simdInt *score1, simdInt *score2) {
+  simdInt leftoverHoriz = simdSub(simdLoad(list->width + index), width);
+  simdInt leftoverVert = simdSub(simdLoad(list->height + index), height);
+  simdInt horizIsShort = simdGreater(leftoverVert, leftoverHoriz);
+  simdInt shortSide = simdSelect(horizIsShort, leftoverHoriz, leftoverVert);
+  simdInt longSide = simdSelect(horizIsShort, leftoverVert, leftoverHoriz);
+  switch (method) {
+    case rectBestShortSideFit:
+      *score1 = shortSide;
+      *score2 = longSide;
+      break;
+    case rectBestLongSideFit:
+      *score1 = longSide;
+      *score2 = shortSide;
+      break;
+    case rectBestAreaFit:
+      *score1 = simdSub(simdLoad(list->area + index), area);
+      *score2 = shortSide;
+      break;
+    default:
+      *score1 = simdAdd(simdLoad(list->y + index), height);
+      *score2 = simdLoad(list->x + index);
+      break;
+  }
+  // A negative leftover on either side means it does not fit.
+  return ~(simdSignMask(simdOr(leftoverHoriz, leftoverVert)) |
+    simdSignMask(simdGreater(*score1, best1))) &
+    ((1 << MAX_RECTS_SIMD_LANES) - 1);
 }
+#endif
 
-maxRectsRect *findPositionForNewNodeBestLongSideFit(maxRectsContext *ctx,
-    int width, int height, int *bestShortSideFit, int *bestLongSideFit) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
+MAX_RECTS_INLINE maxRectsCandidate updateBestCandidate(maxRectsFreeList *list,
+    int index, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsCandidate best) {
+  int score1;
+  int score2;
+  scoreFreeRect(list, index, width, height, method, &score1, &score2);
+  if (score1 < best.score1 || (score1 == best.score1 && score2 < best.score2)) {
+    best.score1 = score1;
+    best.score2 = score2;
+    best.order = index * 2;
+  }
+  if (allowRotations) {
+    scoreFreeRect(list, index, height, width, method, &score1, &score2);
+    if (score1 < best.score1 ||
+        (score1 == best.score1 && score2 < best.score2)) {
+      best.score1 = score1;
+      best.score2 = score2;
+      best.order = index * 2 + 1;
+    }
   }
+  return best;
+}
 
-	*bestLongSideFit = INT_MAX;
+// Finds the first candidate with the smallest (score1, score2) pair, visiting
+// the free rects in order and each one upright before flipped.
+MAX_RECTS_INLINE maxRectsCandidate findBestCandidate(maxRectsFreeList *list,
+    int width, int height, enum maxRectsFreeRectChoiceHeuristic method,
+    int allowRotations) {
+  int count = list->count;
+  maxRectsCandidate best;
+  int i = 0;
+
+  best.score1 = INT_MAX;
+  best.score2 = INT_MAX;
+  best.order = -1;
+
+#ifdef MAX_RECTS_SIMD_LANES
+  {
+    simdInt vecWidth = simdSet1(width);
+    simdInt vecHeight = simdSet1(height);
+    simdInt vecArea = simdSet1(width * height);
+    simdInt best1 = simdSet1(best.score1);
+    for (; i + MAX_RECTS_SIMD_LANES <= count; i += MAX_RECTS_SIMD_LANES) {
+      simdInt upright1;
+      simdInt upright2;
+      simdInt flipped1;
+      simdInt flipped2;
+      int uprightMask = scoreFreeRectsSimd(list, i, vecWidth, vecHeight,
+        vecArea, method, best1, &upright1, &upright2);
+      int flippedMask = 0;
+      if (allowRotations) {
+        flippedMask = scoreFreeRectsSimd(list, i, vecHeight, vecWidth,
+          vecArea, method, best1, &flipped1, &flipped2);
+      }
+      if (uprightMask | flippedMask) {
+        // The best only improves inside the chunk, so lanes outside the
+        // masks cannot win and are skipped.
+        int lanes[4][MAX_RECTS_SIMD_LANES];
+        int lane;
+        simdStore(lanes[0], upright1);
+        simdStore(lanes[1], upright2);
+        if (flippedMask) {
+          simdStore(lanes[2], flipped1);
+          simdStore(lanes[3], flipped2);
+        }
+        for (lane = 0; lane < MAX_RECTS_SIMD_LANES; ++lane) {
+          if ((uprightMask & (1 << lane)) &&
+              (lanes[0][lane] < best.score1 ||
+                (lanes[0][lane] == best.score1 &&
+                  lanes[1][lane] < best.score2))) {
+            best.score1 = lanes[0][lane];
+            best.score2 = lanes[1][lane];
+            best.order = (i + lane) * 2;
+          }
+          if ((flippedMask & (1 << lane)) &&
+              (lanes[2][lane] < best.score1 ||
+                (lanes[2][lane] == best.score1 &&
+                  lanes[3][lane] < best.score2))) {
+            best.score1 = lanes[2][lane];
+            best.score2 = lanes[3][lane];
+            best.order = (i + lane) * 2 + 1;
+          }
+        }
+        best1 = simdSet1(best.score1);
+      }
+    }
+  }
+#endif
 
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (longSideFit < *bestLongSideFit ||
-          (longSideFit == *bestLongSideFit &&
-            shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
+  for (; i < count; ++i) {
+    best = updateBestCandidate(list, i, width, height, method, allowRotations,
+      best);
+  }
 
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int leftoverHoriz = abs((int)loop->width - height);
-			int leftoverVert = abs((int)loop->height - width);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (longSideFit < *bestLongSideFit ||
-          (longSideFit == *bestLongSideFit &&
-            shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
-	}
-	return bestNode;
+  return best;
 }
 
-maxRectsRect *findPositionForNewNodeBestAreaFit(maxRectsContext *ctx,
-    int width, int height, int *bestAreaFit, int *bestShortSideFit) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
+static void candidateToNode(maxRectsContext *ctx, maxRectsCandidate best,
+    int width, int height, maxRectsRect *bestNode) {
+  maxRectsFreeList *list = &ctx->freeList;
+  int i = best.order / 2;
+  memset(bestNode, 0, sizeof(maxRectsRect));
+  if (best.order < 0) {
+    return;
   }
+  bestNode->x = list->x[i];
+  bestNode->y = list->y[i];
+  if (best.order & 1) {
+    bestNode->width = height;
+    bestNode->height = width;
+  } else {
+    bestNode->width = width;
+    bestNode->height = height;
+  }
+}
 
-	*bestAreaFit = INT_MAX;
+static int candidateBefore(const maxRectsCandidate *a,
+    const maxRectsCandidate *b) {
+  return a->score1 < b->score1 || (a->score1 == b->score1 &&
+    (a->score2 < b->score2 ||
+      (a->score2 == b->score2 && a->order < b->order)));
+}
 
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		int areaFit = (int)loop->width * (int)loop->height - width * height;
+static void offerCandidate(maxRectsCandidateList *list, int score1,
+    int score2, int order) {
+  maxRectsCandidate candidate;
+  int i;
+  if (score1 > list->bound1 ||
+      (score1 == list->bound1 && score2 >= list->bound2)) {
+    return;
+  }
+  candidate.score1 = score1;
+  candidate.score2 = score2;
+  candidate.order = order;
+  for (i = list->count; i > 0 &&
+      candidateBefore(&candidate, &list->entries[i - 1]); --i) {
+    list->entries[i] = list->entries[i - 1];
+  }
+  list->entries[i] = candidate;
+  if (++list->count > MAX_RECTS_CACHED_CANDIDATES) {
+    // Drop the whole worst score group, so ties are never split by the
+    // bound and order changes cannot reshuffle them across it. A group
+    // that fills the list keeps its first entries, since candidates come
+    // in free rect order, and the next placement makes the list stale.
+    maxRectsCandidate *worst = &list->entries[list->count - 1];
+    list->bound1 = worst->score1;
+    list->bound2 = worst->score2;
+    if (list->entries[0].score1 == list->bound1 &&
+        list->entries[0].score2 == list->bound2) {
+      --list->count;
+      return;
+    }
+    while (list->count > 0 &&
+        list->entries[list->count - 1].score1 == list->bound1 &&
+        list->entries[list->count - 1].score2 == list->bound2) {
+      --list->count;
+    }
+  }
+}
 
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-
-			if (areaFit < *bestAreaFit ||
-          (areaFit == *bestAreaFit && shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestAreaFit = areaFit;
-			}
-		}
+// Offers the free rects from #first on to the candidate list of one input.
+MAX_RECTS_INLINE void offerFreeRects(maxRectsFreeList *freeList,
+    maxRectsCandidateList *list, int first, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations) {
+  int i;
+  for (i = first; i < freeList->count; ++i) {
+    int score1;
+    int score2;
+    scoreFreeRect(freeList, i, width, height, method, &score1, &score2);
+    if (INT_MAX != score1) {
+      offerCandidate(list, score1, score2, i * 2);
+    }
+    if (allowRotations) {
+      scoreFreeRect(freeList, i, height, width, method, &score1, &score2);
+      if (INT_MAX != score1) {
+        offerCandidate(list, score1, score2, i * 2 + 1);
+      }
+    }
+  }
+}
+
+// Rebuilds the candidate list of one input from the whole free list.
+MAX_RECTS_INLINE void fillCandidateList(maxRectsFreeList *list,
+    maxRectsCandidateList *candidates, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations) {
+  int count = list->count;
+  int i = 0;
+
+  candidates->count = 0;
+  candidates->bound1 = INT_MAX;
+  candidates->bound2 = INT_MAX;
+
+#ifdef MAX_RECTS_SIMD_LANES
+  {
+    simdInt vecWidth = simdSet1(width);
+    simdInt vecHeight = simdSet1(height);
+    simdInt vecArea = simdSet1(width * height);
+    simdInt bound1 = simdSet1(candidates->bound1);
+    for (; i + MAX_RECTS_SIMD_LANES <= count; i += MAX_RECTS_SIMD_LANES) {
+      simdInt upright1;
+      simdInt upright2;
+      simdInt flipped1;
+      simdInt flipped2;
+      int uprightMask = scoreFreeRectsSimd(list, i, vecWidth, vecHeight,
+        vecArea, method, bound1, &upright1, &upright2);
+      int flippedMask = 0;
+      if (allowRotations) {
+        flippedMask = scoreFreeRectsSimd(list, i, vecHeight, vecWidth,
+          vecArea, method, bound1, &flipped1, &flipped2);
+      }
+      if (uprightMask | flippedMask) {
+        int lanes[4][MAX_RECTS_SIMD_LANES];
+        int lane;
+        simdStore(lanes[0], upright1);
+        simdStore(lanes[1], upright2);
+        if (flippedMask) {
+          simdStore(lanes[2], flipped1);
+          simdStore(lanes[3], flipped2);
+        }
+        for (lane = 0; lane < MAX_RECTS_SIMD_LANES; ++lane) {
+          if (uprightMask & (1 << lane)) {
+            offerCandidate(candidates, lanes[0][lane], lanes[1][lane],
+              (i + lane) * 2);
+          }
+          if (flippedMask & (1 << lane)) {
+            offerCandidate(candidates, lanes[2][lane], lanes[3][lane],
+              (i + lane) * 2 + 1);
+          }
+        }
+        bound1 = simdSet1(candidates->bound1);
+      }
+    }
+  }
+#endif
 
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int leftoverHoriz = abs((int)loop->width - height);
-			int leftoverVert = abs((int)loop->height - width);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
+  offerFreeRects(list, candidates, i, width, height, method, allowRotations);
+}
 
-			if (areaFit < *bestAreaFit ||
-          (areaFit == *bestAreaFit && shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = shortSideFit;
-				*bestAreaFit = areaFit;
-			}
-		}
-	}
-	return bestNode;
+// Brings every pending input's candidate list up to date after a placement.
+// freeOrigin maps the first firstNew free rects back to their index before
+// the placement, oldCount of them existed then, and the rects from
+// firstNew on are new fragments.
+static void updatePendingCandidates(maxRectsContext *ctx, int oldCount,
+    int firstNew) {
+  int *remap = ctx->freeRemap;
+  int i;
+  int j;
+  for (i = 0; i < oldCount; ++i) {
+    remap[i] = -1;
+  }
+  for (i = 0; i < firstNew; ++i) {
+    remap[ctx->freeOrigin[i]] = i;
+  }
+  for (i = 0; i < ctx->pendingCount; ++i) {
+    maxRectsCandidateList *list = &ctx->pendingCandidates[i];
+    int width = ctx->pendingClasses[i].width;
+    int height = ctx->pendingClasses[i].height;
+    int kept = 0;
+    if (0 == list->count && INT_MAX != list->bound1) {
+      continue;
+    }
+    if (list->count > 0 &&
+        list->entries[list->count - 1].score1 == list->bound1 &&
+        list->entries[list->count - 1].score2 == list->bound2) {
+      list->count = 0;
+      continue;
+    }
+    for (j = 0; j < list->count; ++j) {
+      maxRectsCandidate candidate = list->entries[j];
+      int index = remap[candidate.order / 2];
+      int k;
+      if (index < 0) {
+        continue;
+      }
+      candidate.order = index * 2 + (candidate.order & 1);
+      for (k = kept; k > 0 &&
+          candidateBefore(&candidate, &list->entries[k - 1]); --k) {
+        list->entries[k] = list->entries[k - 1];
+      }
+      list->entries[k] = candidate;
+      ++kept;
+    }
+    list->count = kept;
+    ctx->kernels->offerFreeRects(&ctx->freeList, list, firstNew, width,
+      height);
+  }
 }
 
 /// Returns 0 if the two intervals i1 and i2 are disjoint, or the length of their overlap otherwise.
@@ -358,76 +841,229 @@ static int commonIntervalLength(int i1start, int i1end,
 	return MIN(i1end, i2end) - MAX(i1start, i2start);
 }
 
+static int createEdgeIndex(maxRectsEdgeIndex *index, int width, int height,
+    int capacity) {
+  int headCount = (width + 1) * 2 + (height + 1) * 2;
+  int *buffer = (int *)malloc(sizeof(int) * (headCount + capacity * 8));
+  if (!buffer) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  memset(buffer, -1, sizeof(int) * headCount);
+  index->leftHead = buffer;
+  index->rightHead = index->leftHead + width + 1;
+  index->topHead = index->rightHead + width + 1;
+  index->bottomHead = index->topHead + height + 1;
+  index->x = buffer + headCount;
+  index->y = index->x + capacity;
+  index->width = index->y + capacity;
+  index->height = index->width + capacity;
+  index->nextLeft = index->height + capacity;
+  index->nextRight = index->nextLeft + capacity;
+  index->nextTop = index->nextRight + capacity;
+  index->nextBottom = index->nextTop + capacity;
+  index->count = 0;
+  return 0;
+}
+
+static void releaseEdgeIndex(maxRectsEdgeIndex *index) {
+  free(index->leftHead);
+  memset(index, 0, sizeof(maxRectsEdgeIndex));
+}
+
+static void addToEdgeIndex(maxRectsEdgeIndex *index, maxRectsRect *rect) {
+  int i = index->count++;
+  index->x[i] = rect->x;
+  index->y[i] = rect->y;
+  index->width[i] = rect->width;
+  index->height[i] = rect->height;
+  index->nextLeft[i] = index->leftHead[rect->x];
+  index->leftHead[rect->x] = i;
+  index->nextRight[i] = index->rightHead[rect->x + rect->width];
+  index->rightHead[rect->x + rect->width] = i;
+  index->nextTop[i] = index->topHead[rect->y];
+  index->topHead[rect->y] = i;
+  index->nextBottom[i] = index->bottomHead[rect->y + rect->height];
+  index->bottomHead[rect->y + rect->height] = i;
+}
+
 static int contactPointScoreNode(maxRectsContext *ctx, int x, int y,
     int width, int height) {
-  maxRectsRect *loop;
+  maxRectsEdgeIndex *index = &ctx->edgeIndex;
+  int right = x + width;
+  int bottom = y + height;
+  int i;
 	int score = 0;
 
-	if (x == 0 || x + width == ctx->width)
+	if (x == 0 || right == ctx->width)
 		score += height;
-	if (y == 0 || y + height == ctx->height)
+	if (y == 0 || bottom == ctx->height)
 		score += width;
 
-	for(loop = ctx->usedRectLink; loop; loop = loop->next) {
-		if (loop->x == x + width || loop->x + loop->width == x)
-			score += commonIntervalLength((int)loop->y,
-        (int)loop->y + (int)loop->height,
-        y, y + height);
-		if (loop->y == y + height || loop->y + loop->height == y)
-			score += commonIntervalLength((int)loop->x,
-        (int)loop->x + (int)loop->width, x, x + width);
-	}
+  // Neighbours touching the candidate's right or left side.
+  for (i = index->leftHead[right]; i >= 0; i = index->nextLeft[i]) {
+    score += commonIntervalLength(index->y[i], index->y[i] + index->height[i],
+      y, bottom);
+  }
+  for (i = index->rightHead[x]; i >= 0; i = index->nextRight[i]) {
+    // A zero width rect can sit in both buckets; count it once.
+    if (index->x[i] != right) {
+      score += commonIntervalLength(index->y[i],
+        index->y[i] + index->height[i], y, bottom);
+    }
+  }
+  // Neighbours touching the candidate's bottom or top side.
+  for (i = index->topHead[bottom]; i >= 0; i = index->nextTop[i]) {
+    score += commonIntervalLength(index->x[i], index->x[i] + index->width[i],
+      x, right);
+  }
+  for (i = index->bottomHead[y]; i >= 0; i = index->nextBottom[i]) {
+    if (index->y[i] != bottom) {
+      score += commonIntervalLength(index->x[i],
+        index->x[i] + index->width[i], x, right);
+    }
+  }
 	return score;
 }
 
-maxRectsRect *findPositionForNewNodeContactPoint(maxRectsContext *ctx,
-    int width, int height, int *bestContactScore) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
-  }
+MAX_RECTS_INLINE void findPositionForNewNodeContactPoint(
+    maxRectsContext *ctx, maxRectsRect *bestNode, int width, int height,
+    int allowRotations, int *bestContactScore) {
+  maxRectsFreeList *list = &ctx->freeList;
+  int i;
+  memset(bestNode, 0, sizeof(maxRectsRect));
 
 	*bestContactScore = -1;
 
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
+	for (i = 0; i < list->count; ++i) {
+    int freeX = list->x[i];
+    int freeY = list->y[i];
+    int freeWidth = list->width[i];
+    int freeHeight = list->height[i];
 		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int score = contactPointScoreNode(ctx, (int)loop->x, (int)loop->y,
-        width, height);
+		if (freeWidth >= width && freeHeight >= height) {
+			int score = contactPointScoreNode(ctx, freeX, freeY, width, height);
 			if (score > *bestContactScore) {
-				bestNode->x = (int)loop->x;
-				bestNode->y = (int)loop->y;
+				bestNode->x = freeX;
+				bestNode->y = freeY;
 				bestNode->width = width;
 				bestNode->height = height;
 				*bestContactScore = score;
 			}
 		}
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int score = contactPointScoreNode(ctx, (int)loop->x, (int)loop->y,
-        height, width);
+		if (allowRotations && freeWidth >= height && freeHeight >= width) {
+			int score = contactPointScoreNode(ctx, freeX, freeY, height, width);
 			if (score > *bestContactScore) {
-				bestNode->x = (int)loop->x;
-				bestNode->y = (int)loop->y;
+				bestNode->x = freeX;
+				bestNode->y = freeY;
 				bestNode->width = height;
 				bestNode->height = width;
 				*bestContactScore = score;
 			}
 		}
 	}
-	return bestNode;
+}
+
+// Every free list heuristic and rotation mode gets its own copy of the
+// scoring loops with both fixed, so the heuristic switch and the rotation
+// tests fold away and the loops over the free rects never branch on the
+// configuration. A layout picks its copies once, in initContext.
+#define MAX_RECTS_FREE_LIST_KERNELS(name, method, allowRotations) \
+static void findPosition##name(maxRectsContext *ctx, int width, \
+    int height, maxRectsRect *bestNode, int *score1, int *score2) { \
+  maxRectsCandidate best = findBestCandidate(&ctx->freeList, width, \
+    height, method, allowRotations); \
+  *score1 = best.score1; \
+  *score2 = best.score2; \
+  candidateToNode(ctx, best, width, height, bestNode); \
+} \
+static void fillCandidates##name(maxRectsFreeList *list, \
+    maxRectsCandidateList *candidates, int width, int height) { \
+  fillCandidateList(list, candidates, width, height, method, \
+    allowRotations); \
+} \
+static void offerFreeRects##name(maxRectsFreeList *list, \
+    maxRectsCandidateList *candidates, int first, int width, int height) { \
+  offerFreeRects(list, candidates, first, width, height, method, \
+    allowRotations); \
+}
+
+// Contact scores are maximized, so they are negated for the minimizing
+// callers; there is no second score.
+#define MAX_RECTS_CONTACT_POINT_KERNELS(name, allowRotations) \
+static void findPosition##name(maxRectsContext *ctx, int width, \
+    int height, maxRectsRect *bestNode, int *score1, int *score2) { \
+  findPositionForNewNodeContactPoint(ctx, bestNode, width, height, \
+    allowRotations, score1); \
+  *score1 = -*score1; \
+  *score2 = INT_MAX; \
+}
+
+MAX_RECTS_FREE_LIST_KERNELS(ShortSide, rectBestShortSideFit, 0)
+MAX_RECTS_FREE_LIST_KERNELS(ShortSideRotated, rectBestShortSideFit, 1)
+MAX_RECTS_FREE_LIST_KERNELS(LongSide, rectBestLongSideFit, 0)
+MAX_RECTS_FREE_LIST_KERNELS(LongSideRotated, rectBestLongSideFit, 1)
+MAX_RECTS_FREE_LIST_KERNELS(Area, rectBestAreaFit, 0)
+MAX_RECTS_FREE_LIST_KERNELS(AreaRotated, rectBestAreaFit, 1)
+MAX_RECTS_FREE_LIST_KERNELS(BottomLeft, rectBottomLeftRule, 0)
+MAX_RECTS_FREE_LIST_KERNELS(BottomLeftRotated, rectBottomLeftRule, 1)
+MAX_RECTS_CONTACT_POINT_KERNELS(ContactPoint, 0)
+MAX_RECTS_CONTACT_POINT_KERNELS(ContactPointRotated, 1)
+
+// By heuristic in enum order, then upright only and with rotations.
+static const maxRectsKernels kernelTable[][2] = {
+  {{findPositionShortSide, fillCandidatesShortSide, offerFreeRectsShortSide},
+    {findPositionShortSideRotated, fillCandidatesShortSideRotated,
+      offerFreeRectsShortSideRotated}},
+  {{findPositionLongSide, fillCandidatesLongSide, offerFreeRectsLongSide},
+    {findPositionLongSideRotated, fillCandidatesLongSideRotated,
+      offerFreeRectsLongSideRotated}},
+  {{findPositionArea, fillCandidatesArea, offerFreeRectsArea},
+    {findPositionAreaRotated, fillCandidatesAreaRotated,
+      offerFreeRectsAreaRotated}},
+  {{findPositionBottomLeft, fillCandidatesBottomLeft,
+      offerFreeRectsBottomLeft},
+    {findPositionBottomLeftRotated, fillCandidatesBottomLeftRotated,
+      offerFreeRectsBottomLeftRotated}},
+  {{findPositionContactPoint, 0, 0},
+    {findPositionContactPointRotated, 0, 0}}
+};
+
+static int compareClassMembers(const void *first, const void *second) {
+  const maxRectsRect *a = *(const maxRectsRect **)first;
+  const maxRectsRect *b = *(const maxRectsRect **)second;
+  if (a->width != b->width) {
+    return a->width < b->width ? -1 : 1;
+  }
+  if (a->height != b->height) {
+    return a->height < b->height ? -1 : 1;
+  }
+  return a->rectOrder < b->rectOrder ? -1 : (a->rectOrder > b->rectOrder);
 }
 
 static int initContext(maxRectsContext *ctx) {
   int i;
-  maxRectsRect *newRect = createRect(0, 0, ctx->width, ctx->height, 0);
-  if (!newRect) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+  maxRectsRect *newRect;
+  ctx->kernels = &kernelTable[ctx->method][ctx->allowRotations ? 1 : 0];
+  if (0 != reserveFreeList(&ctx->freeList, 64) ||
+      0 != reserveFreeList(&ctx->splitList, 64) ||
+      0 != reserveScratch(ctx, ctx->freeList.capacity)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "reserve failed");
     return -1;
   }
-  addRectToFreeRectLink(ctx, newRect);
+  if (rectContactPointRule == ctx->method &&
+      0 != createEdgeIndex(&ctx->edgeIndex, ctx->width, ctx->height,
+        ctx->rectCount)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "createEdgeIndex failed");
+    return -1;
+  }
+  addToFreeList(&ctx->freeList, 0, 0, ctx->width, ctx->height);
+  // An ordered layout scores one rect at a time and needs no input link.
+  if (ctx->order) {
+    return 0;
+  }
   for (i = 0; i < ctx->rectCount; ++i) {
-    newRect = createRect(0, 0, ctx->rects[i].width,
+    newRect = createRect(ctx, 0, 0, ctx->rects[i].width,
         ctx->rects[i].height, i + 1);
     if (!newRect) {
       fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
@@ -435,13 +1071,81 @@ static int initContext(maxRectsContext *ctx) {
     }
     addRectToInputRectLink(ctx, newRect);
   }
+  // Contact scores change with every placement, so only the free list
+  // heuristics keep a candidate cache, one per size class. A beam search
+  // scores its own layouts and only needs the classes.
+  if ((rectContactPointRule != ctx->method || ctx->beamSearch) &&
+      ctx->rectCount > 0) {
+    ctx->classMembers = (maxRectsRect **)malloc(sizeof(maxRectsRect *) *
+      ctx->rectCount);
+    ctx->pendingClasses = (maxRectsSizeClass *)malloc(
+      sizeof(maxRectsSizeClass) * ctx->rectCount);
+    if (!ctx->beamSearch) {
+      ctx->pendingCandidates = (maxRectsCandidateList *)malloc(
+        sizeof(maxRectsCandidateList) * ctx->rectCount);
+    }
+    if (!ctx->classMembers || !ctx->pendingClasses ||
+        (!ctx->beamSearch && !ctx->pendingCandidates)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+      return -1;
+    }
+    i = 0;
+    for (newRect = ctx->inputRectLink; newRect; newRect = newRect->next) {
+      ctx->classMembers[i++] = newRect;
+    }
+    qsort(ctx->classMembers, ctx->rectCount, sizeof(maxRectsRect *),
+      compareClassMembers);
+    for (i = 0; i < ctx->rectCount; ++i) {
+      maxRectsSizeClass *sizeClass = &ctx->pendingClasses[ctx->pendingCount];
+      newRect = ctx->classMembers[i];
+      if (i > 0 && newRect->width == sizeClass[-1].width &&
+          newRect->height == sizeClass[-1].height) {
+        ++sizeClass[-1].count;
+        continue;
+      }
+      sizeClass->width = newRect->width;
+      sizeClass->height = newRect->height;
+      sizeClass->first = i;
+      sizeClass->count = 1;
+      // An empty list with a finite bound gets filled on first use.
+      if (ctx->pendingCandidates) {
+        ctx->pendingCandidates[ctx->pendingCount].count = 0;
+        ctx->pendingCandidates[ctx->pendingCount].bound1 = 0;
+      }
+      ++ctx->pendingCount;
+    }
+  }
   return 0;
 }
 
 static void releaseContext(maxRectsContext *ctx) {
-  freeLink(&ctx->usedRectLink);
-  freeLink(&ctx->freeRectLink);
-  freeLink(&ctx->inputRectLink);
+  while (ctx->rectBlocks) {
+    maxRectsRectBlock *willDel = ctx->rectBlocks;
+    ctx->rectBlocks = willDel->next;
+    free(willDel);
+  }
+  ctx->usedRectLink = 0;
+  ctx->inputRectLink = 0;
+  ctx->recycledRects = 0;
+  releaseFreeList(&ctx->freeList);
+  releaseFreeList(&ctx->splitList);
+  free(ctx->indexBuffer);
+  free(ctx->pruneMarks);
+  ctx->indexBuffer = 0;
+  ctx->pruneMarks = 0;
+  ctx->scratchCapacity = 0;
+  releaseEdgeIndex(&ctx->edgeIndex);
+  free(ctx->freeOrigin);
+  free(ctx->freeRemap);
+  ctx->freeOrigin = 0;
+  ctx->freeRemap = 0;
+  free(ctx->classMembers);
+  free(ctx->pendingClasses);
+  free(ctx->pendingCandidates);
+  ctx->classMembers = 0;
+  ctx->pendingClasses = 0;
+  ctx->pendingCandidates = 0;
+  ctx->pendingCount = 0;
 }
 
 static float getOccupany(maxRectsContext *ctx) {
@@ -454,208 +1158,397 @@ static float getOccupany(maxRectsContext *ctx) {
 	return (float)usedSurfaceArea / (ctx->width * ctx->height);
 }
 
-maxRectsRect *scoreRect(maxRectsContext *ctx, int width, int height,
-    enum maxRectsFreeRectChoiceHeuristic method, int *score1, int *score2) {
-	maxRectsRect *newNode = 0;
-	*score1 = INT_MAX;
-	*score2 = INT_MAX;
-	switch(method) {
-		case rectBestShortSideFit:
-      newNode = findPositionForNewNodeBestShortSideFit(ctx, width, height,
-        score1, score2);
-      break;
-		case rectBottomLeftRule:
-      newNode = findPositionForNewNodeBottomLeft(ctx, width, height,
-        score1, score2);
-      break;
-		case rectContactPointRule:
-      newNode = findPositionForNewNodeContactPoint(ctx, width, height, score1);
-			*score1 = -*score1; // Reverse since we are minimizing, but for contact point score bigger is better.
-			break;
-		case rectBestLongSideFit:
-      newNode = findPositionForNewNodeBestLongSideFit(ctx, width, height,
-        score2, score1);
-      break;
-		case rectBestAreaFit:
-      newNode = findPositionForNewNodeBestAreaFit(ctx, width, height,
-        score1, score2);
-      break;
-	}
+static void scoreRect(maxRectsContext *ctx, int width, int height,
+    maxRectsRect *newNode, int *score1, int *score2) {
+  ctx->kernels->findPosition(ctx, width, height, newNode, score1, score2);
 
 	// Cannot fit the current rectangle.
-	if (!newNode || 0 == newNode->height) {
+	if (0 == newNode->height) {
 		*score1 = INT_MAX;
 		*score2 = INT_MAX;
 	}
-
-	return newNode;
 }
 
-int splitFreeNode(maxRectsContext *ctx, maxRectsRect *freeNode,
+static int splitFreeNode(maxRectsContext *ctx, int freeIndex,
     maxRectsRect *usedNode) {
+  maxRectsFreeList *list = &ctx->freeList;
+  int freeX = list->x[freeIndex];
+  int freeY = list->y[freeIndex];
+  int freeWidth = list->width[freeIndex];
+  int freeHeight = list->height[freeIndex];
+
 	// Test with SAT if the rectangles even intersect.
-	if (usedNode->x >= freeNode->x + freeNode->width ||
-      usedNode->x + usedNode->width <= freeNode->x ||
-		  usedNode->y >= freeNode->y + freeNode->height ||
-      usedNode->y + usedNode->height <= freeNode->y)
+	if (usedNode->x >= freeX + freeWidth ||
+      usedNode->x + usedNode->width <= freeX ||
+		  usedNode->y >= freeY + freeHeight ||
+      usedNode->y + usedNode->height <= freeY)
 		return 0;
 
-	if (usedNode->x < freeNode->x + freeNode->width &&
-      usedNode->x + usedNode->width > freeNode->x) {
+	if (usedNode->x < freeX + freeWidth &&
+      usedNode->x + usedNode->width > freeX) {
 		// New node at the top side of the used node.
-		if (usedNode->y > freeNode->y && usedNode->y <
-        freeNode->y + freeNode->height) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-			if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+		if (usedNode->y > freeY && usedNode->y < freeY + freeHeight) {
+      if (addToFreeList(&ctx->splitList, freeX, freeY, freeWidth,
+          usedNode->y - freeY) < 0) {
         return -1;
       }
-			newNode->height = usedNode->y - newNode->y;
-      addRectToFreeRectLink(ctx, newNode);
 		}
 
 		// New node at the bottom side of the used node.
-		if (usedNode->y + usedNode->height < freeNode->y + freeNode->height) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+		if (usedNode->y + usedNode->height < freeY + freeHeight) {
+      if (addToFreeList(&ctx->splitList, freeX,
+          usedNode->y + usedNode->height, freeWidth,
+          freeY + freeHeight - (usedNode->y + usedNode->height)) < 0) {
         return -1;
       }
-			newNode->y = usedNode->y + usedNode->height;
-			newNode->height = freeNode->y + freeNode->height -
-        (usedNode->y + usedNode->height);
-      addRectToFreeRectLink(ctx, newNode);
 		}
 	}
 
-	if (usedNode->y < freeNode->y + freeNode->height &&
-      usedNode->y + usedNode->height > freeNode->y) {
+	if (usedNode->y < freeY + freeHeight &&
+      usedNode->y + usedNode->height > freeY) {
 		// New node at the left side of the used node.
-		if (usedNode->x > freeNode->x && usedNode->x <
-        freeNode->x + freeNode->width) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+		if (usedNode->x > freeX && usedNode->x < freeX + freeWidth) {
+      if (addToFreeList(&ctx->splitList, freeX, freeY,
+          usedNode->x - freeX, freeHeight) < 0) {
         return -1;
       }
-			newNode->width = usedNode->x - newNode->x;
-			addRectToFreeRectLink(ctx, newNode);
 		}
 
 		// New node at the right side of the used node.
-		if (usedNode->x + usedNode->width <
-        freeNode->x + freeNode->width) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+		if (usedNode->x + usedNode->width < freeX + freeWidth) {
+      if (addToFreeList(&ctx->splitList, usedNode->x + usedNode->width,
+          freeY, freeX + freeWidth - (usedNode->x + usedNode->width),
+          freeHeight) < 0) {
         return -1;
       }
-			newNode->x = usedNode->x + usedNode->width;
-			newNode->width = freeNode->x + freeNode->width -
-        (usedNode->x + usedNode->width);
-			addRectToFreeRectLink(ctx, newNode);
 		}
 	}
 
 	return 1;
 }
 
-static int isContainedIn(maxRectsRect *a, maxRectsRect *b) {
-	return a->x >= b->x && a->y >= b->y &&
-		a->x + a->width <= b->x + b->width &&
-		a->y + a->height <= b->y + b->height;
-}
-
-static void pruneFreeList(maxRectsContext *ctx) {
-  maxRectsRect *outerLoop = ctx->freeRectLink;
-  while (outerLoop) {
-    maxRectsRect *innerLoop;
-    maxRectsRect *outer = outerLoop;
-    outerLoop = outerLoop->next;
-    innerLoop = outerLoop;
-    while (innerLoop) {
-      maxRectsRect *inner = innerLoop;
-      innerLoop = innerLoop->next;
-      if (isContainedIn(outer, inner)) {
-        removeAndFreeRectFromFreeRectLink(ctx, outer);
-				break;
-			}
-      if (isContainedIn(inner, outer)) {
-        if (inner == outerLoop) {
-          outerLoop = outerLoop->next;
+// Only the fragments from firstNew on need checking: the older rects were
+// already pruned against each other, and none of them can be contained in
+// a fragment, since each fragment lies inside an older rect that was.
+static void pruneFreeList(maxRectsContext *ctx, int firstNew) {
+  maxRectsFreeList *list = &ctx->freeList;
+  const int *xs = list->x;
+  const int *ys = list->y;
+  const int *widths = list->width;
+  const int *heights = list->height;
+  unsigned char *marks = ctx->pruneMarks;
+  int count = list->count;
+  int i;
+  int j;
+  memset(marks + firstNew, 0, count - firstNew);
+  // Mark every fragment contained in another rect; of two equal rects the
+  // earlier one goes.
+  for (i = firstNew; i < count; ++i) {
+    int left = xs[i];
+    int top = ys[i];
+    int right = left + widths[i];
+    int bottom = top + heights[i];
+    for (j = 0; j < count; ++j) {
+      int otherLeft = xs[j];
+      int otherTop = ys[j];
+      int otherRight = otherLeft + widths[j];
+      int otherBottom = otherTop + heights[j];
+      if (left >= otherLeft && top >= otherTop &&
+          right <= otherRight && bottom <= otherBottom && j != i &&
+          (j > i || left != otherLeft || top != otherTop ||
+            right != otherRight || bottom != otherBottom)) {
+        marks[i] = 1;
+        break;
+      }
+    }
+  }
+  // Remove from the back, so the rect swapped into a hole is never marked.
+  for (i = count - 1; i >= firstNew; --i) {
+    if (marks[i]) {
+      removeFromFreeList(list, i);
+    }
+  }
+}
+
+// Collects the free rects overlapping usedNode into indexBuffer, in
+// ascending order, and returns how many there are.
+static int findIntersectingFreeRects(maxRectsContext *ctx,
+    maxRectsRect *usedNode) {
+  maxRectsFreeList *list = &ctx->freeList;
+  int usedLeft = usedNode->x;
+  int usedTop = usedNode->y;
+  int usedRight = usedNode->x + usedNode->width;
+  int usedBottom = usedNode->y + usedNode->height;
+  int count = list->count;
+  int found = 0;
+  int i = 0;
+
+#ifdef MAX_RECTS_SIMD_LANES
+  {
+    simdInt vecLeft = simdSet1(usedLeft);
+    simdInt vecTop = simdSet1(usedTop);
+    simdInt vecRight = simdSet1(usedRight);
+    simdInt vecBottom = simdSet1(usedBottom);
+    for (; i + MAX_RECTS_SIMD_LANES <= count; i += MAX_RECTS_SIMD_LANES) {
+      simdInt freeLeft = simdLoad(list->x + i);
+      simdInt freeTop = simdLoad(list->y + i);
+      simdInt overlap = simdAnd(
+        simdAnd(simdGreater(simdAdd(freeLeft, simdLoad(list->width + i)),
+            vecLeft),
+          simdGreater(vecRight, freeLeft)),
+        simdAnd(simdGreater(simdAdd(freeTop, simdLoad(list->height + i)),
+            vecTop),
+          simdGreater(vecBottom, freeTop)));
+      int mask = simdSignMask(overlap);
+      while (mask) {
+        int lane = 0;
+        while (!(mask & (1 << lane))) {
+          ++lane;
         }
-        removeAndFreeRectFromFreeRectLink(ctx, inner);
+        mask &= ~(1 << lane);
+        ctx->indexBuffer[found++] = i + lane;
       }
     }
   }
+#endif
+
+  for (; i < count; ++i) {
+    if (usedLeft < list->x[i] + list->width[i] && usedRight > list->x[i] &&
+        usedTop < list->y[i] + list->height[i] && usedBottom > list->y[i]) {
+      ctx->indexBuffer[found++] = i;
+    }
+  }
+  return found;
 }
 
-static int placeRect(maxRectsContext *ctx, maxRectsRect *rect) {
-  maxRectsRect *loop = ctx->freeRectLink;
-  while (loop) {
-    maxRectsRect *freeNode = loop;
-    int splitResult = splitFreeNode(ctx, freeNode, rect);
-    if (splitResult < 0) {
+// Carves rect out of the free rects and adds it to the contact edges.
+static int occupyRect(maxRectsContext *ctx, maxRectsRect *rect) {
+  maxRectsFreeList *list = &ctx->freeList;
+  maxRectsFreeList *splitList = &ctx->splitList;
+  int removeCount = 0;
+  int oldCount = list->count;
+  int firstNew;
+  int i;
+  splitList->count = 0;
+  removeCount = findIntersectingFreeRects(ctx, rect);
+  for (i = 0; i < removeCount; ++i) {
+    if (splitFreeNode(ctx, ctx->indexBuffer[i], rect) < 0) {
       return -1;
     }
-    loop = loop->next;
-    if (splitResult) {
-      removeAndFreeRectFromFreeRectLink(ctx, freeNode);
-    }
   }
-  pruneFreeList(ctx);
+  if (0 != reserveFreeList(list, list->count + splitList->count) ||
+      0 != reserveScratch(ctx, list->capacity)) {
+    return -1;
+  }
+  for (i = 0; i < oldCount; ++i) {
+    ctx->freeOrigin[i] = i;
+  }
+  while (removeCount > 0) {
+    int index = ctx->indexBuffer[--removeCount];
+    ctx->freeOrigin[index] = ctx->freeOrigin[list->count - 1];
+    removeFromFreeList(list, index);
+  }
+  firstNew = list->count;
+  for (i = 0; i < splitList->count; ++i) {
+    addToFreeList(list, splitList->x[i], splitList->y[i],
+      splitList->width[i], splitList->height[i]);
+  }
+  pruneFreeList(ctx, firstNew);
+  if (ctx->pendingCandidates) {
+    updatePendingCandidates(ctx, oldCount, firstNew);
+  }
+  if (ctx->edgeIndex.leftHead) {
+    addToEdgeIndex(&ctx->edgeIndex, rect);
+  }
+  return 0;
+}
+
+static int placeRect(maxRectsContext *ctx, maxRectsRect *rect) {
+  if (0 != occupyRect(ctx, rect)) {
+    return -1;
+  }
   addRectToUsedRectLink(ctx, rect);
   return 0;
 }
 
+// Same choice as scoring every input with scoreRect, but from the cached
+// candidate lists of the size classes; the picked input leaves its class.
+static maxRectsRect *pickPendingRect(maxRectsContext *ctx,
+    maxRectsRect *bestNode) {
+  int bestScore1 = INT_MAX;
+  int bestScore2 = INT_MAX;
+  int bestOrder = 0;
+  int bestPending = -1;
+  maxRectsSizeClass *sizeClass;
+  maxRectsRect *bestRect;
+  int i;
+  for (i = 0; i < ctx->pendingCount; ++i) {
+    maxRectsSizeClass *candidateClass = &ctx->pendingClasses[i];
+    maxRectsCandidateList *list = &ctx->pendingCandidates[i];
+    maxRectsCandidate *first = &list->entries[0];
+    int rectOrder;
+    if (0 == list->count) {
+      if (INT_MAX == list->bound1) {
+        continue;
+      }
+      ctx->kernels->fillCandidates(&ctx->freeList, list,
+        candidateClass->width, candidateClass->height);
+      if (0 == list->count) {
+        continue;
+      }
+    }
+    // Cannot fit the current rectangle.
+    if (0 == ((first->order & 1) ? candidateClass->width :
+        candidateClass->height)) {
+      continue;
+    }
+    // The input link runs from the last input to the first, and a full
+    // scan keeps the first of equal scores, so ties go to the later input.
+    rectOrder = ctx->classMembers[candidateClass->first +
+      candidateClass->count - 1]->rectOrder;
+    if (first->score1 < bestScore1 ||
+        (first->score1 == bestScore1 && (first->score2 < bestScore2 ||
+          (first->score2 == bestScore2 && rectOrder > bestOrder)))) {
+      bestScore1 = first->score1;
+      bestScore2 = first->score2;
+      bestOrder = rectOrder;
+      bestPending = i;
+    }
+  }
+  if (bestPending < 0) {
+    return 0;
+  }
+  sizeClass = &ctx->pendingClasses[bestPending];
+  bestRect = ctx->classMembers[sizeClass->first + --sizeClass->count];
+  candidateToNode(ctx, ctx->pendingCandidates[bestPending].entries[0],
+    bestRect->width, bestRect->height, bestNode);
+  if (0 == sizeClass->count) {
+    // Classes are compared by rectOrder, so their order is free.
+    --ctx->pendingCount;
+    ctx->pendingClasses[bestPending] = ctx->pendingClasses[ctx->pendingCount];
+    ctx->pendingCandidates[bestPending] =
+      ctx->pendingCandidates[ctx->pendingCount];
+  }
+  return bestRect;
+}
+
+// Tracks the bounding box of the placed rects; returns 1 once its area
+// passes the area limit, which another thread may lower meanwhile.
+static int isOverAreaLimit(maxRectsContext *ctx, int right, int bottom) {
+  unsigned int limit;
+  ctx->usedWidth = MAX(ctx->usedWidth, right);
+  ctx->usedHeight = MAX(ctx->usedHeight, bottom);
+  if (!ctx->areaLimit) {
+    return 0;
+  }
+  limit = sysOpsAtomicLoad(ctx->areaLimit);
+  return limit > 0 &&
+    (unsigned long long)ctx->usedWidth * ctx->usedHeight > limit;
+}
+
+static int isPastDeadline(maxRectsContext *ctx) {
+  if (ctx->deadline <= 0 || 0 != (++ctx->deadlineSteps & 7)) {
+    return 0;
+  }
+  return sysOpsGetTime() >= ctx->deadline;
+}
+
 static int startLayout(maxRectsContext *ctx) {
   while (ctx->inputRectLink) {
     int bestScore1 = INT_MAX;
 		int bestScore2 = INT_MAX;
-    maxRectsRect *bestNode = 0;
+    maxRectsRect bestNode;
     maxRectsRect *bestRect = 0;
+    maxRectsRect *newRect;
     maxRectsRect *loop = ctx->inputRectLink;
+    if (ctx->pendingClasses) {
+      bestRect = pickPendingRect(ctx, &bestNode);
+      loop = 0;
+    }
     while (loop) {
       int score1 = 0;
 			int score2 = 0;
-      maxRectsRect *newRect = 0;
-      newRect = scoreRect(ctx, loop->width, loop->height, ctx->method,
-          &score1, &score2);
-      if (!newRect) {
-        return -1;
-      }
+      maxRectsRect candidate;
+      scoreRect(ctx, loop->width, loop->height, &candidate, &score1,
+        &score2);
       if (score1 < bestScore1 ||
           (score1 == bestScore1 && score2 < bestScore2)) {
 				bestScore1 = score1;
 				bestScore2 = score2;
-        if (bestNode) {
-          freeRect(bestNode);
-        }
         bestRect = loop;
-				bestNode = newRect;
-        newRect = 0;
+				bestNode = candidate;
 			}
-      if (newRect) {
-        freeRect(newRect);
-      }
       loop = loop->next;
     }
-    if (!bestNode) {
-      fprintf(stderr, "%s: %s\n", __FUNCTION__, "find bestRect failed");
+    // Running out of room is up to the caller to report; the auto size
+    // search hits it on every bin that is too small.
+    if (!bestRect) {
+      // Filling a page stops once nothing left fits.
+      if (ctx->placed) {
+        break;
+      }
+      return -1;
+    }
+    newRect = createRect(ctx, bestNode.x, bestNode.y, bestNode.width,
+      bestNode.height, 0);
+    if (!newRect) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
       return -1;
     }
-    if (bestNode->width != bestRect->width ||
-        bestNode->height != bestRect->height) {
-      bestNode->rectOrder = -bestRect->rectOrder;
+    if (newRect->width != bestRect->width ||
+        newRect->height != bestRect->height) {
+      newRect->rectOrder = -bestRect->rectOrder;
     } else {
-      bestNode->rectOrder = bestRect->rectOrder;
+      newRect->rectOrder = bestRect->rectOrder;
+    }
+    if (0 != placeRect(ctx, newRect)) {
+      return -1;
     }
-    placeRect(ctx, bestNode);
     removeAndFreeRectFromInputRectLink(ctx, bestRect);
+    if (isOverAreaLimit(ctx, newRect->x + newRect->width,
+        newRect->y + newRect->height)) {
+      return 1;
+    }
+    if (isPastDeadline(ctx)) {
+      return 2;
+    }
+  }
+  return 0;
+}
+
+// Places the rects one by one in the given order, each at the best spot
+// for it alone, and skips the ones that do not fit when filling a page.
+static int startOrderedLayout(maxRectsContext *ctx) {
+  int i;
+  for (i = 0; i < ctx->orderCount; ++i) {
+    int rectIndex = ctx->order[i];
+    maxRectsSize *size = &ctx->rects[rectIndex];
+    maxRectsRect bestNode;
+    maxRectsRect *newRect;
+    int score1;
+    int score2;
+    memset(&bestNode, 0, sizeof(bestNode));
+    scoreRect(ctx, size->width, size->height, &bestNode, &score1, &score2);
+    if (INT_MAX == score1) {
+      if (ctx->placed) {
+        continue;
+      }
+      return -1;
+    }
+    newRect = createRect(ctx, bestNode.x, bestNode.y, bestNode.width,
+      bestNode.height, bestNode.width != size->width ||
+        bestNode.height != size->height ? -(rectIndex + 1) : rectIndex + 1);
+    if (!newRect) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+      return -1;
+    }
+    if (0 != placeRect(ctx, newRect)) {
+      return -1;
+    }
+    if (isOverAreaLimit(ctx, newRect->x + newRect->width,
+        newRect->y + newRect->height)) {
+      return 1;
+    }
   }
   return 0;
 }
@@ -668,15 +1561,22 @@ static void fillResults(maxRectsContext *ctx) {
     result->left = loop->x;
     result->top = loop->y;
     result->rotated = loop->rectOrder < 0;
+    if (ctx->placed) {
+      ctx->placed[index] = 1;
+    }
     loop = loop->next;
   }
 }
 
-int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
+static int layoutRects(int width, int height, int rectCount,
+    maxRectsSize *rects, const int *order, int orderCount,
     enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
-    maxRectsPosition *layoutResults, float *occupancy) {
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, double deadline,
+    float *occupancy) {
   maxRectsContext contextStruct;
   maxRectsContext *ctx = &contextStruct;
+  int result;
   memset(ctx, 0, sizeof(maxRectsContext));
   ctx->width = width;
   ctx->height = height;
@@ -685,13 +1585,27 @@ int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
   ctx->rectCount = rectCount;
   ctx->rects = rects;
   ctx->layoutResults = layoutResults;
+  ctx->placed = placed;
+  ctx->areaLimit = areaLimit;
+  ctx->deadline = deadline;
+  ctx->order = order;
+  ctx->orderCount = orderCount;
+  if (placed && order) {
+    int i;
+    for (i = 0; i < orderCount; ++i) {
+      placed[order[i]] = 0;
+    }
+  } else if (placed) {
+    memset(placed, 0, rectCount);
+  }
   if (0 != initContext(ctx)) {
     releaseContext(ctx);
     return -1;
   }
-  if (0 != startLayout(ctx)) {
+  result = order ? startOrderedLayout(ctx) : startLayout(ctx);
+  if (0 != result) {
     releaseContext(ctx);
-    return -1;
+    return result;
   }
   if (occupancy) {
     *occupancy = getOccupany(ctx);
@@ -700,3 +1614,1000 @@ int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
   releaseContext(ctx);
   return 0;
 }
+
+static void releaseBeamState(maxRectsBeamState *state) {
+  releaseFreeList(&state->freeList);
+  releaseEdgeIndex(&state->edgeIndex);
+  free(state->pendingCounts);
+  free(state->placedRects);
+  memset(state, 0, sizeof(maxRectsBeamState));
+}
+
+static int allocBeamState(maxRectsBeamSearch *beam,
+    maxRectsBeamState *state) {
+  state->pendingCounts = (int *)malloc(sizeof(int) *
+    MAX(1, beam->base->pendingCount));
+  state->placedRects = (maxRectsRect *)malloc(sizeof(maxRectsRect) *
+    MAX(1, beam->base->rectCount));
+  if (!state->pendingCounts || !state->placedRects) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  return 0;
+}
+
+static int cloneFreeList(maxRectsFreeList *list,
+    const maxRectsFreeList *source) {
+  int count = source->count;
+  if (0 != reserveFreeList(list, MAX(64, count))) {
+    return -1;
+  }
+  memcpy(list->x, source->x, sizeof(int) * count);
+  memcpy(list->y, source->y, sizeof(int) * count);
+  memcpy(list->width, source->width, sizeof(int) * count);
+  memcpy(list->height, source->height, sizeof(int) * count);
+  memcpy(list->area, source->area, sizeof(int) * count);
+  list->count = count;
+  return 0;
+}
+
+static int cloneEdgeIndex(maxRectsEdgeIndex *index,
+    const maxRectsEdgeIndex *source, int width, int height, int capacity) {
+  int headCount = (width + 1) * 2 + (height + 1) * 2;
+  int count = source->count;
+  if (0 != createEdgeIndex(index, width, height, capacity)) {
+    return -1;
+  }
+  memcpy(index->leftHead, source->leftHead, sizeof(int) * headCount);
+  memcpy(index->x, source->x, sizeof(int) * count);
+  memcpy(index->y, source->y, sizeof(int) * count);
+  memcpy(index->width, source->width, sizeof(int) * count);
+  memcpy(index->height, source->height, sizeof(int) * count);
+  memcpy(index->nextLeft, source->nextLeft, sizeof(int) * count);
+  memcpy(index->nextRight, source->nextRight, sizeof(int) * count);
+  memcpy(index->nextTop, source->nextTop, sizeof(int) * count);
+  memcpy(index->nextBottom, source->nextBottom, sizeof(int) * count);
+  index->count = count;
+  return 0;
+}
+
+static int cloneBeamState(maxRectsBeamSearch *beam,
+    maxRectsBeamState *state, const maxRectsBeamState *source) {
+  maxRectsContext *base = beam->base;
+  if (0 != allocBeamState(beam, state) ||
+      0 != cloneFreeList(&state->freeList, &source->freeList) ||
+      (source->edgeIndex.leftHead &&
+        0 != cloneEdgeIndex(&state->edgeIndex, &source->edgeIndex,
+          base->width, base->height, base->rectCount))) {
+    releaseBeamState(state);
+    return -1;
+  }
+  memcpy(state->pendingCounts, source->pendingCounts,
+    sizeof(int) * base->pendingCount);
+  memcpy(state->placedRects, source->placedRects,
+    sizeof(maxRectsRect) * source->placedCount);
+  state->placedCount = source->placedCount;
+  state->cost = source->cost;
+  state->hash = source->hash;
+  state->usedWidth = source->usedWidth;
+  state->usedHeight = source->usedHeight;
+  return 0;
+}
+
+static unsigned long long hashBeamPlacement(int sizeClass,
+    const maxRectsRect *node) {
+  unsigned long long hash = (unsigned int)sizeClass;
+  hash = hash * 0x100000001b3ULL ^ (unsigned int)node->x;
+  hash = hash * 0x100000001b3ULL ^ (unsigned int)node->y;
+  hash = hash * 0x100000001b3ULL ^ (unsigned int)node->width;
+  hash = hash * 0x100000001b3ULL ^ (unsigned int)node->height;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Scores the next input of every pending size class against one state;
+// children over the area limit are dropped.
+static void expandBeamState(maxRectsBeamSearch *beam, maxRectsContext *ctx,
+    int index) {
+  maxRectsContext *base = beam->base;
+  maxRectsBeamState *state = &beam->states[index];
+  maxRectsBeamChild *children = beam->children + index * base->pendingCount;
+  unsigned int limit = base->areaLimit ?
+    sysOpsAtomicLoad(base->areaLimit) : 0;
+  int count = 0;
+  int i;
+  ctx->freeList = state->freeList;
+  ctx->edgeIndex = state->edgeIndex;
+  for (i = 0; i < base->pendingCount; ++i) {
+    maxRectsSizeClass *sizeClass = &base->pendingClasses[i];
+    maxRectsBeamChild *child = &children[count];
+    int pending = state->pendingCounts[i];
+    int score1;
+    int score2;
+    if (0 == pending) {
+      continue;
+    }
+    scoreRect(ctx, sizeClass->width, sizeClass->height, &child->node,
+      &score1, &score2);
+    if (INT_MAX == score1) {
+      continue;
+    }
+    if (limit > 0 && (unsigned long long)
+        MAX(state->usedWidth, child->node.x + child->node.width) *
+        MAX(state->usedHeight, child->node.y + child->node.height) > limit) {
+      state->pruned = 1;
+      continue;
+    }
+    child->parent = index;
+    child->sizeClass = i;
+    child->score2 = score2;
+    // Like the greedy loop, a class hands out its last input first.
+    child->rectOrder = base->classMembers[sizeClass->first +
+      pending - 1]->rectOrder;
+    child->cost = state->cost + score1;
+    child->hash = state->hash ^ hashBeamPlacement(i, &child->node);
+    child->takesParent = 0;
+    ++count;
+  }
+  beam->childCounts[index] = count;
+  memset(&ctx->freeList, 0, sizeof(maxRectsFreeList));
+  memset(&ctx->edgeIndex, 0, sizeof(maxRectsEdgeIndex));
+}
+
+// Ties go the way the greedy loop breaks them, then to the earlier parent,
+// so a beam of one places exactly like maxRects.
+static int compareBeamChildren(const void *first, const void *second) {
+  const maxRectsBeamChild *a = (const maxRectsBeamChild *)first;
+  const maxRectsBeamChild *b = (const maxRectsBeamChild *)second;
+  if (a->cost != b->cost) {
+    return a->cost < b->cost ? -1 : 1;
+  }
+  if (a->score2 != b->score2) {
+    return a->score2 < b->score2 ? -1 : 1;
+  }
+  if (a->rectOrder != b->rectOrder) {
+    return a->rectOrder > b->rectOrder ? -1 : 1;
+  }
+  return a->parent < b->parent ? -1 : (a->parent > b->parent);
+}
+
+// Adds child to the selection unless the same layout is already in it.
+static void selectBeamChild(maxRectsBeamSearch *beam,
+    const maxRectsBeamChild *child) {
+  unsigned long long hash = child->hash ? child->hash : 1;
+  int mask = beam->seenCapacity - 1;
+  int slot = (int)(hash & mask);
+  while (beam->seenHashes[slot] && beam->seenHashes[slot] != hash) {
+    slot = (slot + 1) & mask;
+  }
+  if (beam->seenHashes[slot]) {
+    return;
+  }
+  beam->seenHashes[slot] = hash;
+  beam->selected[beam->selectedCount++] = *child;
+}
+
+// Keeps the beamWidth cheapest children that are distinct layouts. The
+// first state always follows the greedy choice, so the beam ends with the
+// maxRects layout among its candidates and never does worse.
+static void selectBeamChildren(maxRectsBeamSearch *beam) {
+  int classCount = beam->base->pendingCount;
+  int greedy = 0;
+  int total = 0;
+  int i;
+  for (i = 0; i < beam->stateCount; ++i) {
+    memmove(beam->children + total, beam->children + i * classCount,
+      sizeof(maxRectsBeamChild) * beam->childCounts[i]);
+    total += beam->childCounts[i];
+  }
+  memset(beam->seenHashes, 0,
+    sizeof(unsigned long long) * beam->seenCapacity);
+  beam->selectedCount = 0;
+  for (i = 1; i < beam->childCounts[0]; ++i) {
+    if (compareBeamChildren(&beam->children[i],
+        &beam->children[greedy]) < 0) {
+      greedy = i;
+    }
+  }
+  if (beam->childCounts[0] > 0) {
+    selectBeamChild(beam, &beam->children[greedy]);
+  }
+  qsort(beam->children, total, sizeof(maxRectsBeamChild),
+    compareBeamChildren);
+  for (i = 0; i < total && beam->selectedCount < beam->beamWidth; ++i) {
+    selectBeamChild(beam, &beam->children[i]);
+  }
+  for (i = 0; i < beam->stateCount; ++i) {
+    beam->childCounts[i] = 0;
+  }
+  for (i = beam->selectedCount - 1; i >= 0; --i) {
+    maxRectsBeamChild *child = &beam->selected[i];
+    if (!beam->childCounts[child->parent]) {
+      beam->childCounts[child->parent] = 1;
+      child->takesParent = 1;
+    }
+  }
+}
+
+static void cloneBeamParent(maxRectsBeamSearch *beam, maxRectsContext *ctx,
+    int index) {
+  maxRectsBeamChild *child = &beam->selected[index];
+  (void)ctx;
+  if (!child->takesParent &&
+      0 != cloneBeamState(beam, &beam->nextStates[index],
+        &beam->states[child->parent])) {
+    sysOpsAtomicStore(&beam->failed, 1);
+  }
+}
+
+// Moves each parent's storage to its last kept child and frees the
+// parents nothing was kept from.
+static void takeBeamParents(maxRectsBeamSearch *beam) {
+  int i;
+  for (i = 0; i < beam->selectedCount; ++i) {
+    maxRectsBeamChild *child = &beam->selected[i];
+    if (child->takesParent) {
+      beam->nextStates[i] = beam->states[child->parent];
+      memset(&beam->states[child->parent], 0, sizeof(maxRectsBeamState));
+    }
+  }
+  for (i = 0; i < beam->stateCount; ++i) {
+    releaseBeamState(&beam->states[i]);
+  }
+}
+
+static void applyBeamChild(maxRectsBeamSearch *beam, maxRectsContext *ctx,
+    int index) {
+  maxRectsBeamChild *child = &beam->selected[index];
+  maxRectsBeamState *state = &beam->states[index];
+  maxRectsSizeClass *sizeClass =
+    &beam->base->pendingClasses[child->sizeClass];
+  maxRectsRect *rect = &state->placedRects[state->placedCount];
+  int result;
+  *rect = child->node;
+  if (rect->width != sizeClass->width || rect->height != sizeClass->height) {
+    rect->rectOrder = -child->rectOrder;
+  } else {
+    rect->rectOrder = child->rectOrder;
+  }
+  ctx->freeList = state->freeList;
+  ctx->edgeIndex = state->edgeIndex;
+  result = occupyRect(ctx, rect);
+  state->freeList = ctx->freeList;
+  state->edgeIndex = ctx->edgeIndex;
+  memset(&ctx->freeList, 0, sizeof(maxRectsFreeList));
+  memset(&ctx->edgeIndex, 0, sizeof(maxRectsEdgeIndex));
+  if (0 != result) {
+    sysOpsAtomicStore(&beam->failed, 1);
+    return;
+  }
+  ++state->placedCount;
+  --state->pendingCounts[child->sizeClass];
+  state->cost = child->cost;
+  state->hash = child->hash;
+  state->usedWidth = MAX(state->usedWidth, rect->x + rect->width);
+  state->usedHeight = MAX(state->usedHeight, rect->y + rect->height);
+  state->pruned = 0;
+}
+
+static void runBeamBatch(maxRectsBeamWorker *worker) {
+  maxRectsBeamSearch *beam = worker->beam;
+  for (;;) {
+    int index;
+    if (beam->mutex) {
+      sysOpsMutexLock(beam->mutex);
+    }
+    index = beam->nextTask++;
+    if (beam->mutex) {
+      sysOpsMutexUnlock(beam->mutex);
+    }
+    if (index >= beam->taskCount) {
+      break;
+    }
+    beam->task(beam, &worker->ctx, index);
+  }
+}
+
+static void runBeamWorker(void *param) {
+  maxRectsBeamWorker *worker = (maxRectsBeamWorker *)param;
+  maxRectsBeamSearch *beam = worker->beam;
+  sysOpsMutexLock(beam->mutex);
+  for (;;) {
+    while (!beam->stopping && worker->generation == beam->generation) {
+      sysOpsConditionWait(beam->condition, beam->mutex);
+    }
+    if (beam->stopping) {
+      break;
+    }
+    worker->generation = beam->generation;
+    sysOpsMutexUnlock(beam->mutex);
+    runBeamBatch(worker);
+    sysOpsMutexLock(beam->mutex);
+    if (0 == --beam->busyCount) {
+      sysOpsConditionBroadcast(beam->condition);
+    }
+  }
+  sysOpsMutexUnlock(beam->mutex);
+}
+
+// Runs task for every index below taskCount across the workers; the
+// calling thread is one of them. Returns -1 if any of the tasks failed.
+static int runBeamTasks(maxRectsBeamSearch *beam, maxRectsBeamTask task,
+    int taskCount) {
+  beam->task = task;
+  beam->taskCount = taskCount;
+  beam->nextTask = 0;
+  beam->failed = 0;
+  if (beam->threadCount > 0) {
+    sysOpsMutexLock(beam->mutex);
+    ++beam->generation;
+    beam->busyCount = beam->threadCount;
+    sysOpsConditionBroadcast(beam->condition);
+    sysOpsMutexUnlock(beam->mutex);
+  }
+  runBeamBatch(&beam->workers[0]);
+  if (beam->threadCount > 0) {
+    sysOpsMutexLock(beam->mutex);
+    while (beam->busyCount > 0) {
+      sysOpsConditionWait(beam->condition, beam->mutex);
+    }
+    sysOpsMutexUnlock(beam->mutex);
+  }
+  return sysOpsAtomicLoad(&beam->failed) ? -1 : 0;
+}
+
+static int initBeam(maxRectsBeamSearch *beam, int beamWidth,
+    int threadCount) {
+  maxRectsContext *base = beam->base;
+  maxRectsBeamState *state;
+  size_t childCount = (size_t)beamWidth * MAX(1, base->pendingCount);
+  int i;
+  beam->beamWidth = beamWidth;
+  beam->workerCount = MIN(threadCount, MAX_RECTS_BEAM_THREADS);
+  beam->seenCapacity = 16;
+  while (beam->seenCapacity < beamWidth * 2) {
+    beam->seenCapacity *= 2;
+  }
+  beam->states = (maxRectsBeamState *)calloc(beamWidth,
+    sizeof(maxRectsBeamState));
+  beam->nextStates = (maxRectsBeamState *)calloc(beamWidth,
+    sizeof(maxRectsBeamState));
+  beam->children = (maxRectsBeamChild *)malloc(sizeof(maxRectsBeamChild) *
+    childCount);
+  beam->childCounts = (int *)malloc(sizeof(int) * beamWidth);
+  beam->selected = (maxRectsBeamChild *)malloc(sizeof(maxRectsBeamChild) *
+    beamWidth);
+  beam->seenHashes = (unsigned long long *)malloc(
+    sizeof(unsigned long long) * beam->seenCapacity);
+  beam->workers = (maxRectsBeamWorker *)calloc(beam->workerCount,
+    sizeof(maxRectsBeamWorker));
+  if (!beam->states || !beam->nextStates || !beam->children ||
+      !beam->childCounts || !beam->selected || !beam->seenHashes ||
+      !beam->workers) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (i = 0; i < beam->workerCount; ++i) {
+    maxRectsContext *ctx = &beam->workers[i].ctx;
+    beam->workers[i].beam = beam;
+    ctx->width = base->width;
+    ctx->height = base->height;
+    ctx->method = base->method;
+    ctx->allowRotations = base->allowRotations;
+    ctx->kernels = base->kernels;
+    if (0 != reserveFreeList(&ctx->splitList, 64) ||
+        0 != reserveScratch(ctx, 64)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "reserve failed");
+      return -1;
+    }
+  }
+  if (beam->workerCount > 1) {
+    beam->mutex = sysOpsMutexCreate();
+    if (!beam->mutex) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsMutexCreate failed");
+      return -1;
+    }
+    beam->condition = sysOpsConditionCreate();
+    if (!beam->condition) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__,
+        "sysOpsConditionCreate failed");
+      return -1;
+    }
+  }
+  // A thread that does not start leaves its share to the others.
+  for (i = 1; i < beam->workerCount; ++i) {
+    sysOpsThread *thread = sysOpsThreadCreate(runBeamWorker,
+      &beam->workers[i]);
+    if (!thread) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsThreadCreate failed");
+      break;
+    }
+    beam->threads[beam->threadCount++] = thread;
+  }
+  // The first state takes the empty bin over from the base context.
+  state = &beam->states[0];
+  if (0 != allocBeamState(beam, state)) {
+    return -1;
+  }
+  state->freeList = base->freeList;
+  state->edgeIndex = base->edgeIndex;
+  memset(&base->freeList, 0, sizeof(maxRectsFreeList));
+  memset(&base->edgeIndex, 0, sizeof(maxRectsEdgeIndex));
+  for (i = 0; i < base->pendingCount; ++i) {
+    state->pendingCounts[i] = base->pendingClasses[i].count;
+  }
+  beam->stateCount = 1;
+  return 0;
+}
+
+static void releaseBeam(maxRectsBeamSearch *beam) {
+  int i;
+  if (beam->threadCount > 0) {
+    sysOpsMutexLock(beam->mutex);
+    beam->stopping = 1;
+    sysOpsConditionBroadcast(beam->condition);
+    sysOpsMutexUnlock(beam->mutex);
+    for (i = 0; i < beam->threadCount; ++i) {
+      sysOpsThreadJoin(beam->threads[i]);
+    }
+  }
+  if (beam->states && beam->nextStates) {
+    for (i = 0; i < beam->beamWidth; ++i) {
+      releaseBeamState(&beam->states[i]);
+      releaseBeamState(&beam->nextStates[i]);
+    }
+  }
+  if (beam->workers) {
+    for (i = 0; i < beam->workerCount; ++i) {
+      releaseContext(&beam->workers[i].ctx);
+    }
+  }
+  if (beam->condition) {
+    sysOpsConditionDestroy(beam->condition);
+  }
+  if (beam->mutex) {
+    sysOpsMutexDestroy(beam->mutex);
+  }
+  free(beam->states);
+  free(beam->nextStates);
+  free(beam->children);
+  free(beam->childCounts);
+  free(beam->selected);
+  free(beam->seenHashes);
+  free(beam->workers);
+  memset(beam, 0, sizeof(maxRectsBeamSearch));
+}
+
+// Places one input per step in every state and keeps the cheapest states.
+static int searchBeam(maxRectsBeamSearch *beam) {
+  int step;
+  int i;
+  for (step = 0; step < beam->base->rectCount; ++step) {
+    maxRectsBeamState *swap;
+    if (isPastDeadline(beam->base)) {
+      return 2;
+    }
+    if (0 != runBeamTasks(beam, expandBeamState, beam->stateCount)) {
+      return -1;
+    }
+    selectBeamChildren(beam);
+    if (0 == beam->selectedCount) {
+      for (i = 0; i < beam->stateCount; ++i) {
+        if (beam->states[i].pruned) {
+          return 1;
+        }
+      }
+      return -1;
+    }
+    if (0 != runBeamTasks(beam, cloneBeamParent, beam->selectedCount)) {
+      return -1;
+    }
+    takeBeamParents(beam);
+    swap = beam->states;
+    beam->states = beam->nextStates;
+    beam->nextStates = swap;
+    beam->stateCount = beam->selectedCount;
+    if (0 != runBeamTasks(beam, applyBeamChild, beam->stateCount)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Of the finished layouts, keeps the one with the smallest bounding box.
+static void finishBeam(maxRectsBeamSearch *beam,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  maxRectsContext *base = beam->base;
+  maxRectsBeamState *best = &beam->states[0];
+  unsigned long long usedSurfaceArea = 0;
+  int i;
+  for (i = 1; i < beam->stateCount; ++i) {
+    maxRectsBeamState *state = &beam->states[i];
+    unsigned long long area = (unsigned long long)state->usedWidth *
+      state->usedHeight;
+    unsigned long long bestArea = (unsigned long long)best->usedWidth *
+      best->usedHeight;
+    if (area < bestArea || (area == bestArea && state->cost < best->cost)) {
+      best = state;
+    }
+  }
+  for (i = 0; i < best->placedCount; ++i) {
+    maxRectsRect *rect = &best->placedRects[i];
+    maxRectsPosition *result = &layoutResults[abs(rect->rectOrder) - 1];
+    result->left = rect->x;
+    result->top = rect->y;
+    result->rotated = rect->rectOrder < 0;
+    usedSurfaceArea += rect->width * rect->height;
+  }
+  if (occupancy) {
+    *occupancy = (float)usedSurfaceArea / (base->width * base->height);
+  }
+}
+
+int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, 0, 0, method,
+    allowRotations, layoutResults, 0, 0, 0, occupancy);
+}
+
+int maxRectsFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, double deadline,
+    float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, 0, 0, method,
+    allowRotations, layoutResults, placed, areaLimit, deadline, occupancy);
+}
+
+int maxRectsOrdered(int width, int height, int rectCount, maxRectsSize *rects,
+    const int *order, int orderCount,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, char *placed, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, order, orderCount,
+    method, allowRotations, layoutResults, placed, 0, 0, occupancy);
+}
+
+int maxRectsBeam(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    int beamWidth, int threadCount, maxRectsPosition *layoutResults,
+    const unsigned int *areaLimit, double deadline,
+    float *occupancy) {
+  maxRectsContext contextStruct;
+  maxRectsContext *ctx = &contextStruct;
+  maxRectsBeamSearch beamStruct;
+  maxRectsBeamSearch *beam = &beamStruct;
+  int result;
+  memset(ctx, 0, sizeof(maxRectsContext));
+  memset(beam, 0, sizeof(maxRectsBeamSearch));
+  ctx->width = width;
+  ctx->height = height;
+  ctx->method = method;
+  ctx->allowRotations = allowRotations;
+  ctx->beamSearch = 1;
+  ctx->rectCount = rectCount;
+  ctx->rects = rects;
+  ctx->areaLimit = areaLimit;
+  ctx->deadline = deadline;
+  beam->base = ctx;
+  if (0 != initContext(ctx) ||
+      0 != initBeam(beam, MAX(1, beamWidth), MAX(1, threadCount))) {
+    releaseBeam(beam);
+    releaseContext(ctx);
+    return -1;
+  }
+  result = searchBeam(beam);
+  if (0 == result) {
+    finishBeam(beam, layoutResults, occupancy);
+  }
+  releaseBeam(beam);
+  releaseContext(ctx);
+  return result;
+}
+
+// One rect of a session; width and height are as placed, after rotation.
+typedef struct maxRectsSessionRect {
+  int x;
+  int y;
+  int width;
+  int height;
+  int rotated:1;
+  int used:1;
+} maxRectsSessionRect;
+
+typedef struct maxRectsSessionKey {
+  int y;
+  int x;
+  int id;
+} maxRectsSessionKey;
+
+struct maxRectsSession {
+  maxRectsContext ctx;
+  // By id; ids of removed rects are handed out again.
+  maxRectsSessionRect *rects;
+  int rectCount;
+  int rectCapacity;
+  int edgeCapacity;
+  // The placed rects top to bottom, for rebuilding.
+  maxRectsSessionKey *order;
+};
+
+maxRectsSession *maxRectsSessionCreate(int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations) {
+  maxRectsSession *session = (maxRectsSession *)calloc(1,
+    sizeof(maxRectsSession));
+  maxRectsContext *ctx;
+  if (!session) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  ctx = &session->ctx;
+  ctx->width = width;
+  ctx->height = height;
+  ctx->method = method;
+  ctx->allowRotations = allowRotations;
+  if (0 != initContext(ctx)) {
+    maxRectsSessionDestroy(session);
+    return 0;
+  }
+  return session;
+}
+
+void maxRectsSessionDestroy(maxRectsSession *session) {
+  releaseContext(&session->ctx);
+  free(session->rects);
+  free(session->order);
+  free(session);
+}
+
+static int compareSessionKeys(const void *first, const void *second) {
+  const maxRectsSessionKey *firstKey = (const maxRectsSessionKey *)first;
+  const maxRectsSessionKey *secondKey = (const maxRectsSessionKey *)second;
+  if (firstKey->y != secondKey->y) {
+    return firstKey->y - secondKey->y;
+  }
+  return firstKey->x - secondKey->x;
+}
+
+// Starts the free rects over from the empty bin and occupies every rect
+// still placed, which leaves exactly the maximal free rects of the layout.
+// Going top to bottom keeps the free list about as short as the skyline
+// of what is occupied so far. The contact point edge index is rebuilt
+// too, with room to grow.
+static int rebuildSession(maxRectsSession *session) {
+  maxRectsContext *ctx = &session->ctx;
+  int count = 0;
+  int i;
+  ctx->freeList.count = 0;
+  addToFreeList(&ctx->freeList, 0, 0, ctx->width, ctx->height);
+  if (rectContactPointRule == ctx->method) {
+    releaseEdgeIndex(&ctx->edgeIndex);
+    session->edgeCapacity = MAX(16, session->rectCount * 2);
+    if (0 != createEdgeIndex(&ctx->edgeIndex, ctx->width, ctx->height,
+        session->edgeCapacity)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "createEdgeIndex failed");
+      return -1;
+    }
+  }
+  for (i = 0; i < session->rectCount; ++i) {
+    maxRectsSessionRect *sessionRect = &session->rects[i];
+    if (sessionRect->used && sessionRect->width > 0 &&
+        sessionRect->height > 0) {
+      session->order[count].y = sessionRect->y;
+      session->order[count].x = sessionRect->x;
+      session->order[count].id = i;
+      ++count;
+    }
+  }
+  qsort(session->order, count, sizeof(maxRectsSessionKey),
+    compareSessionKeys);
+  for (i = 0; i < count; ++i) {
+    maxRectsSessionRect *sessionRect = &session->rects[session->order[i].id];
+    maxRectsRect rect;
+    memset(&rect, 0, sizeof(rect));
+    rect.x = sessionRect->x;
+    rect.y = sessionRect->y;
+    rect.width = sessionRect->width;
+    rect.height = sessionRect->height;
+    if (0 != occupyRect(ctx, &rect)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// First unused id, growing the rects when all are taken; -1 on errors.
+static int allocSessionId(maxRectsSession *session) {
+  int id;
+  for (id = 0; id < session->rectCount; ++id) {
+    if (!session->rects[id].used) {
+      return id;
+    }
+  }
+  if (session->rectCount == session->rectCapacity) {
+    int capacity = MAX(16, session->rectCapacity * 2);
+    maxRectsSessionRect *rects = (maxRectsSessionRect *)realloc(
+      session->rects, sizeof(maxRectsSessionRect) * capacity);
+    maxRectsSessionKey *order;
+    if (rects) {
+      session->rects = rects;
+    }
+    order = (maxRectsSessionKey *)realloc(session->order,
+      sizeof(maxRectsSessionKey) * capacity);
+    if (order) {
+      session->order = order;
+    }
+    if (!rects || !order) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    session->rectCapacity = capacity;
+  }
+  memset(&session->rects[session->rectCount], 0, sizeof(maxRectsSessionRect));
+  return session->rectCount++;
+}
+
+// Whether a placed width x height rect at (x, y) lies in free space. Every
+// free box is inside one of the maximal free rects.
+static int isSessionSpotFree(maxRectsSession *session, int x, int y,
+    int width, int height) {
+  maxRectsFreeList *list = &session->ctx.freeList;
+  int i;
+  if (0 == width || 0 == height) {
+    return 1;
+  }
+  for (i = 0; i < list->count; ++i) {
+    if (x >= list->x[i] && y >= list->y[i] &&
+        x + width <= list->x[i] + list->width[i] &&
+        y + height <= list->y[i] + list->height[i]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Takes the spot of a rect found free for it and gives it id.
+static int occupySessionRect(maxRectsSession *session, int id, int x, int y,
+    int width, int height, int rotated) {
+  maxRectsContext *ctx = &session->ctx;
+  maxRectsSessionRect *sessionRect = &session->rects[id];
+  maxRectsRect rect;
+  if (rectContactPointRule == ctx->method &&
+      ctx->edgeIndex.count >= session->edgeCapacity &&
+      0 != rebuildSession(session)) {
+    return -1;
+  }
+  if (width > 0 && height > 0) {
+    memset(&rect, 0, sizeof(rect));
+    rect.x = x;
+    rect.y = y;
+    rect.width = width;
+    rect.height = height;
+    if (0 != occupyRect(ctx, &rect)) {
+      return -1;
+    }
+  }
+  sessionRect->x = x;
+  sessionRect->y = y;
+  sessionRect->width = width;
+  sessionRect->height = height;
+  sessionRect->rotated = rotated;
+  sessionRect->used = 1;
+  return 0;
+}
+
+static void getSessionPosition(maxRectsSession *session, int id,
+    maxRectsPosition *position) {
+  maxRectsSessionRect *sessionRect = &session->rects[id];
+  if (position) {
+    position->left = sessionRect->x;
+    position->top = sessionRect->y;
+    position->rotated = sessionRect->rotated ? 1 : 0;
+  }
+}
+
+// Scores the free rects for a width x height rect and takes the best spot
+// for id. Returns 1 when nothing fits.
+static int insertSessionRect(maxRectsSession *session, int id, int width,
+    int height) {
+  maxRectsRect node;
+  int score1;
+  int score2;
+  if (0 == width || 0 == height) {
+    return occupySessionRect(session, id, 0, 0, width, height, 0);
+  }
+  scoreRect(&session->ctx, width, height, &node, &score1, &score2);
+  if (INT_MAX == score1) {
+    return 1;
+  }
+  return occupySessionRect(session, id, node.x, node.y, node.width,
+    node.height, node.width != width || node.height != height);
+}
+
+int maxRectsSessionInsert(maxRectsSession *session, int width, int height,
+    int *id, maxRectsPosition *position) {
+  int newId = allocSessionId(session);
+  int result;
+  if (newId < 0) {
+    return -1;
+  }
+  result = insertSessionRect(session, newId, width, height);
+  if (0 == result) {
+    *id = newId;
+    getSessionPosition(session, newId, position);
+  }
+  return result;
+}
+
+int maxRectsSessionPlace(maxRectsSession *session, int width, int height,
+    const maxRectsPosition *position, int *id) {
+  int placedWidth = position->rotated ? height : width;
+  int placedHeight = position->rotated ? width : height;
+  int newId;
+  int result;
+  if (!isSessionSpotFree(session, position->left, position->top,
+      placedWidth, placedHeight)) {
+    return 1;
+  }
+  newId = allocSessionId(session);
+  if (newId < 0) {
+    return -1;
+  }
+  result = occupySessionRect(session, newId, position->left, position->top,
+    placedWidth, placedHeight, position->rotated);
+  if (0 == result) {
+    *id = newId;
+  }
+  return result;
+}
+
+static int isSessionId(maxRectsSession *session, int id) {
+  if (id < 0 || id >= session->rectCount || !session->rects[id].used) {
+    fprintf(stderr, "%s: %d is no rect of the session\n", __FUNCTION__, id);
+    return 0;
+  }
+  return 1;
+}
+
+int maxRectsSessionRemove(maxRectsSession *session, int id) {
+  if (!isSessionId(session, id)) {
+    return -1;
+  }
+  session->rects[id].used = 0;
+  return rebuildSession(session);
+}
+
+int maxRectsSessionResize(maxRectsSession *session, int id, int width,
+    int height, maxRectsPosition *position) {
+  maxRectsSessionRect old;
+  int placedWidth;
+  int placedHeight;
+  int result;
+  if (!isSessionId(session, id)) {
+    return -1;
+  }
+  old = session->rects[id];
+  placedWidth = old.rotated ? height : width;
+  placedHeight = old.rotated ? width : height;
+  session->rects[id].used = 0;
+  if (0 != rebuildSession(session)) {
+    return -1;
+  }
+  // Staying put keeps the rest of the texture as it is.
+  if (isSessionSpotFree(session, old.x, old.y, placedWidth, placedHeight)) {
+    result = occupySessionRect(session, id, old.x, old.y, placedWidth,
+      placedHeight, old.rotated);
+  } else {
+    result = insertSessionRect(session, id, width, height);
+  }
+  if (1 == result) {
+    session->rects[id] = old;
+    if (0 != rebuildSession(session)) {
+      return -1;
+    }
+  }
+  if (0 == result) {
+    getSessionPosition(session, id, position);
+  }
+  return result;
+}
+
+int maxRectsUniform(int width, int height, int rectCount, maxRectsSize *rects,
+    int allowRotations, maxRectsPosition *layoutResults, float *occupancy) {
+  maxRectsSize classes[MAX_RECTS_UNIFORM_CLASSES];
+  int rotated[MAX_RECTS_UNIFORM_CLASSES];
+  int classOrder[MAX_RECTS_UNIFORM_CLASSES];
+  int classCount = 0;
+  unsigned long long usedSurfaceArea = 0;
+  int shelfLeft = 0;
+  int shelfTop = 0;
+  int shelfHeight = 0;
+  int pass;
+  int i;
+  int j;
+  for (i = 0; i < rectCount; ++i) {
+    for (j = 0; j < classCount; ++j) {
+      if (rects[i].width == classes[j].width &&
+          rects[i].height == classes[j].height) {
+        break;
+      }
+    }
+    if (j == classCount) {
+      if (MAX_RECTS_UNIFORM_CLASSES == classCount) {
+        return 1;
+      }
+      classes[classCount++] = rects[i];
+    }
+    usedSurfaceArea += rects[i].width * rects[i].height;
+  }
+  if (0 == classCount) {
+    return 1;
+  }
+  for (i = 0; i < classCount; ++i) {
+    int w = classes[i].width;
+    int h = classes[i].height;
+    // Lay each class the way more of it fits in the bin.
+    rotated[i] = allowRotations && w > 0 && h > 0 && w != h &&
+      (long long)(width / h) * (height / w) >
+        (long long)(width / w) * (height / h);
+    classOrder[i] = i;
+  }
+  // Tallest classes first, so each shelf is as high as its first rect.
+  for (i = 1; i < classCount; ++i) {
+    int current = classOrder[i];
+    int currentHeight = rotated[current] ? classes[current].width :
+      classes[current].height;
+    for (j = i; j > 0; --j) {
+      int previous = classOrder[j - 1];
+      int previousHeight = rotated[previous] ? classes[previous].width :
+        classes[previous].height;
+      if (previousHeight >= currentHeight) {
+        break;
+      }
+      classOrder[j] = previous;
+    }
+    classOrder[j] = current;
+  }
+  // The first pass only checks that the shelves fit, so a caller falling
+  // back on a 1 still has the layout it passed in.
+  for (pass = 0; pass < 2; ++pass) {
+    shelfLeft = 0;
+    shelfTop = 0;
+    shelfHeight = 0;
+    for (i = 0; i < classCount; ++i) {
+      maxRectsSize *sizeClass = &classes[classOrder[i]];
+      int isRotated = rotated[classOrder[i]];
+      int w = isRotated ? sizeClass->height : sizeClass->width;
+      int h = isRotated ? sizeClass->width : sizeClass->height;
+      for (j = 0; j < rectCount; ++j) {
+        if (rects[j].width != sizeClass->width ||
+            rects[j].height != sizeClass->height) {
+          continue;
+        }
+        if (shelfLeft + w > width) {
+          shelfTop += shelfHeight;
+          shelfLeft = 0;
+          shelfHeight = 0;
+        }
+        if (w > width || shelfTop + h > height) {
+          return 1;
+        }
+        if (pass > 0) {
+          layoutResults[j].left = shelfLeft;
+          layoutResults[j].top = shelfTop;
+          layoutResults[j].rotated = isRotated;
+        }
+        shelfLeft += w;
+        shelfHeight = MAX(shelfHeight, h);
+      }
+    }
+  }
+  if (occupancy) {
+    *occupancy = (float)usedSurfaceArea / (width * height);
+  }
+  return 0;
+}
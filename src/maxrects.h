@@ -31,8 +31,74 @@ enum maxRectsFreeRectChoiceHeuristic {
   rectContactPointRule ///< -CP: Choosest the placement where the rectangle touches other rects as much as possible.
 };
 
+// Returns -1 when the rects do not all fit, without a message on stderr,
+// since a search over bin sizes expects that for every size too small.
 int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
     enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
     maxRectsPosition *layoutResults, float *occupancy);
 
+// Like maxRects, but places as many rects as fit instead of failing, for
+// filling one page of a multi-page atlas. placed[i] is set to 1 for every
+// rect that got a position; occupancy counts only those. With placed 0 it
+// fails like maxRects. With areaLimit, gives up and returns 1 as soon as
+// the bounding box of the placed rects is bigger than *areaLimit (0 for no
+// limit yet), which other threads may lower while it runs. With a deadline
+// above 0, gives up and returns 2 once sysOpsGetTime passes it; the clock
+// is read every few placements.
+int maxRectsFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, double deadline,
+    float *occupancy);
+
+// Places rects[order[0]], rects[order[1]] and so on, each at the best spot
+// the heuristic finds for it alone, instead of picking the best rect for
+// every step. The order then decides the layout, which is what a search
+// over orders needs. placed works as for maxRectsFill, but only the rects
+// listed in order are touched.
+int maxRectsOrdered(int width, int height, int rectCount, maxRectsSize *rects,
+    const int *order, int orderCount,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, char *placed, float *occupancy);
+
+// Keeps the beamWidth best partial layouts at every step instead of only
+// the best one, ranked by the sum of the heuristic's scores, and returns
+// the finished layout with the smallest bounding box. Each step is spread
+// over threadCount threads. A beam of one gives the maxRects layout. The
+// area limit and the deadline work as for maxRectsFill.
+int maxRectsBeam(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    int beamWidth, int threadCount, maxRectsPosition *layoutResults,
+    const unsigned int *areaLimit, double deadline,
+    float *occupancy);
+
+// A layout that stays open for edits: rects can be added, removed and
+// resized one at a time, and the others never move. Removed space goes
+// back to the free rects, which are rebuilt from the rects still placed.
+typedef struct maxRectsSession maxRectsSession;
+
+maxRectsSession *maxRectsSessionCreate(int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations);
+void maxRectsSessionDestroy(maxRectsSession *session);
+// Places a rect where the heuristic likes it best. Returns 0 with its id
+// and position, 1 when it does not fit and -1 on errors.
+int maxRectsSessionInsert(maxRectsSession *session, int width, int height,
+    int *id, maxRectsPosition *position);
+// Places a rect at a given position, as when reopening a finished layout.
+// Returns 1 when the spot is not free.
+int maxRectsSessionPlace(maxRectsSession *session, int width, int height,
+    const maxRectsPosition *position, int *id);
+int maxRectsSessionRemove(maxRectsSession *session, int id);
+// Gives a rect a new size, in its old spot when that is still free, or
+// else wherever it fits. Returns 1 and leaves it alone if it fits nowhere.
+int maxRectsSessionResize(maxRectsSession *session, int id, int width,
+    int height, maxRectsPosition *position);
+
+// Lays out inputs made of a few distinct sizes, like tile sheets, as a grid
+// or as shelves in O(n), without running a heuristic. Returns 1 when the
+// inputs have too many sizes or do not fit that way, and the caller should
+// fall back to maxRects; layoutResults is then left as it was.
+int maxRectsUniform(int width, int height, int rectCount, maxRectsSize *rects,
+    int allowRotations, maxRectsPosition *layoutResults, float *occupancy);
+
 #endif
@@ -0,0 +1,90 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Times every MaxRects heuristic on a synthetic sprite set, so changes to
+// the packer can be compared run against run.
+
+#include "maxrects.h"
+#include "sysops.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static const char *methodNames[] = {"BSSF", "BLSF", "BAF", "BL", "CP"};
+
+static unsigned int seed = 1;
+
+static int randomBetween(int low, int high) {
+  seed = seed * 1103515245 + 12345;
+  return low + (int)((seed >> 16) % (unsigned int)(high - low + 1));
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: maxrectsbench [rect count] [bin size] "
+    "[max rect side] [seed] [beam width] [allow rotations]\n");
+}
+
+int main(int argc, char *argv[]) {
+  int rectCount = argc > 1 ? atoi(argv[1]) : 1000;
+  int binSize = argc > 2 ? atoi(argv[2]) : 2048;
+  int maxSide = argc > 3 ? atoi(argv[3]) : 40;
+  int beamWidth = argc > 5 ? atoi(argv[5]) : 1;
+  int allowRotations = argc > 6 ? atoi(argv[6]) : 1;
+  maxRectsSize *rects;
+  maxRectsPosition *results;
+  int method;
+  int i;
+  if (argc > 4) {
+    seed = (unsigned int)atoi(argv[4]);
+  }
+  if (rectCount <= 0 || binSize <= 0 || maxSide <= 0 || beamWidth <= 0) {
+    usage();
+    return -1;
+  }
+  rects = (maxRectsSize *)calloc(rectCount, sizeof(maxRectsSize));
+  results = (maxRectsPosition *)calloc(rectCount, sizeof(maxRectsPosition));
+  if (!rects || !results) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return -1;
+  }
+  for (i = 0; i < rectCount; ++i) {
+    rects[i].width = randomBetween(1, maxSide);
+    rects[i].height = randomBetween(1, maxSide);
+  }
+  printf("%d rects up to %dx%d in a %dx%d bin%s\n", rectCount, maxSide,
+    maxSide, binSize, binSize, allowRotations ? "" : ", no rotations");
+  for (method = rectBestShortSideFit; method <= rectContactPointRule;
+      ++method) {
+    float occupancy = 0;
+    double start = sysOpsGetTime();
+    int result = beamWidth > 1 ?
+      maxRectsBeam(binSize, binSize, rectCount, rects,
+        (enum maxRectsFreeRectChoiceHeuristic)method, allowRotations, beamWidth,
+        sysOpsGetCpuCount(), results, 0, 0, &occupancy) :
+      maxRects(binSize, binSize, rectCount, rects,
+        (enum maxRectsFreeRectChoiceHeuristic)method, allowRotations, results,
+        &occupancy);
+    double seconds = sysOpsGetTime() - start;
+    if (0 != result) {
+      printf("%-5s failed after %.3fs\n", methodNames[method], seconds);
+    } else {
+      printf("%-5s %.3fs occupancy %.4f\n", methodNames[method], seconds,
+        occupancy);
+    }
+    fflush(stdout);
+  }
+  free(rects);
+  free(results);
+  return 0;
+}
@@ -0,0 +1,329 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Regression checks for MaxRects layouts that have gone wrong before. Exits
+// with 1 and names the check when one fails.
+
+#include "maxrects.h"
+#include "exact.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CHECK_RECT_COUNT 6
+#define CHECK_TIE_RECT_COUNT 77
+#define CHECK_SESSION_SLOTS 24
+
+// Largest bin side of the exact cross-check, small enough to try every
+// cell.
+#define CHECK_BRUTE_SIDE 8
+
+static int hasOverlap(int rectCount, maxRectsSize *rects,
+    maxRectsPosition *results) {
+  int i;
+  int j;
+  for (i = 0; i < rectCount; ++i) {
+    int iw = results[i].rotated ? rects[i].height : rects[i].width;
+    int ih = results[i].rotated ? rects[i].width : rects[i].height;
+    for (j = i + 1; j < rectCount; ++j) {
+      int jw = results[j].rotated ? rects[j].height : rects[j].width;
+      int jh = results[j].rotated ? rects[j].width : rects[j].height;
+      if (results[i].left < results[j].left + jw &&
+          results[j].left < results[i].left + iw &&
+          results[i].top < results[j].top + jh &&
+          results[j].top < results[i].top + ih) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int isOutsideBin(int width, int height, int rectCount,
+    maxRectsSize *rects, maxRectsPosition *results) {
+  int i;
+  for (i = 0; i < rectCount; ++i) {
+    int w = results[i].rotated ? rects[i].height : rects[i].width;
+    int h = results[i].rotated ? rects[i].width : rects[i].height;
+    if (results[i].left < 0 || results[i].top < 0 ||
+        results[i].left + w > width || results[i].top + h > height) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Shelves that overflow the bin partway through used to leave half a
+// layout over the results, which squeezer kept as its time budget baseline.
+static int checkUniformFallback(void) {
+  maxRectsSize rects[CHECK_RECT_COUNT] = {
+    {60, 60}, {40, 40}, {40, 40}, {40, 20}, {40, 20}, {40, 20}
+  };
+  maxRectsPosition results[CHECK_RECT_COUNT];
+  maxRectsPosition before[CHECK_RECT_COUNT];
+  int i;
+  for (i = 0; i < CHECK_RECT_COUNT; ++i) {
+    results[i].left = 1000 + i;
+    results[i].top = 2000 + i;
+    results[i].rotated = 0;
+  }
+  memcpy(before, results, sizeof(results));
+  if (1 != maxRectsUniform(100, 100, CHECK_RECT_COUNT, rects, 0, results,
+      0)) {
+    return -1;
+  }
+  if (0 != memcmp(before, results, sizeof(results))) {
+    return -1;
+  }
+  if (0 != maxRectsUniform(200, 100, CHECK_RECT_COUNT, rects, 0, results,
+      0) || hasOverlap(CHECK_RECT_COUNT, rects, results)) {
+    return -1;
+  }
+  return 0;
+}
+
+// Whether the rects not yet used fit the cells of grid from cell on. The
+// first free cell either holds the top left corner of a rect or stays
+// empty; rects placed later never reach back to it.
+static int bruteFits(char *grid, int width, int height, int cell,
+    int rectCount, maxRectsSize *rects, char *used, int allowRotations,
+    int freeCells, int rectArea) {
+  int x;
+  int y;
+  int i;
+  if (0 == rectArea) {
+    return 1;
+  }
+  while (cell < width * height && grid[cell]) {
+    ++cell;
+  }
+  if (cell == width * height || rectArea > freeCells) {
+    return 0;
+  }
+  x = cell % width;
+  y = cell / width;
+  for (i = 0; i < rectCount; ++i) {
+    int flip;
+    if (used[i]) {
+      continue;
+    }
+    for (flip = 0; flip < (allowRotations ? 2 : 1); ++flip) {
+      int w = flip ? rects[i].height : rects[i].width;
+      int h = flip ? rects[i].width : rects[i].height;
+      int fits = x + w <= width && y + h <= height;
+      int row;
+      int col;
+      for (row = y; fits && row < y + h; ++row) {
+        for (col = x; fits && col < x + w; ++col) {
+          fits = !grid[row * width + col];
+        }
+      }
+      if (!fits) {
+        continue;
+      }
+      for (row = y; row < y + h; ++row) {
+        memset(grid + row * width + x, 1, w);
+      }
+      used[i] = 1;
+      fits = bruteFits(grid, width, height, cell + 1, rectCount, rects,
+        used, allowRotations, freeCells - w * h, rectArea - w * h);
+      used[i] = 0;
+      for (row = y; row < y + h; ++row) {
+        memset(grid + row * width + x, 0, w);
+      }
+      if (fits) {
+        return 1;
+      }
+    }
+  }
+  return bruteFits(grid, width, height, cell + 1, rectCount, rects, used,
+    allowRotations, freeCells - 1, rectArea);
+}
+
+// Compares exactPack with trying every cell. Returns 0 when they agree and
+// the exact layout is sound.
+static int crossCheckExact(int width, int height, int rectCount,
+    maxRectsSize *rects, int allowRotations) {
+  char grid[CHECK_BRUTE_SIDE * CHECK_BRUTE_SIDE];
+  char used[CHECK_RECT_COUNT];
+  maxRectsPosition results[CHECK_RECT_COUNT];
+  int rectArea = 0;
+  int expected;
+  int i;
+  for (i = 0; i < rectCount; ++i) {
+    rectArea += rects[i].width * rects[i].height;
+  }
+  memset(grid, 0, sizeof(grid));
+  memset(used, 0, sizeof(used));
+  expected = bruteFits(grid, width, height, 0, rectCount, rects, used,
+    allowRotations, width * height, rectArea) ? 0 : 1;
+  if (expected != exactPack(width, height, rectCount, rects,
+      allowRotations, 0, results, 0)) {
+    return -1;
+  }
+  if (0 == expected && (isOutsideBin(width, height, rectCount, rects,
+      results) || hasOverlap(rectCount, rects, results))) {
+    return -1;
+  }
+  return 0;
+}
+
+// More free rects than a candidate list holds that tie for an input's
+// best score used to leave the list empty, and so did every refill, so the
+// input was taken not to fit. Here the 1x5 rects run into that.
+static int checkCandidateTies(void) {
+  maxRectsSize rects[CHECK_TIE_RECT_COUNT];
+  maxRectsPosition results[CHECK_TIE_RECT_COUNT];
+  int count = 0;
+  int i;
+  for (i = 0; i < 4; ++i, ++count) {
+    rects[count].width = 50;
+    rects[count].height = 1;
+  }
+  for (i = 0; i < 30; ++i, ++count) {
+    rects[count].width = 1;
+    rects[count].height = 5;
+  }
+  for (i = 0; i < 43; ++i, ++count) {
+    rects[count].width = 49;
+    rects[count].height = 2;
+  }
+  if (0 != maxRects(28, 200, count, rects, rectBestLongSideFit, 1, results,
+      0) || hasOverlap(count, rects, results)) {
+    return -1;
+  }
+  return 0;
+}
+
+// Adds, removes and resizes rects of a session in random order, and checks
+// after every edit that the rects still placed stay in the bin and apart.
+static int checkSessionEdits(void) {
+  maxRectsSession *session = maxRectsSessionCreate(40, 40,
+    rectBestShortSideFit, 1);
+  maxRectsSize rects[CHECK_SESSION_SLOTS];
+  maxRectsPosition results[CHECK_SESSION_SLOTS];
+  maxRectsSize liveRects[CHECK_SESSION_SLOTS];
+  maxRectsPosition liveResults[CHECK_SESSION_SLOTS];
+  int ids[CHECK_SESSION_SLOTS];
+  char live[CHECK_SESSION_SLOTS];
+  unsigned int seed = 777;
+  int result = 0;
+  int step;
+  if (!session) {
+    return -1;
+  }
+  memset(live, 0, sizeof(live));
+  for (step = 0; step < 600 && 0 == result; ++step) {
+    int liveCount = 0;
+    int slot;
+    int width;
+    int height;
+    int edit;
+    int i;
+    seed = seed * 1103515245 + 12345;
+    slot = (seed >> 16) % CHECK_SESSION_SLOTS;
+    seed = seed * 1103515245 + 12345;
+    width = 1 + (seed >> 16) % 16;
+    seed = seed * 1103515245 + 12345;
+    height = 1 + (seed >> 16) % 16;
+    if (!live[slot]) {
+      edit = maxRectsSessionInsert(session, width, height, &ids[slot],
+        &results[slot]);
+      live[slot] = 0 == edit;
+    } else if (step & 1) {
+      edit = maxRectsSessionRemove(session, ids[slot]);
+      live[slot] = 0;
+    } else {
+      edit = maxRectsSessionResize(session, ids[slot], width, height,
+        &results[slot]);
+    }
+    if (edit < 0) {
+      result = -1;
+      break;
+    }
+    if (0 == edit && live[slot]) {
+      rects[slot].width = width;
+      rects[slot].height = height;
+    }
+    for (i = 0; i < CHECK_SESSION_SLOTS; ++i) {
+      if (live[i]) {
+        liveRects[liveCount] = rects[i];
+        liveResults[liveCount] = results[i];
+        ++liveCount;
+      }
+    }
+    if (isOutsideBin(40, 40, liveCount, liveRects, liveResults) ||
+        hasOverlap(liveCount, liveRects, liveResults)) {
+      result = -1;
+    }
+  }
+  maxRectsSessionDestroy(session);
+  return result;
+}
+
+// The exact search used to fill a gap only from its left end, and missed
+// layouts where a rect overhangs a gap narrower than itself.
+static int checkExactSearch(void) {
+  maxRectsSize rects[CHECK_RECT_COUNT] = {
+    {2, 3}, {4, 2}, {5, 2}, {2, 2}, {1, 4}, {4, 3}
+  };
+  unsigned int seed = 12345;
+  int trial;
+  int i;
+  if (0 != crossCheckExact(8, 6, CHECK_RECT_COUNT, rects, 0)) {
+    return -1;
+  }
+  for (trial = 0; trial < 400; ++trial) {
+    int rectCount;
+    int width;
+    int height;
+    seed = seed * 1103515245 + 12345;
+    rectCount = 3 + (seed >> 16) % (CHECK_RECT_COUNT - 2);
+    seed = seed * 1103515245 + 12345;
+    width = 3 + (seed >> 16) % (CHECK_BRUTE_SIDE - 2);
+    seed = seed * 1103515245 + 12345;
+    height = 3 + (seed >> 16) % (CHECK_BRUTE_SIDE - 2);
+    for (i = 0; i < rectCount; ++i) {
+      seed = seed * 1103515245 + 12345;
+      rects[i].width = 1 + (seed >> 16) % 5;
+      seed = seed * 1103515245 + 12345;
+      rects[i].height = 1 + (seed >> 16) % 5;
+    }
+    if (0 != crossCheckExact(width, height, rectCount, rects, trial & 1)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  if (0 != checkUniformFallback()) {
+    printf("%s failed\n", "checkUniformFallback");
+    return 1;
+  }
+  if (0 != checkCandidateTies()) {
+    printf("%s failed\n", "checkCandidateTies");
+    return 1;
+  }
+  if (0 != checkSessionEdits()) {
+    printf("%s failed\n", "checkSessionEdits");
+    return 1;
+  }
+  if (0 != checkExactSearch()) {
+    printf("%s failed\n", "checkExactSearch");
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,237 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "predictor.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#define snprintf sprintf_s
+#endif
+
+#define PREDICTOR_COUNT_BUCKETS 4
+#define PREDICTOR_SPREAD_BUCKETS 3
+#define PREDICTOR_ASPECT_BUCKETS 3
+#define PREDICTOR_FILL_BUCKETS 4
+#define PREDICTOR_PROFILE_COUNT (PREDICTOR_COUNT_BUCKETS * \
+  PREDICTOR_SPREAD_BUCKETS * PREDICTOR_ASPECT_BUCKETS * \
+  PREDICTOR_FILL_BUCKETS * 2)
+
+// Sweeps a profile needs before its counts are trusted.
+#define PREDICTOR_MIN_SAMPLES 4
+
+// Share of the sweeps of a profile a heuristic has to win to be run.
+#define PREDICTOR_MIN_WIN_RATE 0.2
+
+// Most heuristics one prediction runs.
+#define PREDICTOR_MAX_PICKS 3
+
+struct predictor {
+  char name[64];
+  int heuristicCount;
+  // Sweeps per profile, and wins per profile and heuristic.
+  unsigned int *samples;
+  unsigned int *wins;
+};
+
+predictor *predictorCreate(const char *name, int heuristicCount) {
+  predictor *ctx = (predictor *)calloc(1, sizeof(predictor));
+  if (!ctx) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  snprintf(ctx->name, sizeof(ctx->name), "%s", name);
+  ctx->heuristicCount = heuristicCount;
+  ctx->samples = (unsigned int *)calloc(PREDICTOR_PROFILE_COUNT,
+    sizeof(unsigned int));
+  ctx->wins = (unsigned int *)calloc(PREDICTOR_PROFILE_COUNT *
+    heuristicCount, sizeof(unsigned int));
+  if (!ctx->samples || !ctx->wins) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    predictorDestroy(ctx);
+    return 0;
+  }
+  return ctx;
+}
+
+void predictorDestroy(predictor *ctx) {
+  free(ctx->samples);
+  free(ctx->wins);
+  free(ctx);
+}
+
+// The model is plain text: a header with the sweep name and heuristic
+// count, then one line per profile seen, its sweeps and then its wins.
+int predictorLoad(predictor *ctx, const char *filename) {
+  char name[64];
+  int heuristicCount;
+  int profile;
+  int result = 0;
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "%s: open %s failed\n", __FUNCTION__, filename);
+    return -1;
+  }
+  if (2 != fscanf(fp, "squeezer model %63s %d", name, &heuristicCount)) {
+    fprintf(stderr, "%s: %s is no squeezer model\n", __FUNCTION__,
+      filename);
+    fclose(fp);
+    return -1;
+  }
+  if (0 != strcmp(name, ctx->name) || heuristicCount != ctx->heuristicCount) {
+    fprintf(stderr, "%s: %s is a model of %s with %d heuristics, not of %s "
+      "with %d\n", __FUNCTION__, filename, name, heuristicCount, ctx->name,
+      ctx->heuristicCount);
+    fclose(fp);
+    return -1;
+  }
+  while (0 == result && 1 == fscanf(fp, "%d", &profile)) {
+    unsigned int count;
+    int heuristic;
+    if (profile < 0 || profile >= PREDICTOR_PROFILE_COUNT ||
+        1 != fscanf(fp, "%u", &count)) {
+      result = -1;
+      break;
+    }
+    ctx->samples[profile] += count;
+    for (heuristic = 0; heuristic < ctx->heuristicCount; ++heuristic) {
+      if (1 != fscanf(fp, "%u", &count)) {
+        result = -1;
+        break;
+      }
+      ctx->wins[profile * ctx->heuristicCount + heuristic] += count;
+    }
+  }
+  if (0 == result && !feof(fp)) {
+    result = -1;
+  }
+  if (0 != result) {
+    fprintf(stderr, "%s: %s is broken\n", __FUNCTION__, filename);
+  }
+  fclose(fp);
+  return result;
+}
+
+int predictorSave(predictor *ctx, const char *filename) {
+  int profile;
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    fprintf(stderr, "%s: open %s failed\n", __FUNCTION__, filename);
+    return -1;
+  }
+  fprintf(fp, "squeezer model %s %d\n", ctx->name, ctx->heuristicCount);
+  for (profile = 0; profile < PREDICTOR_PROFILE_COUNT; ++profile) {
+    int heuristic;
+    if (0 == ctx->samples[profile]) {
+      continue;
+    }
+    fprintf(fp, "%d %u", profile, ctx->samples[profile]);
+    for (heuristic = 0; heuristic < ctx->heuristicCount; ++heuristic) {
+      fprintf(fp, " %u", ctx->wins[profile * ctx->heuristicCount +
+        heuristic]);
+    }
+    fprintf(fp, "\n");
+  }
+  if (0 != fclose(fp)) {
+    fprintf(stderr, "%s: write %s failed\n", __FUNCTION__, filename);
+    return -1;
+  }
+  return 0;
+}
+
+int predictorGetProfile(int rectCount, const maxRectsSize *rects,
+    int allowRotations, int width, int height) {
+  double area = 0;
+  double squares = 0;
+  double aspect = 0;
+  double mean;
+  double spread;
+  int count = 0;
+  int countBucket;
+  int spreadBucket;
+  int aspectBucket;
+  int fillBucket;
+  int i;
+  for (i = 0; i < rectCount; ++i) {
+    double rectArea = (double)rects[i].width * rects[i].height;
+    int longSide = rects[i].width > rects[i].height ? rects[i].width :
+      rects[i].height;
+    int shortSide = rects[i].width > rects[i].height ? rects[i].height :
+      rects[i].width;
+    if (0 == shortSide) {
+      continue;
+    }
+    area += rectArea;
+    squares += rectArea * rectArea;
+    aspect += (double)longSide / shortSide;
+    ++count;
+  }
+  mean = count > 0 ? area / count : 0;
+  spread = mean > 0 ? sqrt(fabs(squares / count - mean * mean)) / mean : 0;
+  aspect = count > 0 ? aspect / count : 1;
+  countBucket = count < 16 ? 0 : (count < 64 ? 1 : (count < 256 ? 2 : 3));
+  spreadBucket = spread < 0.3 ? 0 : (spread < 1 ? 1 : 2);
+  aspectBucket = aspect < 1.3 ? 0 : (aspect < 2 ? 1 : 2);
+  if (width <= 0 || height <= 0) {
+    fillBucket = 3;
+  } else {
+    double fill = area / ((double)width * height);
+    fillBucket = fill < 0.5 ? 0 : (fill < 0.75 ? 1 : 2);
+  }
+  return (((countBucket * PREDICTOR_SPREAD_BUCKETS + spreadBucket) *
+    PREDICTOR_ASPECT_BUCKETS + aspectBucket) * PREDICTOR_FILL_BUCKETS +
+    fillBucket) * 2 + (allowRotations ? 1 : 0);
+}
+
+void predictorRecord(predictor *ctx, int profile, const char *winners) {
+  int heuristic;
+  ++ctx->samples[profile];
+  for (heuristic = 0; heuristic < ctx->heuristicCount; ++heuristic) {
+    if (winners[heuristic]) {
+      ++ctx->wins[profile * ctx->heuristicCount + heuristic];
+    }
+  }
+}
+
+int predictorSelect(predictor *ctx, int profile, int *heuristics) {
+  unsigned int *wins = ctx->wins + profile * ctx->heuristicCount;
+  unsigned int samples = ctx->samples[profile];
+  int count = 0;
+  int heuristic;
+  int i;
+  if (samples < PREDICTOR_MIN_SAMPLES) {
+    return 0;
+  }
+  // Insertion into the picks by wins; of equal wins the earlier heuristic
+  // stays first, so a model always picks the same ones.
+  for (heuristic = 0; heuristic < ctx->heuristicCount; ++heuristic) {
+    if (wins[heuristic] < samples * PREDICTOR_MIN_WIN_RATE) {
+      continue;
+    }
+    for (i = count; i > 0 && wins[heuristics[i - 1]] < wins[heuristic];
+        --i) {
+      if (i < PREDICTOR_MAX_PICKS) {
+        heuristics[i] = heuristics[i - 1];
+      }
+    }
+    if (i < PREDICTOR_MAX_PICKS) {
+      heuristics[i] = heuristic;
+      count = count < PREDICTOR_MAX_PICKS ? count + 1 : count;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "maxrects.h"
+
+// Win counts of the heuristics of one sweep, per input profile: sprite
+// count, spread of sprite areas, mean aspect, how full the bin is and
+// whether rects may turn. A profile that was seen often enough names the
+// few heuristics that keep winning there, so the others can be skipped.
+typedef struct predictor predictor;
+
+// name tells apart models of different sweeps, as the algorithm does.
+predictor *predictorCreate(const char *name, int heuristicCount);
+void predictorDestroy(predictor *ctx);
+// Adds the counts of a saved model, which must be of the same sweep.
+int predictorLoad(predictor *ctx, const char *filename);
+int predictorSave(predictor *ctx, const char *filename);
+// Profile of a set of rects in a width x height bin; 0 x 0 stands for an
+// auto size bin, which ends up nearly full.
+int predictorGetProfile(int rectCount, const maxRectsSize *rects,
+    int allowRotations, int width, int height);
+// Counts one sweep: winners[i] is 1 for every heuristic that made the best
+// layout.
+void predictorRecord(predictor *ctx, int profile, const char *winners);
+// Fills heuristics with the ones worth running, most wins first. Returns
+// their count, 0 when the profile was not seen often enough to tell.
+int predictorSelect(predictor *ctx, int profile, int *heuristics);
+
+#endif
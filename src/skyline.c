@@ -0,0 +1,538 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "skyline.h"
+#include "sysops.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// One horizontal segment of the skyline; the nodes are sorted by x and
+// cover the bin width without gaps.
+typedef struct skylineNode {
+  int x;
+  int y;
+  int width;
+} skylineNode;
+
+typedef struct skylineRect {
+  int x;
+  int y;
+  int width;
+  int height;
+} skylineRect;
+
+typedef struct skylineOrder {
+  int longSide;
+  int shortSide;
+  int index;
+} skylineOrder;
+
+typedef struct skylineContext {
+  int width;
+  int height;
+  int rectCount;
+  maxRectsSize *rects;
+  maxRectsPosition *layoutResults;
+  char *placed;
+  const unsigned int *areaLimit;
+  int usedWidth;
+  int usedHeight;
+  enum skylineLevelChoiceHeuristic method;
+  int allowRotations:1;
+  int useWasteMap:1;
+  skylineNode *nodes;
+  int nodeCount;
+  int nodeCapacity;
+  skylineRect *wasteRects;
+  int wasteCount;
+  int wasteCapacity;
+  skylineOrder *order;
+} skylineContext;
+
+static int reserveNodes(skylineContext *ctx, int capacity) {
+  skylineNode *nodes;
+  if (capacity <= ctx->nodeCapacity) {
+    return 0;
+  }
+  capacity = MAX(capacity, ctx->nodeCapacity * 2);
+  nodes = (skylineNode *)realloc(ctx->nodes, sizeof(skylineNode) * capacity);
+  if (!nodes) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  ctx->nodes = nodes;
+  ctx->nodeCapacity = capacity;
+  return 0;
+}
+
+static int addWasteRect(skylineContext *ctx, int x, int y, int width,
+    int height) {
+  skylineRect *rect;
+  if (width <= 0 || height <= 0) {
+    return 0;
+  }
+  if (ctx->wasteCount == ctx->wasteCapacity) {
+    int capacity = MAX(64, ctx->wasteCapacity * 2);
+    skylineRect *wasteRects = (skylineRect *)realloc(ctx->wasteRects,
+      sizeof(skylineRect) * capacity);
+    if (!wasteRects) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    ctx->wasteRects = wasteRects;
+    ctx->wasteCapacity = capacity;
+  }
+  rect = &ctx->wasteRects[ctx->wasteCount++];
+  rect->x = x;
+  rect->y = y;
+  rect->width = width;
+  rect->height = height;
+  return 0;
+}
+
+// Returns 1 and the resting y if a width x height rect fits with its left
+// edge at node #index.
+static int fitAtNode(skylineContext *ctx, int index, int width, int height,
+    int *y) {
+  int widthLeft = width;
+  int i = index;
+  if (ctx->nodes[index].x + width > ctx->width) {
+    return 0;
+  }
+  *y = ctx->nodes[index].y;
+  while (widthLeft > 0) {
+    *y = MAX(*y, ctx->nodes[i].y);
+    if (*y + height > ctx->height) {
+      return 0;
+    }
+    widthLeft -= ctx->nodes[i].width;
+    ++i;
+  }
+  return 1;
+}
+
+// Area between the skyline and the bottom of a rect resting at y.
+static int wasteAtNode(skylineContext *ctx, int index, int width, int y) {
+  int left = ctx->nodes[index].x;
+  int right = left + width;
+  int waste = 0;
+  int i;
+  for (i = index; i < ctx->nodeCount && ctx->nodes[i].x < right; ++i) {
+    skylineNode *node = &ctx->nodes[i];
+    waste += (y - node->y) *
+      (MIN(node->x + node->width, right) - MAX(node->x, left));
+  }
+  return waste;
+}
+
+static void scoreNode(skylineContext *ctx, int index, int width, int height,
+    int y, int *score1, int *score2) {
+  if (skylineMinWasteFit == ctx->method) {
+    *score1 = wasteAtNode(ctx, index, width, y);
+    *score2 = y + height;
+  } else {
+    *score1 = y + height;
+    *score2 = ctx->nodes[index].width;
+  }
+}
+
+static int findPositionOnSkyline(skylineContext *ctx, int width, int height,
+    int *bestIndex, skylineRect *bestRect) {
+  int bestScore1 = INT_MAX;
+  int bestScore2 = INT_MAX;
+  int i;
+  *bestIndex = -1;
+  for (i = 0; i < ctx->nodeCount; ++i) {
+    int y;
+    int score1;
+    int score2;
+    if (fitAtNode(ctx, i, width, height, &y)) {
+      scoreNode(ctx, i, width, height, y, &score1, &score2);
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestScore1 = score1;
+        bestScore2 = score2;
+        *bestIndex = i;
+        bestRect->x = ctx->nodes[i].x;
+        bestRect->y = y;
+        bestRect->width = width;
+        bestRect->height = height;
+      }
+    }
+    if (ctx->allowRotations && fitAtNode(ctx, i, height, width, &y)) {
+      scoreNode(ctx, i, height, width, y, &score1, &score2);
+      if (score1 < bestScore1 ||
+          (score1 == bestScore1 && score2 < bestScore2)) {
+        bestScore1 = score1;
+        bestScore2 = score2;
+        *bestIndex = i;
+        bestRect->x = ctx->nodes[i].x;
+        bestRect->y = y;
+        bestRect->width = height;
+        bestRect->height = width;
+      }
+    }
+  }
+  return *bestIndex >= 0;
+}
+
+// Best area fit over the waste rects; returns the waste rect index or -1.
+static int findPositionInWasteMap(skylineContext *ctx, int width, int height,
+    skylineRect *bestRect) {
+  int bestArea = INT_MAX;
+  int bestWaste = -1;
+  int i;
+  for (i = 0; i < ctx->wasteCount; ++i) {
+    skylineRect *waste = &ctx->wasteRects[i];
+    int area = waste->width * waste->height;
+    if (area >= bestArea) {
+      continue;
+    }
+    if (waste->width >= width && waste->height >= height) {
+      bestArea = area;
+      bestWaste = i;
+      bestRect->width = width;
+      bestRect->height = height;
+    } else if (ctx->allowRotations &&
+        waste->width >= height && waste->height >= width) {
+      bestArea = area;
+      bestWaste = i;
+      bestRect->width = height;
+      bestRect->height = width;
+    }
+  }
+  if (bestWaste >= 0) {
+    bestRect->x = ctx->wasteRects[bestWaste].x;
+    bestRect->y = ctx->wasteRects[bestWaste].y;
+  }
+  return bestWaste;
+}
+
+// Takes rect out of the top left corner of waste rect #index and keeps
+// the two leftover pieces, split along the shorter leftover side.
+static int splitWasteRect(skylineContext *ctx, int index, skylineRect *rect) {
+  skylineRect waste = ctx->wasteRects[index];
+  int leftoverWidth = waste.width - rect->width;
+  int leftoverHeight = waste.height - rect->height;
+  ctx->wasteRects[index] = ctx->wasteRects[--ctx->wasteCount];
+  if (leftoverWidth < leftoverHeight) {
+    if (0 != addWasteRect(ctx, waste.x + rect->width, waste.y,
+          leftoverWidth, rect->height) ||
+        0 != addWasteRect(ctx, waste.x, waste.y + rect->height,
+          waste.width, leftoverHeight)) {
+      return -1;
+    }
+  } else {
+    if (0 != addWasteRect(ctx, waste.x + rect->width, waste.y,
+          leftoverWidth, waste.height) ||
+        0 != addWasteRect(ctx, waste.x, waste.y + rect->height,
+          rect->width, leftoverHeight)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int addSkylineLevel(skylineContext *ctx, int index, skylineRect *rect) {
+  skylineNode *nodes;
+  int right = rect->x + rect->width;
+  int i;
+  if (ctx->useWasteMap) {
+    for (i = index; i < ctx->nodeCount && ctx->nodes[i].x < right; ++i) {
+      skylineNode *node = &ctx->nodes[i];
+      int left = MAX(node->x, rect->x);
+      if (0 != addWasteRect(ctx, left, node->y,
+          MIN(node->x + node->width, right) - left, rect->y - node->y)) {
+        return -1;
+      }
+    }
+  }
+  if (0 != reserveNodes(ctx, ctx->nodeCount + 1)) {
+    return -1;
+  }
+  nodes = ctx->nodes;
+  memmove(nodes + index + 1, nodes + index,
+    sizeof(skylineNode) * (ctx->nodeCount - index));
+  ++ctx->nodeCount;
+  nodes[index].x = rect->x;
+  nodes[index].y = rect->y + rect->height;
+  nodes[index].width = rect->width;
+  // Cut the nodes now covered by the new one.
+  i = index + 1;
+  while (i < ctx->nodeCount && nodes[i].x < right) {
+    int shrink = right - nodes[i].x;
+    if (nodes[i].width <= shrink) {
+      memmove(nodes + i, nodes + i + 1,
+        sizeof(skylineNode) * (ctx->nodeCount - i - 1));
+      --ctx->nodeCount;
+      continue;
+    }
+    nodes[i].x += shrink;
+    nodes[i].width -= shrink;
+    break;
+  }
+  // Merge the new node with neighbours at the same height.
+  if (index > 0 && nodes[index - 1].y == nodes[index].y) {
+    nodes[index - 1].width += nodes[index].width;
+    memmove(nodes + index, nodes + index + 1,
+      sizeof(skylineNode) * (ctx->nodeCount - index - 1));
+    --ctx->nodeCount;
+    --index;
+  }
+  if (index + 1 < ctx->nodeCount && nodes[index + 1].y == nodes[index].y) {
+    nodes[index].width += nodes[index + 1].width;
+    memmove(nodes + index + 1, nodes + index + 2,
+      sizeof(skylineNode) * (ctx->nodeCount - index - 2));
+    --ctx->nodeCount;
+  }
+  return 0;
+}
+
+// Tallest first: larger long side, then larger short side, then input
+// order, so the result does not depend on the qsort implementation.
+static int compareRectOrder(const void *first, const void *second) {
+  const skylineOrder *a = (const skylineOrder *)first;
+  const skylineOrder *b = (const skylineOrder *)second;
+  if (a->longSide != b->longSide) {
+    return a->longSide > b->longSide ? -1 : 1;
+  }
+  if (a->shortSide != b->shortSide) {
+    return a->shortSide > b->shortSide ? -1 : 1;
+  }
+  return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+static int initContext(skylineContext *ctx) {
+  int i;
+  if (0 != reserveNodes(ctx, 64)) {
+    return -1;
+  }
+  ctx->nodes[0].x = 0;
+  ctx->nodes[0].y = 0;
+  ctx->nodes[0].width = ctx->width;
+  ctx->nodeCount = 1;
+  ctx->order = (skylineOrder *)malloc(sizeof(skylineOrder) *
+    MAX(ctx->rectCount, 1));
+  if (!ctx->order) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (i = 0; i < ctx->rectCount; ++i) {
+    maxRectsSize *size = &ctx->rects[i];
+    ctx->order[i].longSide = MAX(size->width, size->height);
+    ctx->order[i].shortSide = MIN(size->width, size->height);
+    ctx->order[i].index = i;
+  }
+  qsort(ctx->order, ctx->rectCount, sizeof(skylineOrder), compareRectOrder);
+  return 0;
+}
+
+static void releaseContext(skylineContext *ctx) {
+  free(ctx->nodes);
+  free(ctx->wasteRects);
+  free(ctx->order);
+  ctx->nodes = 0;
+  ctx->wasteRects = 0;
+  ctx->order = 0;
+}
+
+// Places one rect right away, at the best spot the current skyline offers.
+// Returns 1 if it does not fit.
+static int placeRect(skylineContext *ctx, int width, int height,
+    maxRectsPosition *result) {
+  skylineRect rect;
+  int nodeIndex;
+  int wasteIndex = -1;
+  memset(&rect, 0, sizeof(rect));
+  if (ctx->useWasteMap) {
+    wasteIndex = findPositionInWasteMap(ctx, width, height, &rect);
+  }
+  if (wasteIndex >= 0) {
+    if (0 != splitWasteRect(ctx, wasteIndex, &rect)) {
+      return -1;
+    }
+  } else if (findPositionOnSkyline(ctx, width, height, &nodeIndex, &rect)) {
+    if (rect.width > 0 && rect.height > 0 &&
+        0 != addSkylineLevel(ctx, nodeIndex, &rect)) {
+      return -1;
+    }
+  } else {
+    return 1;
+  }
+  result->left = rect.x;
+  result->top = rect.y;
+  result->rotated = rect.width != width || rect.height != height;
+  return 0;
+}
+
+// Tracks the bounding box of the placed rects; returns 1 once its area
+// passes the area limit, which another thread may lower meanwhile.
+static int isOverAreaLimit(skylineContext *ctx, int right, int bottom) {
+  unsigned int limit;
+  ctx->usedWidth = MAX(ctx->usedWidth, right);
+  ctx->usedHeight = MAX(ctx->usedHeight, bottom);
+  if (!ctx->areaLimit) {
+    return 0;
+  }
+  limit = sysOpsAtomicLoad(ctx->areaLimit);
+  return limit > 0 &&
+    (unsigned long long)ctx->usedWidth * ctx->usedHeight > limit;
+}
+
+static int startLayout(skylineContext *ctx) {
+  int i;
+  for (i = 0; i < ctx->rectCount; ++i) {
+    int rectIndex = ctx->order[i].index;
+    maxRectsSize *size = &ctx->rects[rectIndex];
+    maxRectsPosition *pos = &ctx->layoutResults[rectIndex];
+    int result = placeRect(ctx, size->width, size->height, pos);
+    if (result < 0) {
+      return -1;
+    }
+    if (result > 0) {
+      // Filling a page skips what does not fit.
+      if (ctx->placed) {
+        continue;
+      }
+      return -1;
+    }
+    if (ctx->placed) {
+      ctx->placed[rectIndex] = 1;
+    }
+    if (isOverAreaLimit(ctx,
+        pos->left + (pos->rotated ? size->height : size->width),
+        pos->top + (pos->rotated ? size->width : size->height))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int layoutRects(int width, int height, int rectCount,
+    maxRectsSize *rects, enum skylineLevelChoiceHeuristic method,
+    int allowRotations, int useWasteMap, maxRectsPosition *layoutResults,
+    char *placed, const unsigned int *areaLimit, float *occupancy) {
+  skylineContext contextStruct;
+  skylineContext *ctx = &contextStruct;
+  int result;
+  memset(ctx, 0, sizeof(skylineContext));
+  ctx->width = width;
+  ctx->height = height;
+  ctx->rectCount = rectCount;
+  ctx->rects = rects;
+  ctx->layoutResults = layoutResults;
+  ctx->placed = placed;
+  ctx->areaLimit = areaLimit;
+  if (placed) {
+    memset(placed, 0, rectCount);
+  }
+  ctx->method = method;
+  ctx->allowRotations = allowRotations;
+  ctx->useWasteMap = useWasteMap;
+  if (0 != initContext(ctx)) {
+    releaseContext(ctx);
+    return -1;
+  }
+  result = startLayout(ctx);
+  if (0 != result) {
+    releaseContext(ctx);
+    return result;
+  }
+  if (occupancy) {
+    unsigned long long usedSurfaceArea = 0;
+    int i;
+    for (i = 0; i < rectCount; ++i) {
+      if (!placed || placed[i]) {
+        usedSurfaceArea += rects[i].width * rects[i].height;
+      }
+    }
+    *occupancy = (float)usedSurfaceArea / (width * height);
+  }
+  releaseContext(ctx);
+  return 0;
+}
+
+int skyline(int width, int height, int rectCount, maxRectsSize *rects,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap, maxRectsPosition *layoutResults, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, method, allowRotations,
+    useWasteMap, layoutResults, 0, 0, occupancy);
+}
+
+int skylineFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap, maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, float *occupancy) {
+  return layoutRects(width, height, rectCount, rects, method, allowRotations,
+    useWasteMap, layoutResults, placed, areaLimit, occupancy);
+}
+
+struct skylinePacker {
+  skylineContext context;
+  unsigned long long usedSurfaceArea;
+};
+
+skylinePacker *skylinePackerBegin(int width, int height,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap) {
+  skylinePacker *packer = (skylinePacker *)calloc(1, sizeof(skylinePacker));
+  skylineContext *ctx;
+  if (!packer) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  ctx = &packer->context;
+  ctx->width = width;
+  ctx->height = height;
+  ctx->method = method;
+  ctx->allowRotations = allowRotations;
+  ctx->useWasteMap = useWasteMap;
+  if (0 != initContext(ctx)) {
+    releaseContext(ctx);
+    free(packer);
+    return 0;
+  }
+  return packer;
+}
+
+int skylinePackerAdd(skylinePacker *packer, int width, int height,
+    maxRectsPosition *result) {
+  if (0 != placeRect(&packer->context, width, height, result)) {
+    return -1;
+  }
+  packer->usedSurfaceArea += (unsigned long long)width * height;
+  return 0;
+}
+
+void skylinePackerFinish(skylinePacker *packer, float *occupancy) {
+  skylineContext *ctx = &packer->context;
+  if (occupancy) {
+    *occupancy = (float)packer->usedSurfaceArea / (ctx->width * ctx->height);
+  }
+  releaseContext(ctx);
+  free(packer);
+}
@@ -0,0 +1,57 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SKYLINE_H
+#define SKYLINE_H
+
+#include "maxrects.h"
+
+enum skylineLevelChoiceHeuristic {
+  skylineBottomLeft, ///< -BL: Places each rect where its top edge ends up lowest.
+  skylineMinWasteFit ///< -MW: Places each rect where it leaves the least area unusable below it.
+};
+
+// Packs the rects along a skyline, tallest first, which is much cheaper
+// than maxRects on big inputs at some cost in occupancy. With useWasteMap
+// the gaps left below the skyline are kept and filled first. Fails quietly
+// like maxRects when the rects do not fit.
+int skyline(int width, int height, int rectCount, maxRectsSize *rects,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap, maxRectsPosition *layoutResults, float *occupancy);
+
+// Like skyline, but skips the rects that do not fit instead of failing,
+// for filling one page of a multi-page atlas; placed[i] is set to 1 for
+// every rect that got a position. With placed 0 it fails like skyline.
+// areaLimit works as for maxRectsFill.
+int skylineFill(int width, int height, int rectCount, maxRectsSize *rects,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap, maxRectsPosition *layoutResults, char *placed,
+    const unsigned int *areaLimit, float *occupancy);
+
+typedef struct skylinePacker skylinePacker;
+
+// Online variant of skyline() for rects that arrive one at a time, e.g. as
+// their images are decoded. There is no sorting, so occupancy is lower
+// than the batch call gets from the same rects.
+skylinePacker *skylinePackerBegin(int width, int height,
+    enum skylineLevelChoiceHeuristic method, int allowRotations,
+    int useWasteMap);
+// Places the rect right away; returns -1 if it no longer fits.
+int skylinePackerAdd(skylinePacker *packer, int width, int height,
+    maxRectsPosition *result);
+// Frees the packer, reporting the occupancy of everything added.
+void skylinePackerFinish(skylinePacker *packer, float *occupancy);
+
+#endif
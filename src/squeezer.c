@@ -18,14 +18,44 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include "squeezer.h"
 #include "maxrects.h"
+#include "skyline.h"
+#include "guillotine.h"
+#include "exact.h"
+#include "predictor.h"
 #include "imageops.h"
+#include "sysops.h"
 
 #ifdef _WIN32
 #define snprintf sprintf_s
 #endif
 
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define SQUEEZER_MAX_JOBS 64
+
+// Widths the free aspect auto size search starts from when the size rule
+// allows more than that.
+#define SQUEEZER_AUTO_SIZE_WIDTHS 32
+
+// Decoded sprites waiting to be placed, per decoder thread.
+#define SQUEEZER_STREAM_SLOTS_PER_JOB 2
+
+// Largest image count the exact solver is tried on; beyond it a proof
+// rarely finishes in any useful time.
+#define SQUEEZER_EXACT_MAX_ITEMS 40
+
 typedef struct fileItem {
   struct fileItem *next;
   char filename[780];
@@ -121,6 +151,65 @@ typedef struct trimInfo {
   int originHeight;
 } trimInfo;
 
+// One bin size tried by the auto size search. With measureHeight the
+// rects are packed into width x maxSize and height is what they used.
+typedef struct sizeCandidate {
+  int width;
+  int height;
+  int measureHeight;
+  int fits;
+  double seconds;
+} sizeCandidate;
+
+typedef struct packJob {
+  enum squeezerAlgorithm algorithm;
+  int binWidth;
+  int binHeight;
+  enum maxRectsFreeRectChoiceHeuristic method;
+  enum skylineLevelChoiceHeuristic skylineMethod;
+  enum guillotineFreeRectChoiceHeuristic guillotineChoice;
+  enum guillotineSplitHeuristic guillotineSplit;
+  maxRectsSize *inputs;
+  int inputCount;
+  // Set when filling a page: the job places what fits and marks it here.
+  char *placed;
+  // Set when the job may stop once it cannot beat the best layout so far.
+  const unsigned int *areaLimit;
+  // sysOpsGetTime the job gives up at, 0 for none.
+  double deadline;
+  maxRectsPosition *results;
+  float occupancy;
+  unsigned long long area;
+  double seconds;
+  int failed;
+  int pruned;
+  int timedOut;
+} packJob;
+
+// One sprite of a layout read back from squeezerOutputXml.
+typedef struct previousSprite {
+  char name[780];
+  int left;
+  int top;
+  int width;
+  int height;
+  int rotated;
+  int page;
+} previousSprite;
+
+// One decoded sprite handed from a decoder thread to the packing thread.
+// state is 0 while decoding, 1 when image is ready and -1 on failure.
+typedef struct streamSlot {
+  char filename[780];
+  char shortName[780];
+  imageOpsImage *image;
+  int trimOffsetLeft;
+  int trimOffsetTop;
+  int originWidth;
+  int originHeight;
+  int state;
+} streamSlot;
+
 struct squeezer {
   fileItem *fileList;
   int itemCount;
@@ -128,12 +217,78 @@ struct squeezer {
   const char **shortNameArray;
   maxRectsSize *inputs;
   maxRectsPosition *results;
+  packJob *packJobs;
+  int packJobCount;
+  int nextPackJob;
+  sysOpsMutex *packJobMutex;
+  unsigned int areaLimit;
   trimInfo *trimInfos;
   float bestOccupancy;
   maxRectsPosition *bestResults;
-  imageOpsImage *binImage;
+  imageOpsImage **binImages;
+  int pageCount;
+  int *pages;
   int binWidth;
   int binHeight;
+  int jobs;
+  enum squeezerAlgorithm algorithm;
+  enum squeezerSizeRule sizeRule;
+  int sizeMultiple;
+  int maxSize;
+  enum squeezerCrop crop;
+  double optimizeSeconds;
+  int optimizeIterations;
+  unsigned int seed;
+  int beamWidth;
+  int beamThreads;
+  double exactSeconds;
+  // A squeezerDoDir with a time budget stops searching at the deadline.
+  // The baseline is the skyline layout it starts from, in a bin of
+  // baselineWidth x baselineHeight, and timedOut is set once the deadline
+  // cut anything short.
+  double budgetSeconds;
+  double deadline;
+  unsigned long long baselineArea;
+  int baselineWidth;
+  int baselineHeight;
+  int timedOut:1;
+  predictor *model;
+  // Heuristics the model picked for the images, the whole sweep when 0.
+  int predicted[SQUEEZER_MAX_JOBS];
+  int predictedCount;
+  int profile;
+  int calibrationCount;
+  int calibrating:1;
+  int square:1;
+  sizeCandidate *triedSizes;
+  int triedSizeCount;
+  int triedSizeCapacity;
+  const char *streamDirName;
+  DIR *streamDir;
+  sysOpsMutex *streamMutex;
+  sysOpsCondition *streamCondition;
+  streamSlot *streamSlots;
+  int streamSlotCount;
+  int streamCapacity;
+  int nextDecode;
+  int nextPlace;
+  int decodeEnd;
+  // Opened by the first edit of a finished layout, with the id of every
+  // image in it.
+  maxRectsSession *session;
+  int *sessionIds;
+  previousSprite *previousSprites;
+  int previousCount;
+  int previousWidth;
+  int previousHeight;
+  // Images left where the previous layout had them, and the pixels of the
+  // sprites that moved, appeared or went away.
+  int keptCount;
+  unsigned long long changedPixels;
+  int streamStop:1;
+  int streaming:1;
+  int multiPage:1;
+  int ownsShortNames:1;
   int verbose:1;
   int border:1;
   int allowRotations:1;
@@ -141,12 +296,36 @@ struct squeezer {
 
 static void initSqueezer(squeezer *ctx) {
   memset(ctx, 0, sizeof(squeezer));
+  ctx->maxSize = 4096;
+}
+
+static void stopSession(squeezer *ctx) {
+  if (ctx->session) {
+    maxRectsSessionDestroy(ctx->session);
+    ctx->session = 0;
+  }
+  if (ctx->sessionIds) {
+    free(ctx->sessionIds);
+    ctx->sessionIds = 0;
+  }
 }
 
 static void releaseSqueezer(squeezer *ctx) {
-  if (ctx->binImage) {
-    imageOpsDestroy(ctx->binImage);
-    ctx->binImage = 0;
+  int index;
+  stopSession(ctx);
+  if (ctx->binImages) {
+    for (index = 0; index < ctx->pageCount; ++index) {
+      if (ctx->binImages[index]) {
+        imageOpsDestroy(ctx->binImages[index]);
+      }
+    }
+    free(ctx->binImages);
+    ctx->binImages = 0;
+  }
+  ctx->pageCount = 0;
+  if (ctx->pages) {
+    free(ctx->pages);
+    ctx->pages = 0;
   }
   if (ctx->fileList) {
     freeFileList(ctx->fileList);
@@ -156,6 +335,11 @@ static void releaseSqueezer(squeezer *ctx) {
     free(ctx->results);
     ctx->results = 0;
   }
+  if (ctx->packJobs) {
+    free(ctx->packJobs);
+    ctx->packJobs = 0;
+  }
+  ctx->packJobCount = 0;
   if (ctx->bestResults) {
     free(ctx->bestResults);
     ctx->bestResults = 0;
@@ -165,6 +349,12 @@ static void releaseSqueezer(squeezer *ctx) {
     ctx->filenameArray = 0;
   }
   if (ctx->shortNameArray) {
+    if (ctx->ownsShortNames) {
+      for (index = 0; index < ctx->itemCount; ++index) {
+        free((char *)ctx->shortNameArray[index]);
+      }
+      ctx->ownsShortNames = 0;
+    }
     free(ctx->shortNameArray);
     ctx->shortNameArray = 0;
   }
@@ -172,6 +362,49 @@ static void releaseSqueezer(squeezer *ctx) {
     free(ctx->trimInfos);
     ctx->trimInfos = 0;
   }
+  if (ctx->inputs) {
+    free(ctx->inputs);
+    ctx->inputs = 0;
+  }
+  ctx->itemCount = 0;
+  ctx->bestOccupancy = 0;
+  ctx->streamCapacity = 0;
+  ctx->keptCount = 0;
+  ctx->changedPixels = 0;
+  ctx->deadline = 0;
+  ctx->baselineArea = 0;
+  ctx->baselineWidth = 0;
+  ctx->baselineHeight = 0;
+  ctx->timedOut = 0;
+  if (ctx->triedSizes) {
+    free(ctx->triedSizes);
+    ctx->triedSizes = 0;
+  }
+  ctx->triedSizeCount = 0;
+  ctx->triedSizeCapacity = 0;
+}
+
+static int getPage(squeezer *ctx, int index) {
+  return ctx->pages ? ctx->pages[index] : 0;
+}
+
+static int createBinImages(squeezer *ctx, int pageCount) {
+  int index;
+  ctx->binImages = (imageOpsImage **)calloc(pageCount,
+    sizeof(imageOpsImage *));
+  if (!ctx->binImages) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return -1;
+  }
+  ctx->pageCount = pageCount;
+  for (index = 0; index < pageCount; ++index) {
+    ctx->binImages[index] = imageOpsCreate(ctx->binWidth, ctx->binHeight);
+    if (!ctx->binImages[index]) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "imageOpsCreate failed");
+      return -1;
+    }
+  }
+  return 0;
 }
 
 static int outputInfo(squeezer *ctx, const char *outputInfoFilename) {
@@ -183,8 +416,13 @@ static int outputInfo(squeezer *ctx, const char *outputInfoFilename) {
     return -1;
   }
   fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  fprintf(fp, "<texture width=\"%d\" height=\"%d\">\n",
-    ctx->binWidth, ctx->binHeight);
+  if (ctx->multiPage) {
+    fprintf(fp, "<texture width=\"%d\" height=\"%d\" pages=\"%d\">\n",
+      ctx->binWidth, ctx->binHeight, ctx->pageCount);
+  } else {
+    fprintf(fp, "<texture width=\"%d\" height=\"%d\">\n",
+      ctx->binWidth, ctx->binHeight);
+  }
   for (index = 0; index < ctx->itemCount; ++index) {
     maxRectsSize *ipt = &ctx->inputs[index];
     maxRectsPosition *pos = &ctx->bestResults[index];
@@ -196,6 +434,9 @@ static int outputInfo(squeezer *ctx, const char *outputInfoFilename) {
       ipt->width, ipt->height);
     fprintf(fp, " trimOffsetLeft=\"%d\" trimOffsetTop=\"%d\" originWidth=\"%d\" originHeight=\"%d\"",
       trim->offsetLeft, trim->offsetTop, trim->originWidth, trim->originHeight);
+    if (ctx->multiPage) {
+      fprintf(fp, " page=\"%d\"", getPage(ctx, index));
+    }
     fprintf(fp, "></sprite>\n");
   }
   fprintf(fp, "</texture>\n");
@@ -234,74 +475,2122 @@ void squeezerSetHasBorder(squeezer *ctx, int hasBorder) {
   ctx->border = hasBorder;
 }
 
-int squeezerDoDir(squeezer *ctx, const char *dir) {
-  int index;
-  fileItem *loopItem;
+void squeezerSetJobs(squeezer *ctx, int jobs) {
+  ctx->jobs = jobs;
+}
 
-  enum maxRectsFreeRectChoiceHeuristic methods[] = {
-    rectBestShortSideFit, ///< -BSSF: Positions the rectangle against the short side of a free rectangle into which it fits the best.
-    rectBestLongSideFit, ///< -BLSF: Positions the rectangle against the long side of a free rectangle into which it fits the best.
-    rectBestAreaFit, ///< -BAF: Positions the rectangle into the smallest free rect into which it fits.
-    rectBottomLeftRule, ///< -BL: Does the Tetris placement.
-    rectContactPointRule ///< -CP: Choosest the placement where the rectangle touches other rects as much as possible.
-  };
+void squeezerSetAlgorithm(squeezer *ctx, enum squeezerAlgorithm algorithm) {
+  ctx->algorithm = algorithm;
+}
 
-  releaseSqueezer(ctx);
+static const enum maxRectsFreeRectChoiceHeuristic maxRectsMethods[] = {
+  rectBestShortSideFit, ///< -BSSF: Positions the rectangle against the short side of a free rectangle into which it fits the best.
+  rectBestLongSideFit, ///< -BLSF: Positions the rectangle against the long side of a free rectangle into which it fits the best.
+  rectBestAreaFit, ///< -BAF: Positions the rectangle into the smallest free rect into which it fits.
+  rectBottomLeftRule, ///< -BL: Does the Tetris placement.
+  rectContactPointRule ///< -CP: Choosest the placement where the rectangle touches other rects as much as possible.
+};
 
-  if (ctx->verbose) {
-    printf("preparing to squeezer\n");
+static const enum skylineLevelChoiceHeuristic skylineMethods[] = {
+  skylineBottomLeft,
+  skylineMinWasteFit
+};
+
+static const enum guillotineFreeRectChoiceHeuristic guillotineChoices[] = {
+  guillotineBestShortSideFit,
+  guillotineBestAreaFit,
+  guillotineBestLongSideFit
+};
+
+// The two split rules that keep the bigger leftover whole; the others
+// waste noticeably more space on sprite sheets.
+static const enum guillotineSplitHeuristic guillotineSplits[] = {
+  guillotineSplitShorterLeftoverAxis,
+  guillotineSplitMinimizeArea
+};
+
+#define MAX_RECTS_METHOD_COUNT \
+  (int)(sizeof(maxRectsMethods) / sizeof(maxRectsMethods[0]))
+#define SKYLINE_METHOD_COUNT \
+  (int)(sizeof(skylineMethods) / sizeof(skylineMethods[0]))
+#define GUILLOTINE_SPLIT_COUNT \
+  (int)(sizeof(guillotineSplits) / sizeof(guillotineSplits[0]))
+#define GUILLOTINE_METHOD_COUNT \
+  (int)(sizeof(guillotineChoices) / sizeof(guillotineChoices[0]) * \
+    GUILLOTINE_SPLIT_COUNT)
+
+// Number of heuristics the sweep of the algorithm has. The MaxRects sweep
+// also runs the guillotine jobs, they cost next to nothing and can still
+// fit a set the MaxRects heuristics could not.
+static int getSweepCount(squeezer *ctx) {
+  if (squeezerSkyline == ctx->algorithm) {
+    return SKYLINE_METHOD_COUNT;
   }
+  if (squeezerGuillotine == ctx->algorithm) {
+    return GUILLOTINE_METHOD_COUNT;
+  }
+  return MAX_RECTS_METHOD_COUNT + GUILLOTINE_METHOD_COUNT;
+}
 
-  if (ctx->verbose) {
-    printf("fetching file list from dir(%s)\n", dir);
+// Number of heuristics one bin size is tried with.
+static int getHeuristicCount(squeezer *ctx) {
+  return ctx->predictedCount > 0 ? ctx->predictedCount : getSweepCount(ctx);
+}
+
+static void setJobHeuristic(squeezer *ctx, packJob *job, int index) {
+  int heuristic = ctx->predictedCount > 0 ? ctx->predicted[index] : index;
+  if (squeezerSkyline == ctx->algorithm) {
+    job->algorithm = squeezerSkyline;
+    job->skylineMethod = skylineMethods[heuristic];
+  } else if (squeezerMaxRects == ctx->algorithm &&
+      heuristic < MAX_RECTS_METHOD_COUNT) {
+    job->algorithm = squeezerMaxRects;
+    job->method = maxRectsMethods[heuristic];
+  } else {
+    int guillotineIndex = squeezerMaxRects == ctx->algorithm ?
+      heuristic - MAX_RECTS_METHOD_COUNT : heuristic;
+    job->algorithm = squeezerGuillotine;
+    job->guillotineChoice =
+      guillotineChoices[guillotineIndex / GUILLOTINE_SPLIT_COUNT];
+    job->guillotineSplit =
+      guillotineSplits[guillotineIndex % GUILLOTINE_SPLIT_COUNT];
   }
+}
 
-  ctx->fileList = getFileListInDir(dir, &ctx->itemCount);
-  if (!ctx->fileList) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "getFileListInDir failed");
-    releaseSqueezer(ctx);
+// Replaces the pack jobs with jobCount fresh ones, cycling through the
+// heuristics, all for the current bin size.
+static int createPackJobs(squeezer *ctx, int jobCount) {
+  int heuristicCount = getHeuristicCount(ctx);
+  int index;
+  free(ctx->packJobs);
+  free(ctx->results);
+  ctx->packJobCount = jobCount;
+  ctx->packJobs = (packJob *)calloc(jobCount, sizeof(packJob));
+  ctx->results = (maxRectsPosition *)calloc(ctx->itemCount * jobCount,
+    sizeof(maxRectsPosition));
+  if (!ctx->packJobs || !ctx->results) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
     return -1;
   }
+  for (index = 0; index < jobCount; ++index) {
+    packJob *job = &ctx->packJobs[index];
+    setJobHeuristic(ctx, job, index % heuristicCount);
+    job->binWidth = ctx->binWidth;
+    job->binHeight = ctx->binHeight;
+    job->inputs = ctx->inputs;
+    job->inputCount = ctx->itemCount;
+    job->results = ctx->results + index * ctx->itemCount;
+    job->deadline = ctx->deadline;
+  }
+  return 0;
+}
 
-  if (ctx->verbose) {
-    printf("alloc memory for squeezer\n");
+void squeezerSetAutoSize(squeezer *ctx, enum squeezerSizeRule rule,
+    int multiple) {
+  ctx->sizeRule = rule;
+  ctx->sizeMultiple = multiple > 0 ? multiple : 1;
+}
+
+void squeezerSetSquare(squeezer *ctx, int square) {
+  ctx->square = square;
+}
+
+void squeezerSetMaxSize(squeezer *ctx, int maxSize) {
+  ctx->maxSize = maxSize;
+}
+
+void squeezerSetCrop(squeezer *ctx, enum squeezerCrop crop) {
+  ctx->crop = crop;
+}
+
+void squeezerSetOptimizeTime(squeezer *ctx, double seconds) {
+  ctx->optimizeSeconds = seconds;
+}
+
+void squeezerSetOptimizeIterations(squeezer *ctx, int iterations) {
+  ctx->optimizeIterations = iterations;
+}
+
+void squeezerSetSeed(squeezer *ctx, unsigned int seed) {
+  ctx->seed = seed;
+}
+
+void squeezerSetBeamWidth(squeezer *ctx, int beamWidth) {
+  ctx->beamWidth = beamWidth;
+}
+
+void squeezerSetTimeBudget(squeezer *ctx, double seconds) {
+  ctx->budgetSeconds = seconds;
+}
+
+void squeezerSetExact(squeezer *ctx, double seconds) {
+  ctx->exactSeconds = seconds;
+}
+
+static int createModel(squeezer *ctx) {
+  const char *name = squeezerSkyline == ctx->algorithm ? "skyline" :
+    (squeezerGuillotine == ctx->algorithm ? "guillotine" : "maxrects");
+  ctx->model = predictorCreate(name, getSweepCount(ctx));
+  if (!ctx->model) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "predictorCreate failed");
+    return -1;
   }
+  return 0;
+}
 
-  ctx->filenameArray = (const char **)calloc(ctx->itemCount,
-    sizeof(const char *));
-  if (!ctx->filenameArray) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
-    releaseSqueezer(ctx);
+int squeezerLoadModel(squeezer *ctx, const char *filename) {
+  if (!ctx->model && 0 != createModel(ctx)) {
     return -1;
   }
+  return predictorLoad(ctx->model, filename);
+}
 
-  ctx->shortNameArray = (const char **)calloc(ctx->itemCount,
-    sizeof(const char *));
-  if (!ctx->shortNameArray) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
-    releaseSqueezer(ctx);
+// Copies the value of name="value" in an XML tag; returns 0 if it is there.
+static int getXmlAttribute(const char *tag, const char *name, char *value,
+    int size) {
+  char pattern[64];
+  const char *begin;
+  const char *end;
+  snprintf(pattern, sizeof(pattern), " %s=\"", name);
+  begin = strstr(tag, pattern);
+  if (!begin) {
+    return -1;
+  }
+  begin += strlen(pattern);
+  end = strchr(begin, '"');
+  if (!end || end - begin >= size) {
     return -1;
   }
+  memcpy(value, begin, end - begin);
+  value[end - begin] = '\0';
+  return 0;
+}
 
-  ctx->inputs = (maxRectsSize *)calloc(ctx->itemCount, sizeof(maxRectsSize));
-  if (!ctx->inputs) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
-    releaseSqueezer(ctx);
+static int getXmlNumber(const char *tag, const char *name, int *number) {
+  char value[32];
+  if (0 != getXmlAttribute(tag, name, value, sizeof(value))) {
     return -1;
   }
-  for (index = 0, loopItem = ctx->fileList; loopItem;
-      loopItem = loopItem->next, ++index) {
+  *number = atoi(value);
+  return 0;
+}
+
+// Reads the texture size and the sprites of an XML written by outputInfo,
+// which puts every tag on a line of its own.
+static int readPreviousLayout(squeezer *ctx, FILE *fp) {
+  char line[4096];
+  int capacity = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    previousSprite *sprite;
+    char rotated[8];
+    if (strstr(line, "<texture ")) {
+      if (0 != getXmlNumber(line, "width", &ctx->previousWidth) ||
+          0 != getXmlNumber(line, "height", &ctx->previousHeight)) {
+        fprintf(stderr, "%s: %s\n", __FUNCTION__, "texture has no size");
+        return -1;
+      }
+      continue;
+    }
+    if (!strstr(line, "<sprite ")) {
+      continue;
+    }
+    if (ctx->previousCount == capacity) {
+      previousSprite *sprites;
+      capacity = capacity ? capacity * 2 : 256;
+      sprites = (previousSprite *)realloc(ctx->previousSprites,
+        sizeof(previousSprite) * capacity);
+      if (!sprites) {
+        fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+        return -1;
+      }
+      ctx->previousSprites = sprites;
+    }
+    sprite = &ctx->previousSprites[ctx->previousCount];
+    if (0 != getXmlAttribute(line, "name", sprite->name,
+          sizeof(sprite->name)) ||
+        0 != getXmlNumber(line, "left", &sprite->left) ||
+        0 != getXmlNumber(line, "top", &sprite->top) ||
+        0 != getXmlNumber(line, "width", &sprite->width) ||
+        0 != getXmlNumber(line, "height", &sprite->height) ||
+        0 != getXmlAttribute(line, "rotated", rotated, sizeof(rotated))) {
+      fprintf(stderr, "%s: bad sprite: %s", __FUNCTION__, line);
+      return -1;
+    }
+    sprite->rotated = 0 == strcmp(rotated, "true");
+    if (0 != getXmlNumber(line, "page", &sprite->page)) {
+      sprite->page = 0;
+    }
+    ++ctx->previousCount;
+  }
+  return 0;
+}
+
+static void releasePreviousLayout(squeezer *ctx) {
+  free(ctx->previousSprites);
+  ctx->previousSprites = 0;
+  ctx->previousCount = 0;
+  ctx->previousWidth = 0;
+  ctx->previousHeight = 0;
+}
+
+int squeezerSetPreviousLayout(squeezer *ctx, const char *filename) {
+  FILE *fp;
+  int result;
+  releasePreviousLayout(ctx);
+  if (!filename) {
+    return 0;
+  }
+  fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "%s: fopen %s failed\n", __FUNCTION__, filename);
+    return -1;
+  }
+  result = readPreviousLayout(ctx, fp);
+  fclose(fp);
+  if (0 != result || 0 == ctx->previousWidth || 0 == ctx->previousHeight) {
+    fprintf(stderr, "%s: %s is no layout of squeezer\n", __FUNCTION__,
+      filename);
+    releasePreviousLayout(ctx);
+    return -1;
+  }
+  return 0;
+}
+
+int squeezerGetKeptCount(squeezer *ctx) {
+  return ctx->keptCount;
+}
+
+unsigned long long squeezerGetChangedPixels(squeezer *ctx) {
+  return ctx->changedPixels;
+}
+
+int squeezerGetBinWidth(squeezer *ctx) {
+  return ctx->binWidth;
+}
+
+int squeezerGetBinHeight(squeezer *ctx) {
+  return ctx->binHeight;
+}
+
+int squeezerGetTriedSizeCount(squeezer *ctx) {
+  return ctx->triedSizeCount;
+}
+
+int squeezerGetTriedSize(squeezer *ctx, int index, int *width, int *height,
+    double *seconds) {
+  sizeCandidate *candidate = &ctx->triedSizes[index];
+  *width = candidate->width;
+  *height = candidate->height;
+  *seconds = candidate->seconds;
+  return candidate->fits;
+}
+
+void squeezerSetMultiPage(squeezer *ctx, int multiPage) {
+  ctx->multiPage = multiPage;
+}
+
+int squeezerGetPageCount(squeezer *ctx) {
+  return ctx->pageCount;
+}
+
+void squeezerSetStreaming(squeezer *ctx, int streaming) {
+  ctx->streaming = streaming;
+}
+
+static int roundUpPowerOfTwo(int size) {
+  int rounded = 1;
+  while (rounded < size) {
+    rounded <<= 1;
+  }
+  return rounded;
+}
+
+// Bounding box of a layout, from the top left corner of the bin.
+static void getUsedSize(squeezer *ctx, maxRectsPosition *results,
+    int *usedWidth, int *usedHeight) {
+  int index;
+  *usedWidth = 0;
+  *usedHeight = 0;
+  for (index = 0; index < ctx->itemCount; ++index) {
     maxRectsSize *ipt = &ctx->inputs[index];
-    ipt->width = loopItem->width;
-    ipt->height = loopItem->height;
-    ctx->filenameArray[index] = loopItem->filename;
-    ctx->shortNameArray[index] = loopItem->shortName;
+    maxRectsPosition *pos = &results[index];
+    int right = pos->left + (pos->rotated ? ipt->height : ipt->width);
+    int bottom = pos->top + (pos->rotated ? ipt->width : ipt->height);
+    *usedWidth = MAX(*usedWidth, right);
+    *usedHeight = MAX(*usedHeight, bottom);
   }
+}
 
-  ctx->results = (maxRectsPosition *)calloc(ctx->itemCount,
-    sizeof(maxRectsPosition));
-  if (!ctx->results) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+// Side of the texture a layout that uses size of a binSize side needs.
+static int getCropSize(squeezer *ctx, int size, int binSize) {
+  if (squeezerCropPowerOfTwo == ctx->crop) {
+    return MIN(binSize, roundUpPowerOfTwo(size));
+  }
+  return size;
+}
+
+// Score of a layout, lower is better: the area of the texture it would be
+// cropped to. Without a crop the bounding box still tells apart layouts
+// that fit the same bin.
+static unsigned long long getLayoutArea(squeezer *ctx,
+    maxRectsPosition *results, int binWidth, int binHeight) {
+  int usedWidth;
+  int usedHeight;
+  getUsedSize(ctx, results, &usedWidth, &usedHeight);
+  return (unsigned long long)getCropSize(ctx, usedWidth, binWidth) *
+    getCropSize(ctx, usedHeight, binHeight);
+}
+
+static unsigned long long getTotalArea(squeezer *ctx) {
+  unsigned long long area = 0;
+  int index;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    area += (unsigned long long)ctx->inputs[index].width *
+      ctx->inputs[index].height;
+  }
+  return area;
+}
+
+// Whether every image has the same size, the one case a grid is laid out
+// without trying the heuristics.
+static int hasSingleSize(squeezer *ctx) {
+  int index;
+  for (index = 1; index < ctx->itemCount; ++index) {
+    if (ctx->inputs[index].width != ctx->inputs[0].width ||
+        ctx->inputs[index].height != ctx->inputs[0].height) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Lowers the shared area limit to the texture area of a finished layout,
+// so the jobs still running stop as soon as they cannot beat it.
+static void lowerAreaLimit(squeezer *ctx, unsigned long long area) {
+  if (ctx->packJobMutex) {
+    sysOpsMutexLock(ctx->packJobMutex);
+  }
+  if (area <= UINT_MAX && (0 == ctx->areaLimit || area < ctx->areaLimit)) {
+    sysOpsAtomicStore(&ctx->areaLimit, (unsigned int)area);
+  }
+  if (ctx->packJobMutex) {
+    sysOpsMutexUnlock(ctx->packJobMutex);
+  }
+}
+
+static void runPackJob(squeezer *ctx, packJob *job) {
+  double start = sysOpsGetTime();
+  int result;
+  // Jobs still queued at the deadline are not started at all.
+  if (job->deadline > 0 && start >= job->deadline) {
+    job->failed = 1;
+    job->timedOut = 1;
+    return;
+  }
+  if (squeezerSkyline == job->algorithm) {
+    result = skylineFill(job->binWidth, job->binHeight, job->inputCount,
+      job->inputs, job->skylineMethod, ctx->allowRotations, 1, job->results,
+      job->placed, job->areaLimit, &job->occupancy);
+  } else if (squeezerGuillotine == job->algorithm) {
+    result = guillotineFill(job->binWidth, job->binHeight, job->inputCount,
+      job->inputs, job->guillotineChoice, job->guillotineSplit,
+      ctx->allowRotations, 1, job->results, job->placed, job->areaLimit,
+      &job->occupancy);
+  } else if (ctx->beamWidth > 1 && !job->placed) {
+    result = maxRectsBeam(job->binWidth, job->binHeight, job->inputCount,
+      job->inputs, job->method, ctx->allowRotations, ctx->beamWidth,
+      ctx->beamThreads, job->results, job->areaLimit, job->deadline,
+      &job->occupancy);
+  } else {
+    result = maxRectsFill(job->binWidth, job->binHeight, job->inputCount,
+      job->inputs, job->method, ctx->allowRotations, job->results,
+      job->placed, job->areaLimit, job->deadline, &job->occupancy);
+  }
+  job->failed = 0 != result;
+  job->pruned = 1 == result;
+  job->timedOut = 2 == result;
+  if (!job->failed && job->areaLimit) {
+    job->area = getLayoutArea(ctx, job->results, job->binWidth,
+      job->binHeight);
+    lowerAreaLimit(ctx, job->area);
+  }
+  job->seconds = sysOpsGetTime() - start;
+}
+
+static void packWorker(void *param) {
+  squeezer *ctx = (squeezer *)param;
+  for (;;) {
+    int jobIndex;
+    sysOpsMutexLock(ctx->packJobMutex);
+    jobIndex = ctx->nextPackJob++;
+    sysOpsMutexUnlock(ctx->packJobMutex);
+    if (jobIndex >= ctx->packJobCount) {
+      break;
+    }
+    runPackJob(ctx, &ctx->packJobs[jobIndex]);
+  }
+}
+
+static void noteTimedOutJobs(squeezer *ctx) {
+  int index;
+  for (index = 0; index < ctx->packJobCount; ++index) {
+    if (ctx->packJobs[index].timedOut) {
+      ctx->timedOut = 1;
+    }
+  }
+}
+
+static int runPackJobs(squeezer *ctx) {
+  sysOpsThread *threads[SQUEEZER_MAX_JOBS];
+  int threadCount = 0;
+  int index;
+  int workerCount = ctx->jobs;
+  if (workerCount <= 0) {
+    workerCount = sysOpsGetCpuCount();
+  }
+  // A beam search spreads each job over the workers itself, so the jobs
+  // take turns.
+  ctx->beamThreads = workerCount;
+  if (ctx->beamWidth > 1 && squeezerMaxRects == ctx->algorithm) {
+    workerCount = 1;
+  }
+  if (workerCount > ctx->packJobCount) {
+    workerCount = ctx->packJobCount;
+  }
+  if (workerCount > SQUEEZER_MAX_JOBS) {
+    workerCount = SQUEEZER_MAX_JOBS;
+  }
+  if (workerCount <= 1) {
+    for (index = 0; index < ctx->packJobCount; ++index) {
+      runPackJob(ctx, &ctx->packJobs[index]);
+    }
+    noteTimedOutJobs(ctx);
+    return 0;
+  }
+  ctx->packJobMutex = sysOpsMutexCreate();
+  if (!ctx->packJobMutex) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsMutexCreate failed");
+    return -1;
+  }
+  ctx->nextPackJob = 0;
+  // The calling thread is one of the workers.
+  for (index = 1; index < workerCount; ++index) {
+    sysOpsThread *thread = sysOpsThreadCreate(packWorker, ctx);
+    if (!thread) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsThreadCreate failed");
+      break;
+    }
+    threads[threadCount++] = thread;
+  }
+  packWorker(ctx);
+  for (index = 0; index < threadCount; ++index) {
+    sysOpsThreadJoin(threads[index]);
+  }
+  sysOpsMutexDestroy(ctx->packJobMutex);
+  ctx->packJobMutex = 0;
+  noteTimedOutJobs(ctx);
+  return 0;
+}
+
+// Smallest size the size rule allows that is at least size.
+static int roundUpSize(squeezer *ctx, int size) {
+  if (size < 1) {
+    size = 1;
+  }
+  if (squeezerSizePowerOfTwo == ctx->sizeRule) {
+    return roundUpPowerOfTwo(size);
+  }
+  return (size + ctx->sizeMultiple - 1) / ctx->sizeMultiple *
+    ctx->sizeMultiple;
+}
+
+// Largest size the size rule allows that is at most size, 0 if none.
+static int roundDownSize(squeezer *ctx, int size) {
+  if (squeezerSizePowerOfTwo == ctx->sizeRule) {
+    int rounded = 1;
+    if (size < 1) {
+      return 0;
+    }
+    while (rounded * 2 <= size) {
+      rounded <<= 1;
+    }
+    return rounded;
+  }
+  return size / ctx->sizeMultiple * ctx->sizeMultiple;
+}
+
+// Whether a width x height bin beats the other one: less area first, then
+// closer to square, then narrower.
+static int isBetterSize(int width, int height, int otherWidth,
+    int otherHeight) {
+  unsigned long long area = (unsigned long long)width * height;
+  unsigned long long otherArea = (unsigned long long)otherWidth * otherHeight;
+  if (area != otherArea) {
+    return area < otherArea;
+  }
+  if (abs(width - height) != abs(otherWidth - otherHeight)) {
+    return abs(width - height) < abs(otherWidth - otherHeight);
+  }
+  return width < otherWidth;
+}
+
+static int recordTriedSize(squeezer *ctx, sizeCandidate *candidate) {
+  if (ctx->triedSizeCount == ctx->triedSizeCapacity) {
+    int capacity = ctx->triedSizeCapacity ? ctx->triedSizeCapacity * 2 : 32;
+    sizeCandidate *triedSizes = (sizeCandidate *)realloc(ctx->triedSizes,
+      sizeof(sizeCandidate) * capacity);
+    if (!triedSizes) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    ctx->triedSizes = triedSizes;
+    ctx->triedSizeCapacity = capacity;
+  }
+  ctx->triedSizes[ctx->triedSizeCount++] = *candidate;
+  return 0;
+}
+
+// Runs every heuristic on every candidate at once on the worker pool. The
+// candidates are updated with the outcome, and the best layout so far is
+// kept in bestResults with its size in best.
+static int tryCandidates(squeezer *ctx, sizeCandidate *candidates,
+    int candidateCount, sizeCandidate *best) {
+  int heuristicCount = getHeuristicCount(ctx);
+  int index;
+  if (0 != createPackJobs(ctx, candidateCount * heuristicCount)) {
+    return -1;
+  }
+  for (index = 0; index < ctx->packJobCount; ++index) {
+    sizeCandidate *candidate = &candidates[index / heuristicCount];
+    ctx->packJobs[index].binWidth = candidate->width;
+    ctx->packJobs[index].binHeight = candidate->measureHeight ?
+      ctx->maxSize : candidate->height;
+  }
+  if (0 != runPackJobs(ctx)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "runPackJobs failed");
+    return -1;
+  }
+  for (index = 0; index < candidateCount; ++index) {
+    sizeCandidate *candidate = &candidates[index];
+    packJob *winner = 0;
+    int height = 0;
+    unsigned long long area = 0;
+    int heuristic;
+    candidate->seconds = 0;
+    for (heuristic = 0; heuristic < heuristicCount; ++heuristic) {
+      packJob *job = &ctx->packJobs[index * heuristicCount + heuristic];
+      int jobHeight = candidate->height;
+      unsigned long long jobArea;
+      candidate->seconds += job->seconds;
+      if (job->failed) {
+        continue;
+      }
+      jobArea = getLayoutArea(ctx, job->results, job->binWidth,
+        job->binHeight);
+      if (candidate->measureHeight) {
+        int usedWidth;
+        int usedHeight;
+        getUsedSize(ctx, job->results, &usedWidth, &usedHeight);
+        jobHeight = roundUpSize(ctx, usedHeight);
+      }
+      if (!winner || jobHeight < height ||
+          (jobHeight == height && jobArea < area)) {
+        winner = job;
+        height = jobHeight;
+        area = jobArea;
+      }
+    }
+    candidate->fits = 0 != winner;
+    if (winner) {
+      candidate->height = height;
+    } else if (candidate->measureHeight) {
+      candidate->height = ctx->maxSize;
+    }
+    if (0 != recordTriedSize(ctx, candidate)) {
+      return -1;
+    }
+    if (winner && (!best->fits || isBetterSize(candidate->width,
+        candidate->height, best->width, best->height))) {
+      *best = *candidate;
+      memcpy(ctx->bestResults, winner->results,
+        sizeof(maxRectsPosition) * ctx->itemCount);
+    }
+  }
+  return 0;
+}
+
+// Square bins: climbs from the lower bound in growing steps, a few sides
+// at a time, then bisects between the last side that failed and the first
+// that fit.
+static int searchSquareSize(squeezer *ctx, int minSide, int batchSize,
+    sizeCandidate *best) {
+  sizeCandidate candidates[SQUEEZER_MAX_JOBS];
+  // Below minSide nothing fits, which a baseline size is bisected down to.
+  int failedSide = best->fits ? minSide - 1 : 0;
+  int side = roundUpSize(ctx, minSide);
+  int step = 0;
+  int index;
+  while (!best->fits && side <= ctx->maxSize) {
+    int count = 0;
+    while (count < batchSize && side <= ctx->maxSize) {
+      memset(&candidates[count], 0, sizeof(sizeCandidate));
+      candidates[count].width = side;
+      candidates[count].height = side;
+      ++count;
+      step = step ? step * 2 : MAX(1, side / 16);
+      side = roundUpSize(ctx, MAX(side + step, side + 1));
+    }
+    if (0 != tryCandidates(ctx, candidates, count, best)) {
+      return -1;
+    }
+    for (index = 0; index < count; ++index) {
+      if (!candidates[index].fits &&
+          (!best->fits || candidates[index].width < best->width)) {
+        failedSide = MAX(failedSide, candidates[index].width);
+      }
+    }
+  }
+  if (!best->fits) {
+    return 0;
+  }
+  while (best->width > roundUpSize(ctx, failedSide + 1)) {
+    int middle = roundUpSize(ctx, (failedSide + best->width) / 2);
+    sizeCandidate candidate;
+    if (middle <= failedSide || middle >= best->width) {
+      break;
+    }
+    memset(&candidate, 0, sizeof(candidate));
+    candidate.width = middle;
+    candidate.height = middle;
+    if (0 != tryCandidates(ctx, &candidate, 1, best)) {
+      return -1;
+    }
+    if (!candidate.fits) {
+      failedSide = middle;
+    }
+  }
+  return 0;
+}
+
+// Free aspect bins: packs into tall width x maxSize bins and measures the
+// height each width needs, over a ladder of widths refined around the best
+// one. A height rounded up to the next power of two wastes up to half the
+// bin, so the smaller heights are then tried directly.
+static int searchFreeSize(squeezer *ctx, int minWidth, int minHeight,
+    unsigned long long area, sizeCandidate *best) {
+  sizeCandidate candidates[SQUEEZER_AUTO_SIZE_WIDTHS * 2];
+  int firstWidth = roundUpSize(ctx, MAX(minWidth,
+    (int)((area + ctx->maxSize - 1) / ctx->maxSize)));
+  int widthCount = 0;
+  int step;
+  int width;
+  int index;
+  if (squeezerSizePowerOfTwo == ctx->sizeRule ||
+      (ctx->maxSize - firstWidth) / ctx->sizeMultiple <
+        SQUEEZER_AUTO_SIZE_WIDTHS) {
+    step = 0;
+    for (width = firstWidth; width <= ctx->maxSize &&
+        widthCount < SQUEEZER_AUTO_SIZE_WIDTHS;
+        width = roundUpSize(ctx, width + 1)) {
+      memset(&candidates[widthCount], 0, sizeof(sizeCandidate));
+      candidates[widthCount].width = width;
+      candidates[widthCount++].measureHeight = 1;
+    }
+  } else {
+    step = (ctx->maxSize - firstWidth) / (SQUEEZER_AUTO_SIZE_WIDTHS - 1);
+    for (index = 0; index < SQUEEZER_AUTO_SIZE_WIDTHS; ++index) {
+      memset(&candidates[widthCount], 0, sizeof(sizeCandidate));
+      candidates[widthCount].width = MIN(ctx->maxSize,
+        roundUpSize(ctx, firstWidth + index * step));
+      candidates[widthCount++].measureHeight = 1;
+    }
+  }
+  if (widthCount > 0 &&
+      0 != tryCandidates(ctx, candidates, widthCount, best)) {
+    return -1;
+  }
+  if (!best->fits) {
+    return 0;
+  }
+  while (step > ctx->sizeMultiple) {
+    int center = best->width;
+    int count = 0;
+    step /= 2;
+    for (index = -1; index <= 1; index += 2) {
+      width = roundUpSize(ctx, center + index * step);
+      if (width >= firstWidth && width <= ctx->maxSize && width != center) {
+        memset(&candidates[count], 0, sizeof(sizeCandidate));
+        candidates[count].width = width;
+        candidates[count++].measureHeight = 1;
+      }
+    }
+    if (count > 0 && 0 != tryCandidates(ctx, candidates, count, best)) {
+      return -1;
+    }
+  }
+  if (squeezerSizePowerOfTwo == ctx->sizeRule) {
+    int count = 0;
+    for (index = 0; index < ctx->triedSizeCount &&
+        count < SQUEEZER_AUTO_SIZE_WIDTHS * 2; ++index) {
+      sizeCandidate *tried = &ctx->triedSizes[index];
+      int height;
+      if (!tried->fits || !tried->measureHeight) {
+        continue;
+      }
+      for (height = tried->height / 2; height >= 1 &&
+          height >= minHeight &&
+          (unsigned long long)tried->width * height >= area &&
+          count < SQUEEZER_AUTO_SIZE_WIDTHS * 2; height /= 2) {
+        if (!isBetterSize(tried->width, height, best->width, best->height)) {
+          continue;
+        }
+        memset(&candidates[count], 0, sizeof(sizeCandidate));
+        candidates[count].width = tried->width;
+        candidates[count++].height = height;
+      }
+    }
+    if (count > 0 && 0 != tryCandidates(ctx, candidates, count, best)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Picks the smallest bin the size rule allows that the rects pack into,
+// starting from the total rect area and the largest rect, and leaves the
+// winning layout in bestResults.
+static int searchBinSize(squeezer *ctx) {
+  unsigned long long area = 0;
+  int minWidth = 1;
+  int minHeight = 1;
+  int workerCount = ctx->jobs > 0 ? ctx->jobs : sysOpsGetCpuCount();
+  int batchSize = MAX(1, MIN(SQUEEZER_MAX_JOBS,
+    workerCount / getHeuristicCount(ctx)));
+  sizeCandidate best;
+  int index;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    maxRectsSize *ipt = &ctx->inputs[index];
+    area += (unsigned long long)ipt->width * ipt->height;
+    if (ctx->allowRotations) {
+      minWidth = MAX(minWidth, MIN(ipt->width, ipt->height));
+      minHeight = minWidth;
+    } else {
+      minWidth = MAX(minWidth, ipt->width);
+      minHeight = MAX(minHeight, ipt->height);
+    }
+  }
+  ctx->maxSize = roundDownSize(ctx, ctx->maxSize);
+  memset(&best, 0, sizeof(best));
+  // Under a time budget the search only replaces the baseline with a
+  // smaller bin.
+  if (ctx->baselineWidth > 0) {
+    best.width = ctx->baselineWidth;
+    best.height = ctx->baselineHeight;
+    best.fits = 1;
+  }
+  if (ctx->square) {
+    if (0 != searchSquareSize(ctx, MAX(MAX(minWidth, minHeight),
+        (int)ceil(sqrt((double)area))), batchSize, &best)) {
+      return -1;
+    }
+  } else if (0 != searchFreeSize(ctx, minWidth, minHeight, area, &best)) {
+    return -1;
+  }
+  if (!best.fits) {
+    fprintf(stderr, "%s: nothing up to %dx%d fits all images\n",
+      __FUNCTION__, ctx->maxSize, ctx->maxSize);
+    return -1;
+  }
+  ctx->binWidth = best.width;
+  ctx->binHeight = best.height;
+  ctx->bestOccupancy = (float)((double)area / ((double)best.width *
+    best.height));
+  if (ctx->verbose) {
+    printf("auto size picked %dx%d after %d sizes, occupancy %.02f\n",
+      ctx->binWidth, ctx->binHeight, ctx->triedSizeCount,
+      ctx->bestOccupancy);
+  }
+  return 0;
+}
+
+// Sides the exact solver may pick for a bin side: the ones the size rule
+// allows up to maxSize with auto size, else any up to the fixed side the
+// crop can cut the texture down to. Returns the count, -1 on errors.
+static int getExactSides(squeezer *ctx, int binSize, int **sides) {
+  int count = 0;
+  int side;
+  *sides = (int *)malloc(sizeof(int) * MAX(1, binSize));
+  if (!*sides) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  for (side = 1; side <= binSize; ++side) {
+    if (squeezerSizeFixed != ctx->sizeRule) {
+      side = roundUpSize(ctx, side);
+      if (side > binSize) {
+        break;
+      }
+    } else if (squeezerCropPowerOfTwo == ctx->crop && side < binSize) {
+      side = MIN(binSize, roundUpPowerOfTwo(side));
+    }
+    (*sides)[count++] = side;
+  }
+  return count;
+}
+
+// Lays small sets out with the exact solver, which finds the smallest box
+// the size rule or the crop allows. Returns 0 when it settled the layout,
+// 1 when the heuristics or the pages have to do it, as on a timeout, and
+// -1 on errors or when no layout fits the bin at all.
+static int packExact(squeezer *ctx) {
+  int *widths = 0;
+  int *heights = 0;
+  int widthCount;
+  int heightCount;
+  int width = 0;
+  int height = 0;
+  double seconds = ctx->exactSeconds;
+  int result;
+  if (ctx->exactSeconds <= 0 || ctx->itemCount > SQUEEZER_EXACT_MAX_ITEMS) {
+    return 1;
+  }
+  if (ctx->deadline > 0) {
+    seconds = MIN(seconds, ctx->deadline - sysOpsGetTime());
+    if (seconds <= 0) {
+      ctx->timedOut = 1;
+      return 1;
+    }
+  }
+  if (squeezerSizeFixed != ctx->sizeRule) {
+    ctx->maxSize = roundDownSize(ctx, ctx->maxSize);
+    widthCount = getExactSides(ctx, ctx->maxSize, &widths);
+    heightCount = getExactSides(ctx, ctx->maxSize, &heights);
+  } else {
+    widthCount = getExactSides(ctx, ctx->binWidth, &widths);
+    heightCount = getExactSides(ctx, ctx->binHeight, &heights);
+  }
+  result = widthCount < 0 || heightCount < 0 ? -1 :
+    exactMinimumBin(widthCount, widths, heightCount, heights,
+      squeezerSizeFixed != ctx->sizeRule && ctx->square, ctx->itemCount,
+      ctx->inputs, ctx->allowRotations, seconds, &width, &height,
+      ctx->bestResults, 0);
+  free(widths);
+  free(heights);
+  if (2 == result) {
+    if (ctx->verbose) {
+      printf("exact search ran out of time, using heuristics\n");
+    }
+    if (seconds < ctx->exactSeconds) {
+      ctx->timedOut = 1;
+    }
+    return 1;
+  }
+  if (1 == result && ctx->multiPage && squeezerSizeFixed == ctx->sizeRule) {
+    return 1;
+  }
+  if (1 == result) {
+    fprintf(stderr, "%s: no layout up to %dx%d fits all images\n",
+      __FUNCTION__, squeezerSizeFixed != ctx->sizeRule ? ctx->maxSize :
+      ctx->binWidth, squeezerSizeFixed != ctx->sizeRule ? ctx->maxSize :
+      ctx->binHeight);
+    return -1;
+  }
+  if (0 != result) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "exactMinimumBin failed");
+    return -1;
+  }
+  if (squeezerSizeFixed != ctx->sizeRule) {
+    ctx->binWidth = width;
+    ctx->binHeight = height;
+  }
+  ctx->bestOccupancy = (float)((double)getTotalArea(ctx) /
+    ((double)ctx->binWidth * ctx->binHeight));
+  if (ctx->verbose) {
+    printf("exact layout needs %dx%d, occupancy %.02f\n", width, height,
+      ctx->bestOccupancy);
+  }
+  return 0;
+}
+
+// Fills one page after another with the images the earlier pages left
+// over. Every heuristic fills each page and the one that packs the most
+// area wins, so the pages end up as full, and as few, as greedy gets.
+static int packPages(squeezer *ctx) {
+  int heuristicCount = getHeuristicCount(ctx);
+  unsigned long long binArea = (unsigned long long)ctx->binWidth *
+    ctx->binHeight;
+  unsigned long long totalArea = 0;
+  maxRectsSize *inputs = 0;
+  int *remaining = 0;
+  char *placed = 0;
+  int remainingCount = ctx->itemCount;
+  int result = 0;
+  int index;
+  inputs = (maxRectsSize *)malloc(sizeof(maxRectsSize) * ctx->itemCount);
+  remaining = (int *)malloc(sizeof(int) * ctx->itemCount);
+  placed = (char *)malloc(heuristicCount * ctx->itemCount);
+  ctx->pages = (int *)calloc(ctx->itemCount, sizeof(int));
+  if (!inputs || !remaining || !placed || !ctx->pages ||
+      0 != createPackJobs(ctx, heuristicCount)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "alloc failed");
+    free(inputs);
+    free(remaining);
+    free(placed);
+    return -1;
+  }
+  for (index = 0; index < ctx->itemCount; ++index) {
+    remaining[index] = index;
+    totalArea += (unsigned long long)ctx->inputs[index].width *
+      ctx->inputs[index].height;
+  }
+  if (ctx->verbose) {
+    printf("spilling into pages, at least %d needed\n",
+      (int)((totalArea + binArea - 1) / binArea));
+  }
+  ctx->pageCount = 0;
+  while (remainingCount > 0) {
+    packJob *best = 0;
+    unsigned long long bestArea = 0;
+    int kept = 0;
+    for (index = 0; index < remainingCount; ++index) {
+      inputs[index] = ctx->inputs[remaining[index]];
+    }
+    for (index = 0; index < heuristicCount; ++index) {
+      packJob *job = &ctx->packJobs[index];
+      job->inputs = inputs;
+      job->inputCount = remainingCount;
+      job->placed = placed + index * ctx->itemCount;
+      // Every page has to be laid out, whatever the time.
+      job->deadline = 0;
+    }
+    if (0 != runPackJobs(ctx)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "runPackJobs failed");
+      result = -1;
+      break;
+    }
+    for (index = 0; index < heuristicCount; ++index) {
+      packJob *job = &ctx->packJobs[index];
+      unsigned long long area = 0;
+      int i;
+      if (job->failed) {
+        continue;
+      }
+      for (i = 0; i < remainingCount; ++i) {
+        if (job->placed[i]) {
+          area += (unsigned long long)inputs[i].width * inputs[i].height;
+        }
+      }
+      if (area > bestArea) {
+        bestArea = area;
+        best = job;
+      }
+    }
+    if (!best) {
+      fprintf(stderr, "%s: none of the %d images left fits on a page\n",
+        __FUNCTION__, remainingCount);
+      result = -1;
+      break;
+    }
+    for (index = 0; index < remainingCount; ++index) {
+      int item = remaining[index];
+      if (best->placed[index]) {
+        ctx->bestResults[item] = best->results[index];
+        ctx->pages[item] = ctx->pageCount;
+      } else {
+        remaining[kept++] = item;
+      }
+    }
+    if (ctx->verbose) {
+      printf("page %d: %d images, occupancy %.02f\n", ctx->pageCount,
+        remainingCount - kept, (double)bestArea / binArea);
+    }
+    remainingCount = kept;
+    ++ctx->pageCount;
+  }
+  if (0 == result) {
+    ctx->bestOccupancy = (float)((double)totalArea /
+      ((double)binArea * ctx->pageCount));
+  }
+  free(inputs);
+  free(remaining);
+  free(placed);
+  return result;
+}
+
+// Counts the sweep that just ran in the model: every heuristic that made
+// the texture area of the best layout won.
+static void recordWinners(squeezer *ctx, unsigned long long area) {
+  char winners[SQUEEZER_MAX_JOBS];
+  int index;
+  for (index = 0; index < ctx->packJobCount; ++index) {
+    packJob *job = &ctx->packJobs[index];
+    winners[index] = !job->failed && !job->pruned && job->area == area;
+  }
+  predictorRecord(ctx->model, ctx->profile, winners);
+  ++ctx->calibrationCount;
+}
+
+static int packWithHeuristics(squeezer *ctx) {
+  packJob *best = 0;
+  maxRectsPosition *shelfResults = 0;
+  unsigned long long shelfArea = 0;
+  float shelfOccupancy = 0;
+  int prunedCount = 0;
+  int index;
+
+  if (ctx->verbose) {
+    printf("calculating occupancy using %d methods\n", ctx->packJobCount);
+  }
+
+  // Under a time budget only layouts no bigger than the baseline count.
+  ctx->areaLimit = (unsigned int)ctx->baselineArea;
+  for (index = 0; index < ctx->packJobCount; ++index) {
+    ctx->packJobs[index].areaLimit = &ctx->areaLimit;
+  }
+
+  // Sets of a few sizes may also go on shelves, which take O(n) and then
+  // stand as one more layout. A calibration only scores the heuristics.
+  if (!ctx->calibrating) {
+    shelfResults = (maxRectsPosition *)calloc(ctx->itemCount,
+      sizeof(maxRectsPosition));
+    if (!shelfResults) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+      return -1;
+    }
+    if (0 == maxRectsUniform(ctx->binWidth, ctx->binHeight, ctx->itemCount,
+        ctx->inputs, ctx->allowRotations, shelfResults, &shelfOccupancy)) {
+      shelfArea = getLayoutArea(ctx, shelfResults, ctx->binWidth,
+        ctx->binHeight);
+      lowerAreaLimit(ctx, shelfArea);
+    }
+  }
+
+  if (0 != runPackJobs(ctx)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "runPackJobs failed");
+    free(shelfResults);
+    return -1;
+  }
+
+  // Every layout that fits has the same occupancy of the bin, so they are
+  // told apart by the texture area they need. Ties go to the first in
+  // method order, so the result does not depend on which worker finished
+  // first; a pruned job lost to a smaller area, never to a tie.
+  for (index = 0; index < ctx->packJobCount; ++index) {
+    packJob *job = &ctx->packJobs[index];
+    char name[64];
+    if (squeezerSkyline == job->algorithm) {
+      snprintf(name, sizeof(name), "skyline #%d", job->skylineMethod);
+    } else if (squeezerGuillotine == job->algorithm) {
+      snprintf(name, sizeof(name), "guillotine #%d/%d",
+        job->guillotineChoice, job->guillotineSplit);
+    } else {
+      snprintf(name, sizeof(name), "maxRects #%d", job->method);
+    }
+    if (job->timedOut) {
+      if (ctx->verbose) {
+        printf("%s ran out of time\n", name);
+      }
+      continue;
+    }
+    if (job->pruned) {
+      ++prunedCount;
+      if (ctx->verbose) {
+        printf("%s pruned after %.02fms\n", name, job->seconds * 1000);
+      }
+      continue;
+    }
+    if (job->failed) {
+      fprintf(stderr, "%s: %s method failed\n", __FUNCTION__, name);
+      continue;
+    }
+    if (ctx->verbose) {
+      printf("occupancy %s %.02f, texture area %llu\n", name, job->occupancy,
+        job->area);
+    }
+    if (!best || job->area < best->area) {
+      best = job;
+    }
+  }
+  if (ctx->verbose && prunedCount > 0) {
+    printf("%d of %d methods pruned\n", prunedCount, ctx->packJobCount);
+  }
+  // The shelves come after every method, so a tie goes to the heuristics.
+  if (shelfArea > 0 && ctx->verbose) {
+    printf("occupancy shelves %.02f, texture area %llu\n", shelfOccupancy,
+      shelfArea);
+  }
+  if (shelfArea > 0 && (!best || shelfArea < best->area) &&
+      (0 == ctx->baselineArea || shelfArea <= ctx->baselineArea)) {
+    ctx->bestOccupancy = shelfOccupancy;
+    memcpy(ctx->bestResults, shelfResults,
+      sizeof(maxRectsPosition) * ctx->itemCount);
+    free(shelfResults);
+    return 0;
+  }
+  free(shelfResults);
+  if (best && ctx->baselineArea > 0 && best->area > ctx->baselineArea) {
+    best = 0;
+  }
+  if (best && ctx->calibrating) {
+    recordWinners(ctx, best->area);
+  }
+  if (best) {
+    ctx->bestOccupancy = best->occupancy;
+    memcpy(ctx->bestResults, best->results,
+      sizeof(maxRectsPosition) * ctx->itemCount);
+  }
+  return 0;
+}
+
+// Fails fast when no heuristic can fit the images into one bin. Returns -1
+// if an image is bigger than the bin, 1 if the images add up to more area
+// than the bin has, and only multiple pages can hold them.
+static int checkBinArea(squeezer *ctx) {
+  unsigned long long binArea = (unsigned long long)ctx->binWidth *
+    ctx->binHeight;
+  unsigned long long area = 0;
+  int index;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    maxRectsSize *ipt = &ctx->inputs[index];
+    int fits = ipt->width <= ctx->binWidth && ipt->height <= ctx->binHeight;
+    if (!fits && ctx->allowRotations) {
+      fits = ipt->height <= ctx->binWidth && ipt->width <= ctx->binHeight;
+    }
+    if (!fits) {
+      fprintf(stderr, "%s: %s is %dx%d, it does not fit a %dx%d bin\n",
+        __FUNCTION__, ctx->filenameArray[index], ipt->width, ipt->height,
+        ctx->binWidth, ctx->binHeight);
+      return -1;
+    }
+    area += (unsigned long long)ipt->width * ipt->height;
+  }
+  if (area <= binArea) {
+    return 0;
+  }
+  if (!ctx->multiPage) {
+    fprintf(stderr, "%s: the images cover %llu pixels, the %dx%d bin has "
+      "%llu\n", __FUNCTION__, area, ctx->binWidth, ctx->binHeight, binArea);
+  } else if (ctx->verbose) {
+    printf("the images cover %llu pixels, more than one page\n", area);
+  }
+  return 1;
+}
+
+// Shrinks the bin to the box the final layout uses, and the bin images
+// too when they are composited already.
+static int cropBins(squeezer *ctx) {
+  int usedWidth;
+  int usedHeight;
+  int pageCount = MAX(1, ctx->pageCount);
+  int index;
+  if (squeezerCropNone == ctx->crop || 0 == ctx->itemCount) {
+    return 0;
+  }
+  getUsedSize(ctx, ctx->bestResults, &usedWidth, &usedHeight);
+  usedWidth = getCropSize(ctx, usedWidth, ctx->binWidth);
+  usedHeight = getCropSize(ctx, usedHeight, ctx->binHeight);
+  if (ctx->verbose) {
+    printf("cropping %dx%d to %dx%d\n", ctx->binWidth, ctx->binHeight,
+      usedWidth, usedHeight);
+  }
+  for (index = 0; ctx->binImages && index < ctx->pageCount; ++index) {
+    if (0 != imageOpsCrop(ctx->binImages[index], usedWidth, usedHeight)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "imageOpsCrop failed");
+      return -1;
+    }
+  }
+  ctx->binWidth = usedWidth;
+  ctx->binHeight = usedHeight;
+  ctx->bestOccupancy = (float)((double)getTotalArea(ctx) /
+    ((double)usedWidth * usedHeight * pageCount));
+  return 0;
+}
+
+// One simulated annealing chain over the order the rects are inserted in
+// and the MaxRects heuristic used. Every chain has its own random stream,
+// so a seed and a chain count always walk the same path.
+typedef struct annealChain {
+  squeezer *ctx;
+  int index;
+  unsigned int random;
+  int *order;
+  int *candidate;
+  int *bestOrder;
+  int *remaining;
+  char *placed;
+  maxRectsPosition *results;
+  int method;
+  int bestMethod;
+  unsigned long long cost;
+  unsigned long long bestCost;
+  int iterations;
+  int timedOut;
+} annealChain;
+
+static unsigned int nextRandom(annealChain *chain) {
+  chain->random = chain->random * 1103515245 + 12345;
+  return (chain->random >> 16) & 0x7fff;
+}
+
+static int randomBelow(annealChain *chain, int count) {
+  return (int)(((nextRandom(chain) << 15) | nextRandom(chain)) %
+    (unsigned int)count);
+}
+
+// Cost of a layout, lower is better: the pages it needs, then the texture
+// area of its last page, so a layout that empties a page always wins.
+static unsigned long long getLayoutCost(squeezer *ctx, int pageCount,
+    int lastPageWidth, int lastPageHeight) {
+  return (unsigned long long)(pageCount - 1) * ctx->binWidth *
+    ctx->binHeight + (unsigned long long)getCropSize(ctx, lastPageWidth,
+      ctx->binWidth) * getCropSize(ctx, lastPageHeight, ctx->binHeight);
+}
+
+// Inserts the rects in order, first fit over as many pages as it takes.
+// pages may be 0; otherwise it gets the page of every rect.
+static unsigned long long evaluateOrder(squeezer *ctx, annealChain *chain,
+    const int *order, int method, int *pages, int *pageCount) {
+  int remainingCount = ctx->itemCount;
+  int count = 0;
+  int usedWidth = 0;
+  int usedHeight = 0;
+  int index;
+  memcpy(chain->remaining, order, sizeof(int) * ctx->itemCount);
+  while (remainingCount > 0) {
+    int kept = 0;
+    if (0 != maxRectsOrdered(ctx->binWidth, ctx->binHeight, ctx->itemCount,
+        ctx->inputs, chain->remaining, remainingCount,
+        maxRectsMethods[method], ctx->allowRotations, chain->results,
+        chain->placed, 0)) {
+      return ULLONG_MAX;
+    }
+    usedWidth = 0;
+    usedHeight = 0;
+    for (index = 0; index < remainingCount; ++index) {
+      int item = chain->remaining[index];
+      maxRectsPosition *pos = &chain->results[item];
+      maxRectsSize *ipt = &ctx->inputs[item];
+      if (!chain->placed[item]) {
+        chain->remaining[kept++] = item;
+        continue;
+      }
+      usedWidth = MAX(usedWidth, pos->left +
+        (pos->rotated ? ipt->height : ipt->width));
+      usedHeight = MAX(usedHeight, pos->top +
+        (pos->rotated ? ipt->width : ipt->height));
+      if (pages) {
+        pages[item] = count;
+      }
+    }
+    if (kept == remainingCount) {
+      return ULLONG_MAX;
+    }
+    remainingCount = kept;
+    ++count;
+  }
+  if (pageCount) {
+    *pageCount = count;
+  }
+  return getLayoutCost(ctx, count, usedWidth, usedHeight);
+}
+
+// Swaps two rects, moves one rect elsewhere in the order, or switches the
+// heuristic.
+static void perturbOrder(squeezer *ctx, annealChain *chain, int *method) {
+  int count = ctx->itemCount;
+  int move = nextRandom(chain) % 100;
+  int from = randomBelow(chain, count);
+  int to = randomBelow(chain, count);
+  int item = chain->candidate[from];
+  if (move < 10 || count < 2) {
+    *method = (*method + 1 + randomBelow(chain, MAX_RECTS_METHOD_COUNT - 1)) %
+      MAX_RECTS_METHOD_COUNT;
+  } else if (move < 55) {
+    chain->candidate[from] = chain->candidate[to];
+    chain->candidate[to] = item;
+  } else if (from < to) {
+    memmove(chain->candidate + from, chain->candidate + from + 1,
+      sizeof(int) * (to - from));
+    chain->candidate[to] = item;
+  } else {
+    memmove(chain->candidate + to + 1, chain->candidate + to,
+      sizeof(int) * (from - to));
+    chain->candidate[to] = item;
+  }
+}
+
+static int compareByArea(squeezer *ctx, int first, int second) {
+  maxRectsSize *a = &ctx->inputs[first];
+  maxRectsSize *b = &ctx->inputs[second];
+  unsigned long long areaA = (unsigned long long)a->width * a->height;
+  unsigned long long areaB = (unsigned long long)b->width * b->height;
+  if (areaA != areaB) {
+    return areaA > areaB ? -1 : 1;
+  }
+  return first - second;
+}
+
+static int compareByLongSide(squeezer *ctx, int first, int second) {
+  maxRectsSize *a = &ctx->inputs[first];
+  maxRectsSize *b = &ctx->inputs[second];
+  int longA = MAX(a->width, a->height);
+  int longB = MAX(b->width, b->height);
+  if (longA != longB) {
+    return longA > longB ? -1 : 1;
+  }
+  return compareByArea(ctx, first, second);
+}
+
+// Starting points: odd chains start from the biggest area first, even ones
+// from the longest side first, each with its own heuristic.
+static void initChainOrder(squeezer *ctx, annealChain *chain) {
+  int index;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    int item = index;
+    int at = index;
+    // Insertion sort keeps equal keys in input order without relying on
+    // the qsort implementation; it runs once per chain.
+    while (at > 0 && (chain->index & 1 ?
+        compareByArea(ctx, item, chain->order[at - 1]) :
+        compareByLongSide(ctx, item, chain->order[at - 1])) < 0) {
+      chain->order[at] = chain->order[at - 1];
+      --at;
+    }
+    chain->order[at] = item;
+  }
+  chain->method = chain->index % MAX_RECTS_METHOD_COUNT;
+}
+
+static void annealWorker(void *param) {
+  annealChain *chain = (annealChain *)param;
+  squeezer *ctx = chain->ctx;
+  double start = sysOpsGetTime();
+  double temperature = 0;
+  initChainOrder(ctx, chain);
+  chain->cost = evaluateOrder(ctx, chain, chain->order, chain->method, 0, 0);
+  chain->bestCost = chain->cost;
+  chain->bestMethod = chain->method;
+  memcpy(chain->bestOrder, chain->order, sizeof(int) * ctx->itemCount);
+  for (chain->iterations = 0; ; ++chain->iterations) {
+    double elapsed = sysOpsGetTime() - start;
+    double progress;
+    unsigned long long cost;
+    int method = chain->method;
+    if ((ctx->optimizeIterations > 0 &&
+          chain->iterations >= ctx->optimizeIterations) ||
+        (ctx->optimizeSeconds > 0 && elapsed >= ctx->optimizeSeconds)) {
+      break;
+    }
+    if (ctx->deadline > 0 && start + elapsed >= ctx->deadline) {
+      chain->timedOut = 1;
+      break;
+    }
+    // Iteration counts keep the schedule the same on every machine.
+    progress = ctx->optimizeIterations > 0 ?
+      (double)chain->iterations / ctx->optimizeIterations :
+      elapsed / ctx->optimizeSeconds;
+    // Starts out accepting a loss of a few percent of a page.
+    temperature = (1 - progress) * 0.02 * ctx->binWidth * ctx->binHeight;
+    memcpy(chain->candidate, chain->order, sizeof(int) * ctx->itemCount);
+    perturbOrder(ctx, chain, &method);
+    cost = evaluateOrder(ctx, chain, chain->candidate, method, 0, 0);
+    if (cost <= chain->cost || (cost != ULLONG_MAX && temperature > 0 &&
+        nextRandom(chain) / 32768.0 <
+          exp(-(double)(cost - chain->cost) / temperature))) {
+      int *order = chain->order;
+      chain->order = chain->candidate;
+      chain->candidate = order;
+      chain->method = method;
+      chain->cost = cost;
+      if (cost < chain->bestCost) {
+        chain->bestCost = cost;
+        chain->bestMethod = method;
+        memcpy(chain->bestOrder, chain->order, sizeof(int) * ctx->itemCount);
+      }
+    }
+  }
+}
+
+static void releaseChains(annealChain *chains, int chainCount) {
+  int index;
+  for (index = 0; index < chainCount; ++index) {
+    annealChain *chain = &chains[index];
+    free(chain->order);
+    free(chain->candidate);
+    free(chain->bestOrder);
+    free(chain->remaining);
+    free(chain->placed);
+    free(chain->results);
+  }
+  free(chains);
+}
+
+// Cost of the layout in bestResults, ~0 if there is none yet.
+static unsigned long long getBestLayoutCost(squeezer *ctx) {
+  int lastPage = MAX(1, ctx->pageCount) - 1;
+  int usedWidth = 0;
+  int usedHeight = 0;
+  int index;
+  if (ctx->bestOccupancy <= 0) {
+    return ULLONG_MAX;
+  }
+  for (index = 0; index < ctx->itemCount; ++index) {
+    maxRectsPosition *pos = &ctx->bestResults[index];
+    maxRectsSize *ipt = &ctx->inputs[index];
+    if (getPage(ctx, index) != lastPage) {
+      continue;
+    }
+    usedWidth = MAX(usedWidth, pos->left +
+      (pos->rotated ? ipt->height : ipt->width));
+    usedHeight = MAX(usedHeight, pos->top +
+      (pos->rotated ? ipt->width : ipt->height));
+  }
+  return getLayoutCost(ctx, lastPage + 1, usedWidth, usedHeight);
+}
+
+// Runs one annealing chain per worker for the time or iteration budget and
+// keeps the best layout they find if it beats the greedy one.
+static int optimizeLayout(squeezer *ctx) {
+  sysOpsThread *threads[SQUEEZER_MAX_JOBS];
+  int threadCount = 0;
+  int chainCount = ctx->jobs > 0 ? ctx->jobs : sysOpsGetCpuCount();
+  unsigned long long baseCost = getBestLayoutCost(ctx);
+  annealChain *chains;
+  annealChain *best;
+  int pageCount = 0;
+  int iterations = 0;
+  int index;
+  chainCount = MAX(1, MIN(SQUEEZER_MAX_JOBS, chainCount));
+  chains = (annealChain *)calloc(chainCount, sizeof(annealChain));
+  if (!chains) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return -1;
+  }
+  for (index = 0; index < chainCount; ++index) {
+    annealChain *chain = &chains[index];
+    chain->ctx = ctx;
+    chain->index = index;
+    chain->random = ctx->seed + index;
+    chain->order = (int *)malloc(sizeof(int) * ctx->itemCount);
+    chain->candidate = (int *)malloc(sizeof(int) * ctx->itemCount);
+    chain->bestOrder = (int *)malloc(sizeof(int) * ctx->itemCount);
+    chain->remaining = (int *)malloc(sizeof(int) * ctx->itemCount);
+    chain->placed = (char *)malloc(ctx->itemCount);
+    chain->results = (maxRectsPosition *)malloc(sizeof(maxRectsPosition) *
+      ctx->itemCount);
+    if (!chain->order || !chain->candidate || !chain->bestOrder ||
+        !chain->remaining || !chain->placed || !chain->results) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+      releaseChains(chains, chainCount);
+      return -1;
+    }
+  }
+  if (ctx->verbose) {
+    printf("optimizing with %d chains, seed %u\n", chainCount, ctx->seed);
+  }
+  // The calling thread runs the first chain.
+  for (index = 1; index < chainCount; ++index) {
+    sysOpsThread *thread = sysOpsThreadCreate(annealWorker, &chains[index]);
+    if (!thread) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsThreadCreate failed");
+      break;
+    }
+    threads[threadCount++] = thread;
+  }
+  annealWorker(&chains[0]);
+  for (index = 0; index < threadCount; ++index) {
+    sysOpsThreadJoin(threads[index]);
+  }
+  // Only the chains that got a thread ran; ties go to the first chain.
+  best = &chains[0];
+  for (index = 0; index <= threadCount; ++index) {
+    iterations += chains[index].iterations;
+    if (chains[index].timedOut) {
+      ctx->timedOut = 1;
+    }
+    if (chains[index].bestCost < best->bestCost) {
+      best = &chains[index];
+    }
+  }
+  if (ctx->verbose) {
+    printf("optimizer tried %d layouts, cost %llu, greedy %llu\n",
+      iterations, best->bestCost, baseCost);
+  }
+  if (best->bestCost < baseCost) {
+    evaluateOrder(ctx, best, best->bestOrder, best->bestMethod, ctx->pages,
+      &pageCount);
+    // Without pages only a layout that fits one bin counts.
+    if (pageCount > 1 && !ctx->pages) {
+      releaseChains(chains, chainCount);
+      return 0;
+    }
+    memcpy(ctx->bestResults, best->results,
+      sizeof(maxRectsPosition) * ctx->itemCount);
+    if (ctx->pages) {
+      ctx->pageCount = pageCount;
+    }
+    ctx->bestOccupancy = (float)(getTotalArea(ctx) / ((double)ctx->binWidth *
+      ctx->binHeight * pageCount));
+  }
+  releaseChains(chains, chainCount);
+  return 0;
+}
+
+// Claims the next directory entry and decodes it into its slot. Returns
+// -1 once the directory is exhausted or the stream was stopped.
+static int decodeNextSprite(squeezer *ctx) {
+  struct dirent *dp;
+  streamSlot *slot;
+  imageOpsImage *img;
+  sysOpsMutexLock(ctx->streamMutex);
+  while (!ctx->streamStop &&
+      ctx->nextDecode - ctx->nextPlace >= ctx->streamSlotCount) {
+    sysOpsConditionWait(ctx->streamCondition, ctx->streamMutex);
+  }
+  if (ctx->streamStop || ctx->decodeEnd >= 0) {
+    sysOpsMutexUnlock(ctx->streamMutex);
+    return -1;
+  }
+  while ((dp = readdir(ctx->streamDir)) && '.' == dp->d_name[0]) {
+  }
+  if (!dp) {
+    ctx->decodeEnd = ctx->nextDecode;
+    sysOpsConditionBroadcast(ctx->streamCondition);
+    sysOpsMutexUnlock(ctx->streamMutex);
+    return -1;
+  }
+  slot = &ctx->streamSlots[ctx->nextDecode++ % ctx->streamSlotCount];
+  snprintf(slot->shortName, sizeof(slot->shortName), "%s", dp->d_name);
+  snprintf(slot->filename, sizeof(slot->filename), "%s/%s",
+    ctx->streamDirName, dp->d_name);
+  sysOpsMutexUnlock(ctx->streamMutex);
+  img = createSpecificImage(slot->filename, &slot->trimOffsetLeft,
+    &slot->trimOffsetTop, &slot->originWidth, &slot->originHeight);
+  if (img && (0 == imageOpsGetWidth(img) || 0 == imageOpsGetHeight(img))) {
+    fprintf(stderr, "%s: %s is empty after trimming\n", __FUNCTION__,
+      slot->filename);
+    imageOpsDestroy(img);
+    img = 0;
+  }
+  sysOpsMutexLock(ctx->streamMutex);
+  slot->image = img;
+  slot->state = img ? 1 : -1;
+  sysOpsConditionBroadcast(ctx->streamCondition);
+  sysOpsMutexUnlock(ctx->streamMutex);
+  return 0;
+}
+
+static void decodeWorker(void *param) {
+  squeezer *ctx = (squeezer *)param;
+  while (0 == decodeNextSprite(ctx)) {
+  }
+}
+
+static int reserveStreamItems(squeezer *ctx, int count) {
+  int capacity;
+  maxRectsSize *inputs;
+  maxRectsPosition *bestResults;
+  trimInfo *trimInfos;
+  const char **shortNameArray;
+  if (count <= ctx->streamCapacity) {
+    return 0;
+  }
+  capacity = ctx->streamCapacity ? ctx->streamCapacity * 2 : 256;
+  inputs = (maxRectsSize *)realloc(ctx->inputs,
+    sizeof(maxRectsSize) * capacity);
+  if (inputs) {
+    ctx->inputs = inputs;
+  }
+  bestResults = (maxRectsPosition *)realloc(ctx->bestResults,
+    sizeof(maxRectsPosition) * capacity);
+  if (bestResults) {
+    ctx->bestResults = bestResults;
+  }
+  trimInfos = (trimInfo *)realloc(ctx->trimInfos,
+    sizeof(trimInfo) * capacity);
+  if (trimInfos) {
+    ctx->trimInfos = trimInfos;
+  }
+  shortNameArray = (const char **)realloc((void *)ctx->shortNameArray,
+    sizeof(const char *) * capacity);
+  if (shortNameArray) {
+    ctx->shortNameArray = shortNameArray;
+  }
+  if (!inputs || !bestResults || !trimInfos || !shortNameArray) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  ctx->streamCapacity = capacity;
+  return 0;
+}
+
+// Places and composites one decoded sprite, then frees its image.
+static int placeStreamSprite(squeezer *ctx, skylinePacker *packer,
+    streamSlot *slot) {
+  int index = ctx->itemCount;
+  maxRectsSize *ipt;
+  maxRectsPosition *pos;
+  char *shortName;
+  size_t nameLength = strlen(slot->shortName) + 1;
+  if (0 != reserveStreamItems(ctx, index + 1)) {
+    return -1;
+  }
+  shortName = (char *)malloc(nameLength);
+  if (!shortName) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+    return -1;
+  }
+  memcpy(shortName, slot->shortName, nameLength);
+  ctx->shortNameArray[index] = shortName;
+  ctx->itemCount++;
+  ipt = &ctx->inputs[index];
+  pos = &ctx->bestResults[index];
+  ipt->width = imageOpsGetWidth(slot->image);
+  ipt->height = imageOpsGetHeight(slot->image);
+  ctx->trimInfos[index].offsetLeft = slot->trimOffsetLeft;
+  ctx->trimInfos[index].offsetTop = slot->trimOffsetTop;
+  ctx->trimInfos[index].originWidth = slot->originWidth;
+  ctx->trimInfos[index].originHeight = slot->originHeight;
+  if (0 != skylinePackerAdd(packer, ipt->width, ipt->height, pos)) {
+    fprintf(stderr, "%s: no room left for %s\n", __FUNCTION__,
+      slot->filename);
+    return -1;
+  }
+  if (ctx->border) {
+    imageOpsAddBorder(slot->image);
+  }
+  if (pos->rotated) {
+    imageOpsRotate(slot->image, 90);
+  }
+  if (ctx->verbose) {
+    printf("coping image(%s) to bin left:%d top:%d width:%d height:%d\n",
+      slot->filename, pos->left, pos->top, ipt->width, ipt->height);
+  }
+  if (0 != imageOpsComposite(ctx->binImages[0], slot->image, pos->left,
+      pos->top)) {
+    fprintf(stderr, "%s: imageOpsComposite %s failed\n", __FUNCTION__,
+      slot->filename);
+    return -1;
+  }
+  return 0;
+}
+
+static void releaseStream(squeezer *ctx) {
+  int index;
+  if (ctx->streamSlots) {
+    for (index = 0; index < ctx->streamSlotCount; ++index) {
+      if (ctx->streamSlots[index].image) {
+        imageOpsDestroy(ctx->streamSlots[index].image);
+      }
+    }
+    free(ctx->streamSlots);
+    ctx->streamSlots = 0;
+  }
+  if (ctx->streamCondition) {
+    sysOpsConditionDestroy(ctx->streamCondition);
+    ctx->streamCondition = 0;
+  }
+  if (ctx->streamMutex) {
+    sysOpsMutexDestroy(ctx->streamMutex);
+    ctx->streamMutex = 0;
+  }
+  closedir(ctx->streamDir);
+  ctx->streamDir = 0;
+}
+
+// Packs the sprites online while they are decoded: decoder threads fill a
+// small ring of slots, and this thread places and composites each sprite
+// in directory order as soon as its slot is ready. Only the ring holds
+// decoded images, so memory stays bounded however big the directory is.
+static int streamDir(squeezer *ctx, const char *dir) {
+  sysOpsThread *threads[SQUEEZER_MAX_JOBS];
+  int threadCount = 0;
+  int workerCount = ctx->jobs;
+  skylinePacker *packer = 0;
+  int result = 0;
+  int sequence;
+  int index;
+  if (workerCount <= 0) {
+    workerCount = sysOpsGetCpuCount();
+  }
+  // The calling thread places the sprites; the others decode.
+  --workerCount;
+  if (workerCount > SQUEEZER_MAX_JOBS) {
+    workerCount = SQUEEZER_MAX_JOBS;
+  }
+  ctx->streamDirName = dir;
+  ctx->streamDir = opendir(dir);
+  if (!ctx->streamDir) {
+    fprintf(stderr, "%s: opendir %s failed\n", __FUNCTION__, dir);
+    return -1;
+  }
+  ctx->streamSlotCount = SQUEEZER_STREAM_SLOTS_PER_JOB *
+    (workerCount > 0 ? workerCount : 1);
+  ctx->streamSlots = (streamSlot *)calloc(ctx->streamSlotCount,
+    sizeof(streamSlot));
+  ctx->streamMutex = sysOpsMutexCreate();
+  ctx->streamCondition = sysOpsConditionCreate();
+  packer = skylinePackerBegin(ctx->binWidth, ctx->binHeight,
+    skylineBottomLeft, ctx->allowRotations, 1);
+  if (!ctx->streamSlots || !ctx->streamMutex || !ctx->streamCondition ||
+      !packer || 0 != createBinImages(ctx, 1)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "init stream failed");
+    if (packer) {
+      skylinePackerFinish(packer, 0);
+    }
+    releaseStream(ctx);
+    return -1;
+  }
+  ctx->nextDecode = 0;
+  ctx->nextPlace = 0;
+  ctx->decodeEnd = -1;
+  ctx->streamStop = 0;
+  for (index = 0; index < workerCount; ++index) {
+    sysOpsThread *thread = sysOpsThreadCreate(decodeWorker, ctx);
+    if (!thread) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsThreadCreate failed");
+      break;
+    }
+    threads[threadCount++] = thread;
+  }
+  for (sequence = 0; ; ++sequence) {
+    streamSlot *slot = &ctx->streamSlots[sequence % ctx->streamSlotCount];
+    if (0 == threadCount) {
+      decodeNextSprite(ctx);
+    }
+    sysOpsMutexLock(ctx->streamMutex);
+    while (0 == slot->state &&
+        (ctx->decodeEnd < 0 || sequence < ctx->decodeEnd)) {
+      sysOpsConditionWait(ctx->streamCondition, ctx->streamMutex);
+    }
+    sysOpsMutexUnlock(ctx->streamMutex);
+    if (0 == slot->state) {
+      break;
+    }
+    if (slot->state < 0) {
+      fprintf(stderr, "%s: decoding %s failed\n", __FUNCTION__,
+        slot->filename);
+      result = -1;
+      break;
+    }
+    if (0 != placeStreamSprite(ctx, packer, slot)) {
+      result = -1;
+      break;
+    }
+    sysOpsMutexLock(ctx->streamMutex);
+    imageOpsDestroy(slot->image);
+    slot->image = 0;
+    slot->state = 0;
+    ctx->nextPlace = sequence + 1;
+    sysOpsConditionBroadcast(ctx->streamCondition);
+    sysOpsMutexUnlock(ctx->streamMutex);
+  }
+  sysOpsMutexLock(ctx->streamMutex);
+  ctx->streamStop = 1;
+  sysOpsConditionBroadcast(ctx->streamCondition);
+  sysOpsMutexUnlock(ctx->streamMutex);
+  for (index = 0; index < threadCount; ++index) {
+    sysOpsThreadJoin(threads[index]);
+  }
+  if (ctx->verbose) {
+    printf("streamed %d images with %d decoder threads\n", ctx->itemCount,
+      threadCount);
+  }
+  skylinePackerFinish(packer, &ctx->bestOccupancy);
+  releaseStream(ctx);
+  if (0 == result && 0 != cropBins(ctx)) {
+    result = -1;
+  }
+  return result;
+}
+
+static int findPreviousSprite(squeezer *ctx, const char *name) {
+  int index;
+  for (index = 0; index < ctx->previousCount; ++index) {
+    if (0 == strcmp(ctx->previousSprites[index].name, name)) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+// Whether image index is the same size, and on the first page, as the
+// sprite of the previous layout with its name.
+static int isUnchanged(squeezer *ctx, int index, previousSprite *sprite) {
+  return sprite->width == ctx->inputs[index].width &&
+    sprite->height == ctx->inputs[index].height && 0 == sprite->page &&
+    (ctx->allowRotations || !sprite->rotated);
+}
+
+// Leaves every image that kept its name and size where the previous
+// layout had it, and fits the new and resized ones around them, longest
+// side first. Returns 1 when they do not fit, for a full repack. Auto
+// size keeps the size of the previous texture.
+static int packStable(squeezer *ctx) {
+  int binWidth = squeezerSizeFixed == ctx->sizeRule ? ctx->binWidth :
+    ctx->previousWidth;
+  int binHeight = squeezerSizeFixed == ctx->sizeRule ? ctx->binHeight :
+    ctx->previousHeight;
+  maxRectsSession *session;
+  int *newItems;
+  int newCount = 0;
+  int kept = 0;
+  int result = 0;
+  int index;
+  session = maxRectsSessionCreate(binWidth, binHeight, rectBestShortSideFit,
+    ctx->allowRotations);
+  newItems = (int *)malloc(sizeof(int) * MAX(1, ctx->itemCount));
+  if (!session || !newItems) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "create session failed");
+    if (session) {
+      maxRectsSessionDestroy(session);
+    }
+    free(newItems);
+    return -1;
+  }
+  for (index = 0; index < ctx->itemCount && result >= 0; ++index) {
+    int previous = findPreviousSprite(ctx, ctx->shortNameArray[index]);
+    int place = 1;
+    int id;
+    if (previous >= 0 &&
+        isUnchanged(ctx, index, &ctx->previousSprites[previous])) {
+      previousSprite *sprite = &ctx->previousSprites[previous];
+      maxRectsPosition *pos = &ctx->bestResults[index];
+      pos->left = sprite->left;
+      pos->top = sprite->top;
+      pos->rotated = sprite->rotated;
+      place = maxRectsSessionPlace(session, sprite->width, sprite->height,
+        pos, &id);
+    }
+    if (place < 0) {
+      result = -1;
+    } else if (0 == place) {
+      ++kept;
+    } else {
+      int at = newCount++;
+      while (at > 0 && compareByLongSide(ctx, index, newItems[at - 1]) < 0) {
+        newItems[at] = newItems[at - 1];
+        --at;
+      }
+      newItems[at] = index;
+    }
+  }
+  for (index = 0; index < newCount && 0 == result; ++index) {
+    maxRectsSize *ipt = &ctx->inputs[newItems[index]];
+    int id;
+    result = maxRectsSessionInsert(session, ipt->width, ipt->height, &id,
+      &ctx->bestResults[newItems[index]]);
+  }
+  maxRectsSessionDestroy(session);
+  free(newItems);
+  if (1 == result && ctx->verbose) {
+    printf("%d new or resized images do not fit around the %d kept, "
+      "repacking\n", newCount, kept);
+  }
+  if (0 != result) {
+    return result;
+  }
+  ctx->binWidth = binWidth;
+  ctx->binHeight = binHeight;
+  ctx->bestOccupancy = (float)((double)getTotalArea(ctx) /
+    ((double)binWidth * binHeight));
+  if (ctx->verbose) {
+    printf("kept %d images in place, placed %d around them\n", kept,
+      newCount);
+  }
+  return 0;
+}
+
+// Lays the images out once with the fast skyline heuristic before a time
+// budgeted search, so a complete layout is there whenever the deadline
+// comes, and the search only keeps layouts that beat it. When even that
+// does not fit, the search runs as it would without a budget.
+static void packBaseline(squeezer *ctx) {
+  int binWidth = ctx->binWidth;
+  int binHeight = ctx->binHeight;
+  float occupancy = 0;
+  int usedWidth;
+  int usedHeight;
+  int result;
+  // Auto size starts out near square, as a skyline fills the whole width
+  // it is given, and only goes up to the largest bin when that fails.
+  if (squeezerSizeFixed != ctx->sizeRule) {
+    unsigned long long area = 0;
+    int minWidth = 1;
+    int index;
+    for (index = 0; index < ctx->itemCount; ++index) {
+      maxRectsSize *ipt = &ctx->inputs[index];
+      area += (unsigned long long)ipt->width * ipt->height;
+      minWidth = MAX(minWidth, ctx->allowRotations ?
+        MIN(ipt->width, ipt->height) : ipt->width);
+    }
+    binHeight = roundDownSize(ctx, ctx->maxSize);
+    binWidth = MIN(binHeight, roundUpSize(ctx, MAX(minWidth,
+      (int)ceil(sqrt((double)area)))));
+  }
+  result = skylineFill(binWidth, binHeight, ctx->itemCount, ctx->inputs,
+    skylineBottomLeft, ctx->allowRotations, 1, ctx->bestResults, 0, 0,
+    &occupancy);
+  if (0 != result && binWidth < binHeight) {
+    binWidth = binHeight;
+    result = skylineFill(binWidth, binHeight, ctx->itemCount, ctx->inputs,
+      skylineBottomLeft, ctx->allowRotations, 1, ctx->bestResults, 0, 0,
+      &occupancy);
+  }
+  if (0 != result) {
+    return;
+  }
+  if (squeezerSizeFixed == ctx->sizeRule) {
+    unsigned long long area = getLayoutArea(ctx, ctx->bestResults,
+      binWidth, binHeight);
+    ctx->bestOccupancy = occupancy;
+    ctx->baselineArea = area <= UINT_MAX ? area : 0;
+    if (ctx->verbose) {
+      printf("baseline layout, texture area %llu\n", area);
+    }
+    return;
+  }
+  getUsedSize(ctx, ctx->bestResults, &usedWidth, &usedHeight);
+  ctx->baselineWidth = roundUpSize(ctx, usedWidth);
+  ctx->baselineHeight = roundUpSize(ctx, usedHeight);
+  if (ctx->square) {
+    ctx->baselineWidth = MAX(ctx->baselineWidth, ctx->baselineHeight);
+    ctx->baselineHeight = ctx->baselineWidth;
+  }
+  if (ctx->verbose) {
+    printf("baseline layout, %dx%d\n", ctx->baselineWidth,
+      ctx->baselineHeight);
+  }
+}
+
+// Compares the final layout with the previous one: images at the same
+// spot, size and page are kept, and every other sprite of either layout
+// counts as changed pixels.
+static void countChangedPixels(squeezer *ctx) {
+  char *matched = (char *)calloc(MAX(1, ctx->previousCount), 1);
+  int index;
+  ctx->keptCount = 0;
+  ctx->changedPixels = 0;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    maxRectsSize *ipt = &ctx->inputs[index];
+    maxRectsPosition *pos = &ctx->bestResults[index];
+    int previous = findPreviousSprite(ctx, ctx->shortNameArray[index]);
+    previousSprite *sprite = previous >= 0 ?
+      &ctx->previousSprites[previous] : 0;
+    if (sprite && sprite->left == pos->left && sprite->top == pos->top &&
+        sprite->width == ipt->width && sprite->height == ipt->height &&
+        !sprite->rotated == !pos->rotated &&
+        sprite->page == getPage(ctx, index)) {
+      ++ctx->keptCount;
+      if (matched) {
+        matched[previous] = 1;
+      }
+      continue;
+    }
+    ctx->changedPixels += (unsigned long long)ipt->width * ipt->height;
+  }
+  for (index = 0; matched && index < ctx->previousCount; ++index) {
+    if (!matched[index]) {
+      ctx->changedPixels += (unsigned long long)
+        ctx->previousSprites[index].width * ctx->previousSprites[index].height;
+    }
+  }
+  free(matched);
+}
+
+int squeezerDoDir(squeezer *ctx, const char *dir) {
+  int binCheck = 0;
+  int stableResult = 1;
+  int exactResult = 1;
+  int index;
+  fileItem *loopItem;
+
+  releaseSqueezer(ctx);
+  if (ctx->budgetSeconds > 0 && !ctx->calibrating) {
+    ctx->deadline = sysOpsGetTime() + ctx->budgetSeconds;
+  }
+
+  if (ctx->verbose) {
+    printf("preparing to squeezer\n");
+  }
+
+  if (ctx->streaming) {
+    if (squeezerSizeFixed != ctx->sizeRule) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__,
+        "auto size needs every image size up front, ignored when streaming");
+    }
+    ctx->ownsShortNames = 1;
+    if (0 != streamDir(ctx, dir)) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (ctx->verbose) {
+    printf("fetching file list from dir(%s)\n", dir);
+  }
+
+  ctx->fileList = getFileListInDir(dir, &ctx->itemCount);
+  if (!ctx->fileList) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "getFileListInDir failed");
+    releaseSqueezer(ctx);
+    return -1;
+  }
+
+  if (ctx->verbose) {
+    printf("alloc memory for squeezer\n");
+  }
+
+  ctx->filenameArray = (const char **)calloc(ctx->itemCount,
+    sizeof(const char *));
+  if (!ctx->filenameArray) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    releaseSqueezer(ctx);
+    return -1;
+  }
+
+  ctx->shortNameArray = (const char **)calloc(ctx->itemCount,
+    sizeof(const char *));
+  if (!ctx->shortNameArray) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    releaseSqueezer(ctx);
+    return -1;
+  }
+
+  ctx->inputs = (maxRectsSize *)calloc(ctx->itemCount, sizeof(maxRectsSize));
+  if (!ctx->inputs) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    releaseSqueezer(ctx);
+    return -1;
+  }
+  for (index = 0, loopItem = ctx->fileList; loopItem;
+      loopItem = loopItem->next, ++index) {
+    maxRectsSize *ipt = &ctx->inputs[index];
+    ipt->width = loopItem->width;
+    ipt->height = loopItem->height;
+    ctx->filenameArray[index] = loopItem->filename;
+    ctx->shortNameArray[index] = loopItem->shortName;
+  }
+
+  // A calibration runs the whole sweep to count who wins it.
+  ctx->predictedCount = 0;
+  if (ctx->model) {
+    ctx->profile = predictorGetProfile(ctx->itemCount, ctx->inputs,
+      ctx->allowRotations, squeezerSizeFixed == ctx->sizeRule ?
+      ctx->binWidth : 0, squeezerSizeFixed == ctx->sizeRule ?
+      ctx->binHeight : 0);
+    if (!ctx->calibrating) {
+      ctx->predictedCount = predictorSelect(ctx->model, ctx->profile,
+        ctx->predicted);
+    }
+    if (ctx->verbose && ctx->predictedCount > 0) {
+      printf("model picked %d of %d heuristics for profile %d\n",
+        ctx->predictedCount, getSweepCount(ctx), ctx->profile);
+    }
+  }
+
+  if (0 != createPackJobs(ctx, getHeuristicCount(ctx))) {
     releaseSqueezer(ctx);
     return -1;
   }
@@ -322,26 +2611,96 @@ int squeezerDoDir(squeezer *ctx, const char *dir) {
     return -1;
   }
 
-  for (index = 0; index < sizeof(methods) / sizeof(methods[0]); ++index) {
-    float occupancy = 0;
-    enum maxRectsFreeRectChoiceHeuristic method = methods[index];
-    if (ctx->verbose) {
-      printf("calculating occupancy using method #%d\n", method);
+  if (squeezerSizeFixed == ctx->sizeRule) {
+    binCheck = checkBinArea(ctx);
+    if (binCheck < 0 || (binCheck > 0 && !ctx->multiPage)) {
+      releaseSqueezer(ctx);
+      return -1;
     }
-    if (0 != maxRects(ctx->binWidth, ctx->binHeight, ctx->itemCount,
-        ctx->inputs, method, ctx->allowRotations, ctx->results, &occupancy)) {
-      fprintf(stderr, "%s: maxRects method #%d failed\n", __FUNCTION__,
-        method);
-      continue;
+  }
+
+  if (ctx->previousSprites && 0 == binCheck && !ctx->calibrating) {
+    stableResult = packStable(ctx);
+    if (stableResult < 0) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+  }
+
+  if (1 == stableResult && 0 == binCheck && !ctx->calibrating) {
+    exactResult = packExact(ctx);
+    if (exactResult < 0) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+  }
+
+  if (ctx->deadline > 0 && 1 == stableResult && 1 == exactResult &&
+      0 == binCheck) {
+    packBaseline(ctx);
+  }
+
+  // The auto size search keeps its own best layout; otherwise a tile set
+  // of one size is laid out as a grid directly. Sets that cannot fit one
+  // bin go straight to the pages.
+  if (0 == stableResult) {
+    // The unchanged images kept their spots and the others fit around.
+  } else if (0 == exactResult) {
+    // The exact solver left the smallest layout there is.
+  } else if (squeezerSizeFixed != ctx->sizeRule) {
+    if (0 != searchBinSize(ctx)) {
+      releaseSqueezer(ctx);
+      return -1;
     }
+  } else if (0 == binCheck && hasSingleSize(ctx) &&
+      0 == maxRectsUniform(ctx->binWidth, ctx->binHeight, ctx->itemCount,
+        ctx->inputs, ctx->allowRotations, ctx->bestResults,
+        &ctx->bestOccupancy)) {
     if (ctx->verbose) {
-      printf("occupancy #%d %.02f\n",
-        method, occupancy);
+      printf("using uniform layout, occupancy %.02f\n", ctx->bestOccupancy);
     }
-    if (occupancy > ctx->bestOccupancy) {
-      ctx->bestOccupancy = occupancy;
-      memcpy(ctx->bestResults, ctx->results,
-        sizeof(maxRectsPosition) * ctx->itemCount);
+  } else if (0 == binCheck && 0 != packWithHeuristics(ctx)) {
+    releaseSqueezer(ctx);
+    return -1;
+  }
+
+  // The heuristics the model skipped may still fit a set the picked ones
+  // could not, before it spills into pages.
+  if (ctx->bestOccupancy <= 0 && ctx->predictedCount > 0 && 0 == binCheck &&
+      squeezerSizeFixed == ctx->sizeRule) {
+    ctx->predictedCount = 0;
+    if (0 != createPackJobs(ctx, getHeuristicCount(ctx)) ||
+        0 != packWithHeuristics(ctx)) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+  }
+
+  // The auto size sizes are scored by height, so a calibration sweeps the
+  // bin it picked once more. The layout is not needed beyond that.
+  if (ctx->calibrating) {
+    if (squeezerSizeFixed != ctx->sizeRule &&
+        (0 != createPackJobs(ctx, getHeuristicCount(ctx)) ||
+          0 != packWithHeuristics(ctx))) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (ctx->bestOccupancy <= 0 && ctx->multiPage &&
+      squeezerSizeFixed == ctx->sizeRule) {
+    if (0 != packPages(ctx)) {
+      releaseSqueezer(ctx);
+      return -1;
+    }
+  }
+
+  if ((ctx->optimizeSeconds > 0 || ctx->optimizeIterations > 0) &&
+      squeezerSizeFixed == ctx->sizeRule && 0 != stableResult) {
+    if (0 != optimizeLayout(ctx)) {
+      releaseSqueezer(ctx);
+      return -1;
     }
   }
 
@@ -351,11 +2710,19 @@ int squeezerDoDir(squeezer *ctx, const char *dir) {
     return -1;
   }
 
+  if (0 != cropBins(ctx)) {
+    releaseSqueezer(ctx);
+    return -1;
+  }
+
   if (ctx->verbose) {
     printf("creating bin image\n");
   }
 
-  ctx->binImage = imageOpsCreate(ctx->binWidth, ctx->binHeight);
+  if (0 != createBinImages(ctx, ctx->pageCount > 0 ? ctx->pageCount : 1)) {
+    releaseSqueezer(ctx);
+    return -1;
+  }
   for (index = 0; index < ctx->itemCount; ++index) {
     imageOpsImage *itemImage;
     maxRectsSize *ipt = &ctx->inputs[index];
@@ -389,8 +2756,8 @@ int squeezerDoDir(squeezer *ctx, const char *dir) {
       printf("coping image(%s) to bin left:%d top:%d width:%d height:%d\n",
         itemFilename, pos->left, pos->top, ipt->width, ipt->height);
     }
-    if (0 != imageOpsComposite(ctx->binImage, itemImage, pos->left,
-        pos->top)) {
+    if (0 != imageOpsComposite(ctx->binImages[getPage(ctx, index)],
+        itemImage, pos->left, pos->top)) {
       fprintf(stderr, "%s: imageOpsComposite %s failed\n", __FUNCTION__,
         itemFilename);
       imageOpsDestroy(itemImage);
@@ -400,23 +2767,432 @@ int squeezerDoDir(squeezer *ctx, const char *dir) {
     imageOpsDestroy(itemImage);
   }
 
+  if (ctx->previousSprites) {
+    countChangedPixels(ctx);
+  }
+
+  return ctx->timedOut ? 1 : 0;
+}
+
+// Calibrates on every directory below dir that has no subdirectories,
+// each one a set of images; sets that fail to pack are skipped.
+static int calibrateDir(squeezer *ctx, const char *dir) {
+  struct dirent *dp;
+  int subdirCount = 0;
+  DIR *dirp = opendir(dir);
+  if (!dirp) {
+    fprintf(stderr, "%s: open %s failed\n", __FUNCTION__, dir);
+    return -1;
+  }
+  while ((dp = readdir(dirp))) {
+    char path[780];
+    DIR *subdir;
+    if ('.' == dp->d_name[0]) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, dp->d_name);
+    subdir = opendir(path);
+    if (!subdir) {
+      continue;
+    }
+    closedir(subdir);
+    ++subdirCount;
+    if (0 != calibrateDir(ctx, path)) {
+      closedir(dirp);
+      return -1;
+    }
+  }
+  closedir(dirp);
+  if (0 == subdirCount && 0 != squeezerDoDir(ctx, dir)) {
+    fprintf(stderr, "%s: skipping %s\n", __FUNCTION__, dir);
+  }
+  return 0;
+}
+
+int squeezerCalibrate(squeezer *ctx, const char *dir,
+    const char *modelFilename) {
+  int result;
+  if (!ctx->model && 0 != createModel(ctx)) {
+    return -1;
+  }
+  ctx->calibrating = 1;
+  ctx->calibrationCount = 0;
+  result = calibrateDir(ctx, dir);
+  ctx->calibrating = 0;
+  releaseSqueezer(ctx);
+  if (0 != result) {
+    return -1;
+  }
+  if (ctx->verbose) {
+    printf("calibrated on %d image sets\n", ctx->calibrationCount);
+  }
+  return predictorSave(ctx->model, modelFilename);
+}
+
+// Edits keep the bin the layout was made for, cropped or not, and work
+// on the one page there is.
+static int startSession(squeezer *ctx) {
+  int index;
+  if (ctx->session) {
+    return 0;
+  }
+  if (!ctx->fileList || !ctx->binImages) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__,
+      "no layout of squeezerDoDir to edit");
+    return -1;
+  }
+  if (ctx->pageCount > 1) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__,
+      "a layout of more than one page cannot be edited");
+    return -1;
+  }
+  ctx->session = maxRectsSessionCreate(ctx->binWidth, ctx->binHeight,
+    rectBestShortSideFit, ctx->allowRotations);
+  ctx->sessionIds = (int *)malloc(sizeof(int) * MAX(1, ctx->itemCount));
+  if (!ctx->session || !ctx->sessionIds) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "create session failed");
+    stopSession(ctx);
+    return -1;
+  }
+  for (index = 0; index < ctx->itemCount; ++index) {
+    maxRectsSize *ipt = &ctx->inputs[index];
+    if (0 != maxRectsSessionPlace(ctx->session, ipt->width, ipt->height,
+        &ctx->bestResults[index], &ctx->sessionIds[index])) {
+      fprintf(stderr, "%s: %s overlaps another image\n", __FUNCTION__,
+        ctx->filenameArray[index]);
+      // A half built session would pass for a whole one on the next edit.
+      stopSession(ctx);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int reserveEditItems(squeezer *ctx, int count) {
+  maxRectsSize *inputs;
+  maxRectsPosition *bestResults;
+  trimInfo *trimInfos;
+  const char **filenameArray;
+  const char **shortNameArray;
+  int *sessionIds;
+  int *pages = 0;
+  inputs = (maxRectsSize *)realloc(ctx->inputs, sizeof(maxRectsSize) * count);
+  if (inputs) {
+    ctx->inputs = inputs;
+  }
+  bestResults = (maxRectsPosition *)realloc(ctx->bestResults,
+    sizeof(maxRectsPosition) * count);
+  if (bestResults) {
+    ctx->bestResults = bestResults;
+  }
+  trimInfos = (trimInfo *)realloc(ctx->trimInfos, sizeof(trimInfo) * count);
+  if (trimInfos) {
+    ctx->trimInfos = trimInfos;
+  }
+  filenameArray = (const char **)realloc((void *)ctx->filenameArray,
+    sizeof(const char *) * count);
+  if (filenameArray) {
+    ctx->filenameArray = filenameArray;
+  }
+  shortNameArray = (const char **)realloc((void *)ctx->shortNameArray,
+    sizeof(const char *) * count);
+  if (shortNameArray) {
+    ctx->shortNameArray = shortNameArray;
+  }
+  sessionIds = (int *)realloc(ctx->sessionIds, sizeof(int) * count);
+  if (sessionIds) {
+    ctx->sessionIds = sessionIds;
+  }
+  if (ctx->pages) {
+    pages = (int *)realloc(ctx->pages, sizeof(int) * count);
+    if (pages) {
+      ctx->pages = pages;
+    }
+  }
+  if (!inputs || !bestResults || !trimInfos || !filenameArray ||
+      !shortNameArray || !sessionIds || (ctx->pages && !pages)) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  return 0;
+}
+
+static const char *getShortName(const char *filename) {
+  const char *slash = strrchr(filename, '/');
+  const char *backslash = strrchr(filename, '\\');
+  if (backslash > slash) {
+    slash = backslash;
+  }
+  return slash ? slash + 1 : filename;
+}
+
+static int findImage(squeezer *ctx, const char *filename) {
+  const char *shortName = getShortName(filename);
+  int index;
+  for (index = 0; index < ctx->itemCount; ++index) {
+    if (0 == strcmp(ctx->shortNameArray[index], shortName)) {
+      return index;
+    }
+  }
+  fprintf(stderr, "%s: %s is not in the layout\n", __FUNCTION__, shortName);
+  return -1;
+}
+
+static void updateSessionOccupancy(squeezer *ctx) {
+  ctx->bestOccupancy = (float)((double)getTotalArea(ctx) /
+    ((double)ctx->binWidth * ctx->binHeight));
+}
+
+// Makes the box of an image transparent again.
+static int clearImage(squeezer *ctx, int index) {
+  maxRectsSize *ipt = &ctx->inputs[index];
+  maxRectsPosition *pos = &ctx->bestResults[index];
+  return imageOpsClear(ctx->binImages[0], pos->left, pos->top,
+    pos->rotated ? ipt->height : ipt->width,
+    pos->rotated ? ipt->width : ipt->height);
+}
+
+// Composites a decoded image into its box, then frees it.
+static int compositeImage(squeezer *ctx, int index, imageOpsImage *image) {
+  maxRectsPosition *pos = &ctx->bestResults[index];
+  int result;
+  if (ctx->border) {
+    imageOpsAddBorder(image);
+  }
+  if (pos->rotated) {
+    imageOpsRotate(image, 90);
+  }
+  if (ctx->verbose) {
+    printf("coping image(%s) to bin left:%d top:%d width:%d height:%d\n",
+      ctx->filenameArray[index], pos->left, pos->top,
+      ctx->inputs[index].width, ctx->inputs[index].height);
+  }
+  result = imageOpsComposite(ctx->binImages[0], image, pos->left, pos->top);
+  imageOpsDestroy(image);
+  if (0 != result) {
+    fprintf(stderr, "%s: imageOpsComposite %s failed\n", __FUNCTION__,
+      ctx->filenameArray[index]);
+    return -1;
+  }
+  return 0;
+}
+
+int squeezerAddImage(squeezer *ctx, const char *filename) {
+  int index = ctx->itemCount;
+  imageOpsImage *image;
+  fileItem *newItem;
+  trimInfo trim;
+  maxRectsPosition pos;
+  int id;
+  int result;
+  if (0 != startSession(ctx)) {
+    return -1;
+  }
+  for (id = 0; id < ctx->itemCount; ++id) {
+    if (0 == strcmp(ctx->shortNameArray[id], getShortName(filename))) {
+      fprintf(stderr, "%s: %s is in the layout already\n", __FUNCTION__,
+        filename);
+      return -1;
+    }
+  }
+  if (0 != reserveEditItems(ctx, index + 1)) {
+    return -1;
+  }
+  newItem = (fileItem *)calloc(1, sizeof(fileItem));
+  if (!newItem) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return -1;
+  }
+  image = createSpecificImage(filename, &trim.offsetLeft, &trim.offsetTop,
+    &trim.originWidth, &trim.originHeight);
+  if (!image) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "createSpecificImage failed");
+    free(newItem);
+    return -1;
+  }
+  newItem->width = imageOpsGetWidth(image);
+  newItem->height = imageOpsGetHeight(image);
+  result = maxRectsSessionInsert(ctx->session, newItem->width,
+    newItem->height, &id, &pos);
+  if (0 != result) {
+    if (1 == result && ctx->verbose) {
+      printf("no room left for %s\n", filename);
+    }
+    imageOpsDestroy(image);
+    free(newItem);
+    return result;
+  }
+  snprintf(newItem->filename, sizeof(newItem->filename), "%s", filename);
+  snprintf(newItem->shortName, sizeof(newItem->shortName), "%s",
+    getShortName(filename));
+  newItem->originWidth = trim.originWidth;
+  newItem->originHeight = trim.originHeight;
+  newItem->next = ctx->fileList;
+  ctx->fileList = newItem;
+  ctx->inputs[index].width = newItem->width;
+  ctx->inputs[index].height = newItem->height;
+  ctx->bestResults[index] = pos;
+  ctx->trimInfos[index] = trim;
+  ctx->filenameArray[index] = newItem->filename;
+  ctx->shortNameArray[index] = newItem->shortName;
+  ctx->sessionIds[index] = id;
+  if (ctx->pages) {
+    ctx->pages[index] = 0;
+  }
+  ctx->itemCount++;
+  updateSessionOccupancy(ctx);
+  return compositeImage(ctx, index, image);
+}
+
+int squeezerRemoveImage(squeezer *ctx, const char *filename) {
+  fileItem **link;
+  int index;
+  int tail;
+  if (0 != startSession(ctx)) {
+    return -1;
+  }
+  index = findImage(ctx, filename);
+  if (index < 0) {
+    return -1;
+  }
+  if (0 != clearImage(ctx, index) ||
+      0 != maxRectsSessionRemove(ctx->session, ctx->sessionIds[index])) {
+    return -1;
+  }
+  for (link = &ctx->fileList; *link; link = &(*link)->next) {
+    if ((*link)->filename == ctx->filenameArray[index]) {
+      fileItem *willDel = *link;
+      *link = willDel->next;
+      free(willDel);
+      break;
+    }
+  }
+  tail = ctx->itemCount - index - 1;
+  memmove(&ctx->inputs[index], &ctx->inputs[index + 1],
+    sizeof(maxRectsSize) * tail);
+  memmove(&ctx->bestResults[index], &ctx->bestResults[index + 1],
+    sizeof(maxRectsPosition) * tail);
+  memmove(&ctx->trimInfos[index], &ctx->trimInfos[index + 1],
+    sizeof(trimInfo) * tail);
+  memmove((void *)&ctx->filenameArray[index],
+    (void *)&ctx->filenameArray[index + 1], sizeof(const char *) * tail);
+  memmove((void *)&ctx->shortNameArray[index],
+    (void *)&ctx->shortNameArray[index + 1], sizeof(const char *) * tail);
+  memmove(&ctx->sessionIds[index], &ctx->sessionIds[index + 1],
+    sizeof(int) * tail);
+  if (ctx->pages) {
+    memmove(&ctx->pages[index], &ctx->pages[index + 1], sizeof(int) * tail);
+  }
+  ctx->itemCount--;
+  updateSessionOccupancy(ctx);
+  return 0;
+}
+
+int squeezerUpdateImage(squeezer *ctx, const char *filename) {
+  imageOpsImage *image;
+  trimInfo trim;
+  maxRectsPosition pos;
+  int index;
+  int width;
+  int height;
+  int result;
+  if (0 != startSession(ctx)) {
+    return -1;
+  }
+  index = findImage(ctx, filename);
+  if (index < 0) {
+    return -1;
+  }
+  image = createSpecificImage(ctx->filenameArray[index], &trim.offsetLeft,
+    &trim.offsetTop, &trim.originWidth, &trim.originHeight);
+  if (!image) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "createSpecificImage failed");
+    return -1;
+  }
+  width = imageOpsGetWidth(image);
+  height = imageOpsGetHeight(image);
+  result = maxRectsSessionResize(ctx->session, ctx->sessionIds[index], width,
+    height, &pos);
+  if (0 != result) {
+    if (1 == result && ctx->verbose) {
+      printf("no room left for %s at %dx%d\n", filename, width, height);
+    }
+    imageOpsDestroy(image);
+    return result;
+  }
+  if (0 != clearImage(ctx, index)) {
+    imageOpsDestroy(image);
+    return -1;
+  }
+  ctx->inputs[index].width = width;
+  ctx->inputs[index].height = height;
+  ctx->bestResults[index] = pos;
+  ctx->trimInfos[index] = trim;
+  updateSessionOccupancy(ctx);
+  return compositeImage(ctx, index, image);
+}
+
+int squeezerCompareTexture(squeezer *ctx, const char *filename,
+    unsigned long long *changedPixels) {
+  imageOpsImage *previous;
+  if (!ctx->binImages) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "no texture to compare");
+    return -1;
+  }
+  previous = imageOpsOpen(filename);
+  if (!previous) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "imageOpsOpen failed");
+    return -1;
+  }
+  *changedPixels = imageOpsCountChanged(ctx->binImages[0], previous);
+  imageOpsDestroy(previous);
   return 0;
 }
 
 void squeezerDestroy(squeezer *ctx) {
   imageOpsUninit();
   releaseSqueezer(ctx);
+  releasePreviousLayout(ctx);
+  if (ctx->model) {
+    predictorDestroy(ctx->model);
+  }
   free(ctx);
 }
 
-int squeezerOutputImage(squeezer *ctx, const char *filename) {
-  if (ctx->verbose) {
-    printf("outputing bin(%s)\n", filename);
+// Page filenames get the page index before the extension, so "atlas.png"
+// becomes "atlas_0.png", "atlas_1.png" and so on.
+static void makePageFilename(char *buffer, int size, const char *filename,
+    int page) {
+  const char *dot = strrchr(filename, '.');
+  const char *slash = strrchr(filename, '/');
+  const char *backslash = strrchr(filename, '\\');
+  if (backslash > slash) {
+    slash = backslash;
   }
-  if (0 != imageOpsSave(ctx->binImage, filename)) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "imageOpsSave failed");
-    releaseSqueezer(ctx);
-    return -1;
+  if (!dot || (slash && dot < slash)) {
+    dot = filename + strlen(filename);
+  }
+  snprintf(buffer, size, "%.*s_%d%s", (int)(dot - filename), filename, page,
+    dot);
+}
+
+int squeezerOutputImage(squeezer *ctx, const char *filename) {
+  int page;
+  for (page = 0; page < ctx->pageCount; ++page) {
+    char pageFilename[1024];
+    if (ctx->pageCount > 1) {
+      makePageFilename(pageFilename, sizeof(pageFilename), filename, page);
+    } else {
+      snprintf(pageFilename, sizeof(pageFilename), "%s", filename);
+    }
+    if (ctx->verbose) {
+      printf("outputing bin(%s)\n", pageFilename);
+    }
+    if (0 != imageOpsSave(ctx->binImages[page], pageFilename)) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "imageOpsSave failed");
+      releaseSqueezer(ctx);
+      return -1;
+    }
   }
   return 0;
 }
@@ -445,6 +3221,7 @@ typedef struct customOutput {
   int originWidth;
   int originHeight;
   int rotated;
+  int page;
   const char *shortName;
 } customOutput;
 
@@ -489,6 +3266,9 @@ static void parse(squeezer *ctx, customOutput *output, const char *fmt) {
         case 'f':
           fprintf(output->fp, "%d", output->rotated ? 1 : 0);
           break;
+        case 'p':
+          fprintf(output->fp, "%d", output->page);
+          break;
         case '%':
           fprintf(output->fp, "%c", '%');
           break;
@@ -577,6 +3357,7 @@ int squeezerOutputCustomFormat(squeezer *ctx, const char *filename,
     output.originWidth = trim->originWidth;
     output.originHeight = trim->originHeight;
     output.rotated = pos->rotated;
+    output.page = getPage(ctx, index);
     parse(ctx, &output, body);
   }
 
@@ -588,3 +3369,197 @@ int squeezerOutputCustomFormat(squeezer *ctx, const char *filename,
 
   return 0;
 }
+
+// Atlases of a squeezerDoBatch call, handed out to the workers biggest
+// first.
+typedef struct batchQueue {
+  const squeezer *settings;
+  squeezerBatchJob *jobs;
+  int *order;
+  int jobCount;
+  int nextJob;
+  int failedCount;
+  sysOpsMutex *mutex;
+} batchQueue;
+
+typedef struct batchWorker {
+  batchQueue *queue;
+  squeezer ctx;
+} batchWorker;
+
+typedef struct batchKey {
+  int fileCount;
+  int index;
+} batchKey;
+
+static int compareBatchKeys(const void *first, const void *second) {
+  const batchKey *firstKey = (const batchKey *)first;
+  const batchKey *secondKey = (const batchKey *)second;
+  if (firstKey->fileCount != secondKey->fileCount) {
+    return secondKey->fileCount - firstKey->fileCount;
+  }
+  return firstKey->index - secondKey->index;
+}
+
+// Entries of a directory, without decoding them, to guess how long its
+// atlas takes.
+static int countDirEntries(const char *dir) {
+  struct dirent *dp;
+  int count = 0;
+  DIR *dirp = opendir(dir);
+  if (!dirp) {
+    return 0;
+  }
+  while ((dp = readdir(dirp))) {
+    if ('.' != dp->d_name[0]) {
+      ++count;
+    }
+  }
+  closedir(dirp);
+  return count;
+}
+
+// Gives a worker the options of the batch again; the last atlas may have
+// cropped or auto sized its bin. The atlases themselves are the parallel
+// work, so each runs its heuristics on one thread.
+static void copySettings(squeezer *ctx, const squeezer *settings) {
+  ctx->binWidth = settings->binWidth;
+  ctx->binHeight = settings->binHeight;
+  ctx->jobs = 1;
+  ctx->algorithm = settings->algorithm;
+  ctx->sizeRule = settings->sizeRule;
+  ctx->sizeMultiple = settings->sizeMultiple;
+  ctx->maxSize = settings->maxSize;
+  ctx->crop = settings->crop;
+  ctx->optimizeSeconds = settings->optimizeSeconds;
+  ctx->optimizeIterations = settings->optimizeIterations;
+  ctx->seed = settings->seed;
+  ctx->beamWidth = settings->beamWidth;
+  ctx->exactSeconds = settings->exactSeconds;
+  ctx->budgetSeconds = settings->budgetSeconds;
+  ctx->model = settings->model;
+  ctx->square = settings->square;
+  ctx->streaming = settings->streaming;
+  ctx->multiPage = settings->multiPage;
+  ctx->verbose = settings->verbose;
+  ctx->border = settings->border;
+  ctx->allowRotations = settings->allowRotations;
+}
+
+static void runBatchJob(squeezer *ctx, const squeezer *settings,
+    squeezerBatchJob *job) {
+  double start = sysOpsGetTime();
+  int result;
+  copySettings(ctx, settings);
+  job->result = -1;
+  result = squeezerDoDir(ctx, job->dir);
+  if (result < 0) {
+    job->error = "squeezerDoDir failed";
+  } else if (0 != squeezerOutputImage(ctx, job->outputTexture)) {
+    job->error = "squeezerOutputImage failed";
+  } else if (0 != squeezerOutputXml(ctx, job->outputInfo)) {
+    job->error = "squeezerOutputXml failed";
+  } else {
+    job->result = result;
+    job->error = 0;
+  }
+  releaseSqueezer(ctx);
+  job->seconds = sysOpsGetTime() - start;
+}
+
+static void batchWorkerRun(void *param) {
+  batchWorker *worker = (batchWorker *)param;
+  batchQueue *queue = worker->queue;
+  for (;;) {
+    squeezerBatchJob *job;
+    int jobIndex;
+    sysOpsMutexLock(queue->mutex);
+    jobIndex = queue->nextJob++;
+    sysOpsMutexUnlock(queue->mutex);
+    if (jobIndex >= queue->jobCount) {
+      break;
+    }
+    job = &queue->jobs[queue->order[jobIndex]];
+    runBatchJob(&worker->ctx, queue->settings, job);
+    if (job->result < 0) {
+      sysOpsMutexLock(queue->mutex);
+      ++queue->failedCount;
+      sysOpsMutexUnlock(queue->mutex);
+    }
+  }
+}
+
+int squeezerDoBatch(squeezer *ctx, squeezerBatchJob *jobs, int jobCount) {
+  sysOpsThread *threads[SQUEEZER_MAX_JOBS];
+  int threadCount = 0;
+  batchWorker *workers;
+  batchKey *keys;
+  batchQueue queue;
+  int workerCount = ctx->jobs > 0 ? ctx->jobs : sysOpsGetCpuCount();
+  int index;
+  releaseSqueezer(ctx);
+  workerCount = MAX(1, MIN(MIN(workerCount, jobCount), SQUEEZER_MAX_JOBS));
+  memset(&queue, 0, sizeof(queue));
+  queue.settings = ctx;
+  queue.jobs = jobs;
+  queue.jobCount = jobCount;
+  queue.order = (int *)malloc(sizeof(int) * MAX(1, jobCount));
+  keys = (batchKey *)malloc(sizeof(batchKey) * MAX(1, jobCount));
+  workers = (batchWorker *)calloc(workerCount, sizeof(batchWorker));
+  queue.mutex = sysOpsMutexCreate();
+  if (!queue.order || !keys || !workers || !queue.mutex) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "create queue failed");
+    free(queue.order);
+    free(keys);
+    free(workers);
+    if (queue.mutex) {
+      sysOpsMutexDestroy(queue.mutex);
+    }
+    return -1;
+  }
+  // The biggest atlases go first so that no worker picks up a long one
+  // while the others run out of work.
+  for (index = 0; index < jobCount; ++index) {
+    keys[index].fileCount = countDirEntries(jobs[index].dir);
+    keys[index].index = index;
+  }
+  qsort(keys, jobCount, sizeof(batchKey), compareBatchKeys);
+  for (index = 0; index < jobCount; ++index) {
+    queue.order[index] = keys[index].index;
+  }
+  free(keys);
+  for (index = 0; index < workerCount; ++index) {
+    workers[index].queue = &queue;
+    initSqueezer(&workers[index].ctx);
+  }
+  // The calling thread is one of the workers.
+  for (index = 1; index < workerCount; ++index) {
+    sysOpsThread *thread = sysOpsThreadCreate(batchWorkerRun,
+      &workers[index]);
+    if (!thread) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "sysOpsThreadCreate failed");
+      break;
+    }
+    threads[threadCount++] = thread;
+  }
+  batchWorkerRun(&workers[0]);
+  for (index = 0; index < threadCount; ++index) {
+    sysOpsThreadJoin(threads[index]);
+  }
+  for (index = 0; index < workerCount; ++index) {
+    releaseSqueezer(&workers[index].ctx);
+  }
+  free(workers);
+  free(queue.order);
+  sysOpsMutexDestroy(queue.mutex);
+  if (queue.failedCount > 0) {
+    fprintf(stderr, "%s: %d of %d atlases failed\n", __FUNCTION__,
+      queue.failedCount, jobCount);
+    for (index = 0; index < jobCount; ++index) {
+      if (jobs[index].result < 0) {
+        fprintf(stderr, "    %s: %s\n", jobs[index].dir, jobs[index].error);
+      }
+    }
+  }
+  return queue.failedCount;
+}
@@ -18,13 +18,134 @@
 
 typedef struct squeezer squeezer;
 
+// One atlas of squeezerDoBatch: the image dir and where its texture and
+// XML info go. result, error and seconds are filled in by the batch;
+// result is what squeezerDoDir returned, or -1 if writing failed.
+typedef struct squeezerBatchJob {
+  const char *dir;
+  const char *outputTexture;
+  const char *outputInfo;
+  int result;
+  const char *error;
+  double seconds;
+} squeezerBatchJob;
+
+enum squeezerAlgorithm {
+  squeezerMaxRects, ///< Tries the five MaxRects heuristics, best occupancy.
+  squeezerSkyline, ///< Skyline packing, much faster on big inputs.
+  squeezerGuillotine ///< Guillotine packing, close to MaxRects for a fraction of the time.
+};
+
+enum squeezerSizeRule {
+  squeezerSizeFixed, ///< Uses the bin width and height as given.
+  squeezerSizePowerOfTwo, ///< Searches the smallest power of two bin.
+  squeezerSizeMultiple ///< Searches the smallest bin with sides a multiple of N.
+};
+
+enum squeezerCrop {
+  squeezerCropNone, ///< Keeps the whole bin.
+  squeezerCropTight, ///< Crops the texture to the bounding box of the sprites.
+  squeezerCropPowerOfTwo ///< Crops to the smallest power of two box holding the sprites.
+};
+
 squeezer *squeezerCreate(void);
 void squeezerSetBinWidth(squeezer *ctx, int width);
 void squeezerSetBinHeight(squeezer *ctx, int height);
 void squeezerSetAllowRotations(squeezer *ctx, int allowRotations);
 void squeezerSetVerbose(squeezer *ctx, int verbose);
 void squeezerSetHasBorder(squeezer *ctx, int hasBorder);
+void squeezerSetJobs(squeezer *ctx, int jobs);
+void squeezerSetAlgorithm(squeezer *ctx, enum squeezerAlgorithm algorithm);
+// Packs each sprite with an online skyline as soon as it is decoded,
+// instead of decoding the whole directory first.
+void squeezerSetStreaming(squeezer *ctx, int streaming);
+// Spills the images that do not fit into more pages of the same size;
+// squeezerOutputImage then writes one texture per page, name_N.ext.
+void squeezerSetMultiPage(squeezer *ctx, int multiPage);
+int squeezerGetPageCount(squeezer *ctx);
+// Searches the smallest bin the rule allows instead of using the bin width
+// and height; multiple is the N of squeezerSizeMultiple.
+void squeezerSetAutoSize(squeezer *ctx, enum squeezerSizeRule rule,
+  int multiple);
+void squeezerSetSquare(squeezer *ctx, int square);
+// Largest side the auto size search may pick, 4096 by default.
+void squeezerSetMaxSize(squeezer *ctx, int maxSize);
+// Layouts are always scored by the box the sprites use; with a crop the
+// texture is also cut down to that box, and the bin size getters and the
+// info output report the cropped size.
+void squeezerSetCrop(squeezer *ctx, enum squeezerCrop crop);
+// After the heuristics, anneals the insertion order and heuristic on one
+// chain per job for a few points of occupancy or a page less, and keeps
+// the result if it beats them. It stops after seconds of wall clock or
+// iterations per chain, whichever comes first; 0 means no such limit. The
+// same seed, job count and iterations give the same layout.
+void squeezerSetOptimizeTime(squeezer *ctx, double seconds);
+void squeezerSetOptimizeIterations(squeezer *ctx, int iterations);
+void squeezerSetSeed(squeezer *ctx, unsigned int seed);
+// Above 1, each MaxRects heuristic keeps that many partial layouts per
+// step instead of one, spread over the jobs; slower, but never worse.
+// Multi-page spills still place greedily.
+void squeezerSetBeamWidth(squeezer *ctx, int beamWidth);
+// Above 0, sets of up to 40 images are laid out by an exact search for the
+// smallest box the size rule, or the crop of a fixed bin, allows. When it
+// takes longer than seconds the heuristics take over as usual.
+void squeezerSetExact(squeezer *ctx, double seconds);
+// Above 0, squeezerDoDir stops searching that many seconds after it
+// starts and uses the best complete layout found by then, which is at
+// worst a single skyline pass. Extra pages are always laid out in full.
+void squeezerSetTimeBudget(squeezer *ctx, double seconds);
+// Loads a model saved by squeezerCalibrate, for the algorithm set at the
+// time. Each image set then runs only the heuristics that won most sets
+// of the same profile, falling back to the whole sweep when the profile
+// is new or they fit nothing.
+int squeezerLoadModel(squeezer *ctx, const char *filename);
+// Runs the whole sweep on every directory below dir that has no
+// subdirectories, counts which heuristics win per profile, adds the
+// counts to any model loaded before and saves it as modelFilename.
+int squeezerCalibrate(squeezer *ctx, const char *dir,
+  const char *modelFilename);
+// Reads a layout written by squeezerOutputXml. Later runs leave every
+// image that kept its name and trimmed size where that layout had it, so
+// delta patches of the texture stay small, and fit the new and resized
+// ones into the space left; only when they do not fit is everything
+// packed again. Auto size keeps the size of the previous texture. 0 as
+// filename forgets the layout.
+int squeezerSetPreviousLayout(squeezer *ctx, const char *filename);
+// Images of the last run left in place, and the pixels of the sprites of
+// either layout that moved, appeared, went away or changed size.
+int squeezerGetKeptCount(squeezer *ctx);
+unsigned long long squeezerGetChangedPixels(squeezer *ctx);
+// Counts the pixels the texture of the first page changed from the
+// texture in filename, for sprites redrawn in place too.
+int squeezerCompareTexture(squeezer *ctx, const char *filename,
+  unsigned long long *changedPixels);
+int squeezerGetBinWidth(squeezer *ctx);
+int squeezerGetBinHeight(squeezer *ctx);
+// Sizes tried by the last auto size search, in the order they were tried.
+// Returns 1 if the images fit into width x height.
+int squeezerGetTriedSizeCount(squeezer *ctx);
+int squeezerGetTriedSize(squeezer *ctx, int index, int *width, int *height,
+  double *seconds);
+// Returns 0 after a full search, 1 when the time budget cut the search
+// short and the layout is the best found by then, -1 on errors.
 int squeezerDoDir(squeezer *ctx, const char *dir);
+// Packs and writes every atlas of jobs with the options of ctx, on a pool
+// of as many threads as squeezerSetJobs asks for. Each worker takes the
+// next atlas as soon as it is done with one, biggest dir first, and each
+// atlas runs its heuristics on its worker alone. A failed atlas does not
+// stop the others; its job gets result -1 and what failed. Returns the
+// number of failed atlases, after listing them on stderr, or -1 if the
+// pool could not start.
+int squeezerDoBatch(squeezer *ctx, squeezerBatchJob *jobs, int jobCount);
+// Edit the layout of the last squeezerDoDir in place: the other images
+// keep their spots and only the box of the edited one is composited
+// again. Images are matched by file name without the directory; an update
+// loads the image again from where it came from. The bin keeps its size,
+// so these return 1 and change nothing when there is no room left, 0 when
+// done and -1 on errors. Layouts of more than one page cannot be edited.
+int squeezerAddImage(squeezer *ctx, const char *filename);
+int squeezerRemoveImage(squeezer *ctx, const char *filename);
+int squeezerUpdateImage(squeezer *ctx, const char *filename);
 void squeezerDestroy(squeezer *ctx);
 int squeezerOutputImage(squeezer *ctx, const char *filename);
 int squeezerOutputXml(squeezer *ctx, const char *filename);
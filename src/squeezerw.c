@@ -25,6 +25,24 @@ static int binWidth = 512;
 static int binHeight = 512;
 static int allowRotations = 1;
 static int verbose = 0;
+static int streaming = 0;
+static int multiPage = 0;
+static enum squeezerSizeRule sizeRule = squeezerSizeFixed;
+static int sizeMultiple = 1;
+static int square = 0;
+static int maxSize = 4096;
+static enum squeezerCrop crop = squeezerCropNone;
+static double optimizeSeconds = 0;
+static int optimizeIterations = 0;
+static unsigned int seed = 0;
+static int beamWidth = 1;
+static double exactSeconds = 0;
+static double budgetSeconds = 0;
+static const char *modelFilename = 0;
+static const char *calibrateFilename = 0;
+static const char *previousLayoutFilename = 0;
+static const char *previousTextureFilename = 0;
+static const char *batchFilename = 0;
 static const char *outputTextureFilename = "squeezer.png";
 static const char *outputInfoFilename = "squeezer.xml";
 static const char *infoHeader = 0;
@@ -32,6 +50,8 @@ static const char *infoFooter = 0;
 static const char *infoBody = 0;
 static const char *infoSplit = 0;
 static int border = 0;
+static int jobs = 0;
+static enum squeezerAlgorithm algorithm = squeezerMaxRects;
 
 static void usage(void) {
   fprintf(stderr, "squeezerw " SQUEEZERW_VER "\n"
@@ -47,6 +67,25 @@ static void usage(void) {
     "        --infoBody <output body template>\n"
     "        --infoSplit <output body split template>\n"
     "        --infoFooter <output footer template>\n"
+    "        --jobs <worker threads, 0 for one per cpu>\n"
+    "        --algorithm <maxrects/skyline/guillotine>\n"
+    "        --autoSize <off/pow2/multiple of N>\n"
+    "        --square <1/0/true/false/yes/no>\n"
+    "        --maxSize <largest auto size side>\n"
+    "        --multiPage <1/0/true/false/yes/no>\n"
+    "        --crop <off/tight/pow2>\n"
+    "        --optimize <seconds to search for a better layout>\n"
+    "        --optimizeIterations <search steps per job, 0 for no limit>\n"
+    "        --seed <random seed of the search>\n"
+    "        --beamWidth <maxrects partial layouts kept per step>\n"
+    "        --exact <seconds to search for the smallest layout>\n"
+    "        --timeBudget <seconds before the best layout so far is used>\n"
+    "        --model <heuristic model filename>\n"
+    "        --calibrate <model filename to save, dir is a tree of sets>\n"
+    "        --previousLayout <xml of a previous build to keep sprites of>\n"
+    "        --previousTexture <texture of that build to count changes>\n"
+    "        --batch <job file, a line of dir texture info per atlas>\n"
+    "        --stream\n"
     "        --verbose\n"
     "        --version\n"
     "    format specifiers of infoHeader/infoBody/infoFooter:\n"
@@ -62,6 +101,7 @@ static void usage(void) {
     "        %%c: original width\n"
     "        %%r: original height\n"
     "        %%f: 1 if rotated else 0\n"
+    "        %%p: page index\n"
     "        and '\\n', '\\r', '\\t'\n");
 }
 
@@ -77,8 +117,99 @@ static int parseBooleanParam(const char *param) {
   return 1;
 }
 
+// A batch job with room for its paths.
+typedef struct batchLine {
+  char dir[780];
+  char outputTexture[780];
+  char outputInfo[780];
+} batchLine;
+
+// Reads a job file: one atlas per line as the image dir, the texture and
+// the info filename, separated by blanks. Empty lines and lines starting
+// with '#' are skipped.
+static int readBatchFile(const char *filename, batchLine **lines,
+    squeezerBatchJob **jobs) {
+  char buffer[2400];
+  int count = 0;
+  int capacity = 0;
+  int index;
+  FILE *fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "%s: fopen %s failed\n", __FUNCTION__, filename);
+    return -1;
+  }
+  *lines = 0;
+  while (fgets(buffer, sizeof(buffer), fp)) {
+    batchLine *line;
+    char first[2];
+    if (1 != sscanf(buffer, " %1s", first) || '#' == first[0]) {
+      continue;
+    }
+    if (count == capacity) {
+      batchLine *newLines;
+      capacity = capacity ? capacity * 2 : 64;
+      newLines = (batchLine *)realloc(*lines, sizeof(batchLine) * capacity);
+      if (!newLines) {
+        fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+        free(*lines);
+        fclose(fp);
+        return -1;
+      }
+      *lines = newLines;
+    }
+    line = &(*lines)[count];
+    if (3 != sscanf(buffer, "%779s %779s %779s", line->dir,
+        line->outputTexture, line->outputInfo)) {
+      fprintf(stderr, "%s: need dir texture info: %s", __FUNCTION__, buffer);
+      free(*lines);
+      fclose(fp);
+      return -1;
+    }
+    ++count;
+  }
+  fclose(fp);
+  *jobs = (squeezerBatchJob *)calloc(count ? count : 1,
+    sizeof(squeezerBatchJob));
+  if (!*jobs) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    free(*lines);
+    return -1;
+  }
+  for (index = 0; index < count; ++index) {
+    (*jobs)[index].dir = (*lines)[index].dir;
+    (*jobs)[index].outputTexture = (*lines)[index].outputTexture;
+    (*jobs)[index].outputInfo = (*lines)[index].outputInfo;
+  }
+  return count;
+}
+
+static int runBatch(squeezer *ctx) {
+  batchLine *lines;
+  squeezerBatchJob *jobs;
+  int failedCount;
+  int index;
+  int count = readBatchFile(batchFilename, &lines, &jobs);
+  if (count < 0) {
+    return -1;
+  }
+  failedCount = squeezerDoBatch(ctx, jobs, count);
+  for (index = 0; verbose && index < count; ++index) {
+    printf("%s: %s, %.2fms\n", jobs[index].dir,
+      jobs[index].result < 0 ? jobs[index].error :
+        (1 == jobs[index].result ? "partial" : "done"),
+      jobs[index].seconds * 1000);
+  }
+  if (failedCount >= 0) {
+    printf("packed %d of %d atlases\n", count - failedCount, count);
+  }
+  free(jobs);
+  free(lines);
+  return 0 == failedCount ? 0 : -1;
+}
+
 static int squeezerw(void) {
   squeezer *ctx = squeezerCreate();
+  int result;
   if (!ctx) {
     fprintf(stderr, "%s: squeezerCreate failed\n", __FUNCTION__);
     return -1;
@@ -88,11 +219,88 @@ static int squeezerw(void) {
   squeezerSetAllowRotations(ctx, allowRotations);
   squeezerSetVerbose(ctx, verbose);
   squeezerSetHasBorder(ctx, border);
-  if (0 != squeezerDoDir(ctx, dir)) {
+  squeezerSetJobs(ctx, jobs);
+  squeezerSetAlgorithm(ctx, algorithm);
+  squeezerSetStreaming(ctx, streaming);
+  squeezerSetMultiPage(ctx, multiPage);
+  squeezerSetAutoSize(ctx, sizeRule, sizeMultiple);
+  squeezerSetSquare(ctx, square);
+  squeezerSetMaxSize(ctx, maxSize);
+  squeezerSetCrop(ctx, crop);
+  squeezerSetOptimizeTime(ctx, optimizeSeconds);
+  squeezerSetOptimizeIterations(ctx, optimizeIterations);
+  squeezerSetSeed(ctx, seed);
+  squeezerSetBeamWidth(ctx, beamWidth);
+  squeezerSetExact(ctx, exactSeconds);
+  squeezerSetTimeBudget(ctx, budgetSeconds);
+  if (modelFilename && 0 != squeezerLoadModel(ctx, modelFilename)) {
+    fprintf(stderr, "%s: squeezerLoadModel failed\n", __FUNCTION__);
+    squeezerDestroy(ctx);
+    return -1;
+  }
+  if (previousLayoutFilename &&
+      0 != squeezerSetPreviousLayout(ctx, previousLayoutFilename)) {
+    fprintf(stderr, "%s: squeezerSetPreviousLayout failed\n", __FUNCTION__);
+    squeezerDestroy(ctx);
+    return -1;
+  }
+  if (batchFilename) {
+    result = runBatch(ctx);
+    squeezerDestroy(ctx);
+    return result;
+  }
+  if (calibrateFilename) {
+    result = squeezerCalibrate(ctx, dir, calibrateFilename);
+    if (0 != result) {
+      fprintf(stderr, "%s: squeezerCalibrate failed\n", __FUNCTION__);
+    }
+    squeezerDestroy(ctx);
+    return result;
+  }
+  result = squeezerDoDir(ctx, dir);
+  if (result < 0) {
     fprintf(stderr, "%s: squeezerDoDir failed\n", __FUNCTION__);
     squeezerDestroy(ctx);
     return -1;
   }
+  if (1 == result) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__,
+      "time budget ran out, using the best layout found");
+  }
+  if (squeezerSizeFixed != sizeRule && !streaming) {
+    int count = squeezerGetTriedSizeCount(ctx);
+    int index;
+    for (index = 0; index < count; ++index) {
+      int width;
+      int height;
+      double seconds;
+      int fits = squeezerGetTriedSize(ctx, index, &width, &height, &seconds);
+      printf("tried %dx%d: %s, %.2fms\n", width, height,
+        fits ? "fits" : "does not fit", seconds * 1000);
+    }
+    printf("chosen size %dx%d\n", squeezerGetBinWidth(ctx),
+      squeezerGetBinHeight(ctx));
+  }
+  if (squeezerCropNone != crop) {
+    printf("cropped to %dx%d\n", squeezerGetBinWidth(ctx),
+      squeezerGetBinHeight(ctx));
+  }
+  if (squeezerGetPageCount(ctx) > 1) {
+    printf("packed into %d pages\n", squeezerGetPageCount(ctx));
+  }
+  // Compared before the output may overwrite the previous texture.
+  if (previousLayoutFilename) {
+    unsigned long long changedPixels = squeezerGetChangedPixels(ctx);
+    if (previousTextureFilename && 0 != squeezerCompareTexture(ctx,
+        previousTextureFilename, &changedPixels)) {
+      fprintf(stderr, "%s: squeezerCompareTexture failed\n", __FUNCTION__);
+      squeezerDestroy(ctx);
+      return -1;
+    }
+    printf("kept %d sprites in place, %s%llu pixels changed\n",
+      squeezerGetKeptCount(ctx), previousTextureFilename ? "" : "at most ",
+      changedPixels);
+  }
   if (0 != squeezerOutputImage(ctx, outputTextureFilename)) {
     fprintf(stderr, "%s: squeezerOutputImage failed\n", __FUNCTION__);
     squeezerDestroy(ctx);
@@ -148,6 +356,78 @@ int main(int argc, char *argv[]) {
         infoSplit = argv[++i];
       } else if (0 == strcmp(param, "--infoFooter")) {
         infoFooter = argv[++i];
+      } else if (0 == strcmp(param, "--jobs")) {
+        jobs = atoi(argv[++i]);
+      } else if (0 == strcmp(param, "--algorithm")) {
+        const char *name = argv[++i];
+        if (0 == strcmp(name, "maxrects")) {
+          algorithm = squeezerMaxRects;
+        } else if (0 == strcmp(name, "skyline")) {
+          algorithm = squeezerSkyline;
+        } else if (0 == strcmp(name, "guillotine")) {
+          algorithm = squeezerGuillotine;
+        } else {
+          usage();
+          fprintf(stderr, "%s: unknown algorithm: %s\n", __FUNCTION__, name);
+          return -1;
+        }
+      } else if (0 == strcmp(param, "--autoSize")) {
+        const char *rule = argv[++i];
+        if (0 == strcmp(rule, "off")) {
+          sizeRule = squeezerSizeFixed;
+        } else if (0 == strcmp(rule, "pow2")) {
+          sizeRule = squeezerSizePowerOfTwo;
+        } else if (atoi(rule) > 0) {
+          sizeRule = squeezerSizeMultiple;
+          sizeMultiple = atoi(rule);
+        } else {
+          usage();
+          fprintf(stderr, "%s: unknown auto size: %s\n", __FUNCTION__, rule);
+          return -1;
+        }
+      } else if (0 == strcmp(param, "--square")) {
+        square = parseBooleanParam(argv[++i]);
+      } else if (0 == strcmp(param, "--maxSize")) {
+        maxSize = atoi(argv[++i]);
+      } else if (0 == strcmp(param, "--multiPage")) {
+        multiPage = parseBooleanParam(argv[++i]);
+      } else if (0 == strcmp(param, "--crop")) {
+        const char *name = argv[++i];
+        if (0 == strcmp(name, "off")) {
+          crop = squeezerCropNone;
+        } else if (0 == strcmp(name, "tight")) {
+          crop = squeezerCropTight;
+        } else if (0 == strcmp(name, "pow2")) {
+          crop = squeezerCropPowerOfTwo;
+        } else {
+          usage();
+          fprintf(stderr, "%s: unknown crop: %s\n", __FUNCTION__, name);
+          return -1;
+        }
+      } else if (0 == strcmp(param, "--optimize")) {
+        optimizeSeconds = atof(argv[++i]);
+      } else if (0 == strcmp(param, "--optimizeIterations")) {
+        optimizeIterations = atoi(argv[++i]);
+      } else if (0 == strcmp(param, "--seed")) {
+        seed = (unsigned int)strtoul(argv[++i], 0, 10);
+      } else if (0 == strcmp(param, "--beamWidth")) {
+        beamWidth = atoi(argv[++i]);
+      } else if (0 == strcmp(param, "--exact")) {
+        exactSeconds = atof(argv[++i]);
+      } else if (0 == strcmp(param, "--timeBudget")) {
+        budgetSeconds = atof(argv[++i]);
+      } else if (0 == strcmp(param, "--model")) {
+        modelFilename = argv[++i];
+      } else if (0 == strcmp(param, "--calibrate")) {
+        calibrateFilename = argv[++i];
+      } else if (0 == strcmp(param, "--previousLayout")) {
+        previousLayoutFilename = argv[++i];
+      } else if (0 == strcmp(param, "--previousTexture")) {
+        previousTextureFilename = argv[++i];
+      } else if (0 == strcmp(param, "--batch")) {
+        batchFilename = argv[++i];
+      } else if (0 == strcmp(param, "--stream")) {
+        streaming = 1;
       } else if (0 == strcmp(param, "--verbose")) {
         verbose = 1;
       } else {
@@ -159,8 +439,13 @@ int main(int argc, char *argv[]) {
       dir = param;
     }
   }
-  if (!dir) {
+  if (!dir && !batchFilename) {
+    usage();
+    return -1;
+  }
+  if (batchFilename && infoBody) {
     usage();
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "--batch writes XML info only");
     return -1;
   }
   if (verbose) {
@@ -175,6 +460,25 @@ int main(int argc, char *argv[]) {
       "    --infoBody %s\n"
       "    --infoFooter %s\n"
       "    --infoSplit %s\n"
+      "    --jobs %d\n"
+      "    --algorithm %s\n"
+      "    --autoSize %s\n"
+      "    --square %s\n"
+      "    --maxSize %d\n"
+      "    --multiPage %s\n"
+      "    --crop %s\n"
+      "    --optimize %g\n"
+      "    --optimizeIterations %d\n"
+      "    --seed %u\n"
+      "    --beamWidth %d\n"
+      "    --exact %g\n"
+      "    --timeBudget %g\n"
+      "    --model %s\n"
+      "    --calibrate %s\n"
+      "    --previousLayout %s\n"
+      "    --previousTexture %s\n"
+      "    --batch %s\n"
+      "%s"
       "%s",
       binWidth,
       binHeight,
@@ -186,6 +490,28 @@ int main(int argc, char *argv[]) {
       infoBody ? infoBody : "",
       infoFooter ? infoFooter : "",
       infoSplit ? infoSplit : "",
+      jobs,
+      squeezerSkyline == algorithm ? "skyline" :
+        (squeezerGuillotine == algorithm ? "guillotine" : "maxrects"),
+      squeezerSizePowerOfTwo == sizeRule ? "pow2" :
+        (squeezerSizeMultiple == sizeRule ? "multiple" : "off"),
+      square ? "true" : "false",
+      maxSize,
+      multiPage ? "true" : "false",
+      squeezerCropTight == crop ? "tight" :
+        (squeezerCropPowerOfTwo == crop ? "pow2" : "off"),
+      optimizeSeconds,
+      optimizeIterations,
+      seed,
+      beamWidth,
+      exactSeconds,
+      budgetSeconds,
+      modelFilename ? modelFilename : "",
+      calibrateFilename ? calibrateFilename : "",
+      previousLayoutFilename ? previousLayoutFilename : "",
+      previousTextureFilename ? previousTextureFilename : "",
+      batchFilename ? batchFilename : "",
+      streaming ? "    --stream\n" : "",
       verbose ? "    --verbose\n" : "");
   }
   return squeezerw();
@@ -0,0 +1,231 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "sysops.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+struct sysOpsThread {
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+  sysOpsThreadFunc func;
+  void *arg;
+};
+
+struct sysOpsMutex {
+#ifdef _WIN32
+  CRITICAL_SECTION handle;
+#else
+  pthread_mutex_t handle;
+#endif
+};
+
+struct sysOpsCondition {
+#ifdef _WIN32
+  CONDITION_VARIABLE handle;
+#else
+  pthread_cond_t handle;
+#endif
+};
+
+#ifdef _WIN32
+static DWORD WINAPI threadEntry(LPVOID param) {
+  sysOpsThread *thread = (sysOpsThread *)param;
+  thread->func(thread->arg);
+  return 0;
+}
+#else
+static void *threadEntry(void *param) {
+  sysOpsThread *thread = (sysOpsThread *)param;
+  thread->func(thread->arg);
+  return 0;
+}
+#endif
+
+sysOpsThread *sysOpsThreadCreate(sysOpsThreadFunc func, void *arg) {
+  sysOpsThread *thread = (sysOpsThread *)calloc(1, sizeof(sysOpsThread));
+  if (!thread) {
+    fprintf(stderr, "%s: calloc failed\n", __FUNCTION__);
+    return 0;
+  }
+  thread->func = func;
+  thread->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(0, 0, threadEntry, thread, 0, 0);
+  if (!thread->handle) {
+    fprintf(stderr, "%s: CreateThread failed\n", __FUNCTION__);
+    free(thread);
+    return 0;
+  }
+#else
+  if (0 != pthread_create(&thread->handle, 0, threadEntry, thread)) {
+    fprintf(stderr, "%s: pthread_create failed\n", __FUNCTION__);
+    free(thread);
+    return 0;
+  }
+#endif
+  return thread;
+}
+
+void sysOpsThreadJoin(sysOpsThread *thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, 0);
+#endif
+  free(thread);
+}
+
+sysOpsMutex *sysOpsMutexCreate(void) {
+  sysOpsMutex *mutex = (sysOpsMutex *)calloc(1, sizeof(sysOpsMutex));
+  if (!mutex) {
+    fprintf(stderr, "%s: calloc failed\n", __FUNCTION__);
+    return 0;
+  }
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->handle);
+#else
+  if (0 != pthread_mutex_init(&mutex->handle, 0)) {
+    fprintf(stderr, "%s: pthread_mutex_init failed\n", __FUNCTION__);
+    free(mutex);
+    return 0;
+  }
+#endif
+  return mutex;
+}
+
+void sysOpsMutexLock(sysOpsMutex *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->handle);
+#else
+  pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void sysOpsMutexUnlock(sysOpsMutex *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->handle);
+#else
+  pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+void sysOpsMutexDestroy(sysOpsMutex *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->handle);
+#else
+  pthread_mutex_destroy(&mutex->handle);
+#endif
+  free(mutex);
+}
+
+sysOpsCondition *sysOpsConditionCreate(void) {
+  sysOpsCondition *cond = (sysOpsCondition *)calloc(1,
+    sizeof(sysOpsCondition));
+  if (!cond) {
+    fprintf(stderr, "%s: calloc failed\n", __FUNCTION__);
+    return 0;
+  }
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->handle);
+#else
+  if (0 != pthread_cond_init(&cond->handle, 0)) {
+    fprintf(stderr, "%s: pthread_cond_init failed\n", __FUNCTION__);
+    free(cond);
+    return 0;
+  }
+#endif
+  return cond;
+}
+
+void sysOpsConditionWait(sysOpsCondition *cond, sysOpsMutex *mutex) {
+#ifdef _WIN32
+  SleepConditionVariableCS(&cond->handle, &mutex->handle, INFINITE);
+#else
+  pthread_cond_wait(&cond->handle, &mutex->handle);
+#endif
+}
+
+void sysOpsConditionBroadcast(sysOpsCondition *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->handle);
+#else
+  pthread_cond_broadcast(&cond->handle);
+#endif
+}
+
+void sysOpsConditionDestroy(sysOpsCondition *cond) {
+#ifndef _WIN32
+  pthread_cond_destroy(&cond->handle);
+#endif
+  free(cond);
+}
+
+int sysOpsGetCpuCount(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#endif
+}
+
+double sysOpsGetTime(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+unsigned int sysOpsAtomicLoad(const unsigned int *value) {
+#ifdef _WIN32
+  return (unsigned int)InterlockedCompareExchange((volatile LONG *)value,
+    0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+void sysOpsAtomicStore(unsigned int *value, unsigned int newValue) {
+#ifdef _WIN32
+  InterlockedExchange((volatile LONG *)value, (LONG)newValue);
+#else
+  __atomic_store_n(value, newValue, __ATOMIC_RELAXED);
+#endif
+}
@@ -0,0 +1,43 @@
+/* Copyright (c) huxingyi@msn.com All rights reserved.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SYS_OPS_H
+#define SYS_OPS_H
+
+typedef struct sysOpsThread sysOpsThread;
+typedef struct sysOpsMutex sysOpsMutex;
+typedef struct sysOpsCondition sysOpsCondition;
+typedef void (*sysOpsThreadFunc)(void *arg);
+
+sysOpsThread *sysOpsThreadCreate(sysOpsThreadFunc func, void *arg);
+void sysOpsThreadJoin(sysOpsThread *thread);
+sysOpsMutex *sysOpsMutexCreate(void);
+void sysOpsMutexLock(sysOpsMutex *mutex);
+void sysOpsMutexUnlock(sysOpsMutex *mutex);
+void sysOpsMutexDestroy(sysOpsMutex *mutex);
+sysOpsCondition *sysOpsConditionCreate(void);
+// Releases mutex while waiting and holds it again on return.
+void sysOpsConditionWait(sysOpsCondition *cond, sysOpsMutex *mutex);
+void sysOpsConditionBroadcast(sysOpsCondition *cond);
+void sysOpsConditionDestroy(sysOpsCondition *cond);
+int sysOpsGetCpuCount(void);
+// Seconds from a monotonic clock, for timing work across threads.
+double sysOpsGetTime(void);
+// Atomic load and store without ordering, for a value other threads read
+// while one of them updates it, such as a bound that only ever tightens.
+unsigned int sysOpsAtomicLoad(const unsigned int *value);
+void sysOpsAtomicStore(unsigned int *value, unsigned int newValue);
+
+#endif